@@ -0,0 +1,24 @@
+/*
+ * NeTV DRM driver userspace interface
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef NETV_DRM_H
+#define NETV_DRM_H
+
+#include <drm/drm.h>
+
+/*
+ * DIRTYFB damage is coalesced and flushed to the device at most once per
+ * refresh interval. DRM_IOCTL_NETV_FLUSH uploads everything pending on the
+ * scanout buffer right away and returns once it reached the device.
+ */
+#define DRM_NETV_FLUSH			0x00
+
+#define DRM_IOCTL_NETV_FLUSH		DRM_IO(DRM_COMMAND_BASE + DRM_NETV_FLUSH)
+
+#endif /* NETV_DRM_H */
@@ -12,6 +12,7 @@
 #include <linux/io.h>
 #include <linux/fb.h>
 #include <linux/console.h>
+#include <linux/module.h>
 
 #include <drm/drmP.h>
 #include <drm/drm_crtc.h>
@@ -53,54 +54,126 @@ static struct simplefb_format simplefb_formats[] = SIMPLEFB_FORMATS;
 
 /* ---------------------------------------------------------------------- */
 
-#if 0
-static void netv_vga_writeb(struct sdrm_device *netv, u16 ioport, u8 val)
+/*
+ * Scanout registers. Bitstreams that can scan out from anywhere in BAR0
+ * expose bochs-compatible VBE DISPI registers in BAR2; without them the
+ * scanout is fixed at offset 0 and every flip has to be blitted there.
+ */
+#define VBE_DISPI_MMIO_OFFSET		0x500
+
+#define VBE_DISPI_INDEX_ID		0x0
+#define VBE_DISPI_INDEX_XRES		0x1
+#define VBE_DISPI_INDEX_YRES		0x2
+#define VBE_DISPI_INDEX_BPP		0x3
+#define VBE_DISPI_INDEX_ENABLE		0x4
+#define VBE_DISPI_INDEX_BANK		0x5
+#define VBE_DISPI_INDEX_VIRT_WIDTH	0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT	0x7
+#define VBE_DISPI_INDEX_X_OFFSET	0x8
+#define VBE_DISPI_INDEX_Y_OFFSET	0x9
+
+#define VBE_DISPI_ID0			0xB0C0
+#define VBE_DISPI_ENABLED		0x01
+#define VBE_DISPI_LFB_ENABLED		0x40
+
+static bool netv_soft_flip;
+module_param_named(soft_flip, netv_soft_flip, bool, 0444);
+MODULE_PARM_DESC(soft_flip,
+		 "Without scanout registers, flip by recording the base only, for testing (default: false)");
+
+static u16 netv_dispi_read(struct sdrm_device *netv, u16 reg)
 {
-#if 0
-	if (WARN_ON(ioport < 0x3c0 || ioport > 0x3df))
-		return;
+	return readw(netv->mmio + VBE_DISPI_MMIO_OFFSET + (reg << 1));
+}
 
-	if (netv->mmio) {
-		int offset = ioport - 0x3c0 + 0x400;
-		writeb(val, netv->mmio + offset);
-	} else {
-		outb(val, ioport);
-	}
-#endif
+static void netv_dispi_write(struct sdrm_device *netv, u16 reg, u16 val)
+{
+	writew(val, netv->mmio + VBE_DISPI_MMIO_OFFSET + (reg << 1));
 }
 
-static u16 netv_dispi_read(struct sdrm_device *netv, u16 reg)
+static void netv_dispi_set_mode(struct sdrm_device *netv,
+				struct drm_display_mode *mode)
 {
-	u16 ret = 0;
-#if 0
-	if (netv->mmio) {
-		int offset = 0x500 + (reg << 1);
-		ret = readw(netv->mmio + offset);
-	} else {
-		outw(reg, VBE_DISPI_IOPORT_INDEX);
-		ret = inw(VBE_DISPI_IOPORT_DATA);
-	}
-#endif
-	return ret;
+	u32 cpp = (netv->fb_bpp + 7) / 8;
+
+	DRM_DEBUG_DRIVER("%dx%d @ %d bpp, vy %lu\n",
+			 mode->hdisplay, mode->vdisplay, netv->fb_bpp,
+			 netv->fb_size / netv->fb_stride);
+
+	netv_dispi_write(netv, VBE_DISPI_INDEX_ENABLE,      0);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_BPP,         netv->fb_bpp);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_XRES,        mode->hdisplay);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_YRES,        mode->vdisplay);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_BANK,        0);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_VIRT_WIDTH,
+			 netv->fb_stride / cpp);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_VIRT_HEIGHT,
+			 netv->fb_size / netv->fb_stride);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_X_OFFSET,    0);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_Y_OFFSET,    0);
+
+	netv_dispi_write(netv, VBE_DISPI_INDEX_ENABLE,
+			 VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
 }
 
-static void netv_dispi_write(struct sdrm_device *netv, u16 reg, u16 val)
+static void netv_dispi_set_base(struct sdrm_device *netv, u32 offset)
 {
-#if 0
-	if (netv->mmio) {
-		int offset = 0x500 + (reg << 1);
-		writew(val, netv->mmio + offset);
-	} else {
-		outw(reg, VBE_DISPI_IOPORT_INDEX);
-		outw(val, VBE_DISPI_IOPORT_DATA);
+	u32 cpp = (netv->fb_bpp + 7) / 8;
+	u32 vy = offset / netv->fb_stride;
+	u32 vx = (offset % netv->fb_stride) / cpp;
+
+	netv_dispi_write(netv, VBE_DISPI_INDEX_X_OFFSET, vx);
+	netv_dispi_write(netv, VBE_DISPI_INDEX_Y_OFFSET, vy);
+}
+
+static const struct netv_hw_funcs netv_dispi_funcs = {
+	.name = "dispi",
+	.set_mode = netv_dispi_set_mode,
+	.set_base = netv_dispi_set_base,
+};
+
+/*
+ * Software stand-in for the scanout registers. Nothing reaches the
+ * display, but the flip path runs as with real registers and the base it
+ * programs can be checked in debugfs.
+ */
+static void netv_soft_set_mode(struct sdrm_device *netv,
+			       struct drm_display_mode *mode)
+{
+}
+
+static void netv_soft_set_base(struct sdrm_device *netv, u32 offset)
+{
+}
+
+static const struct netv_hw_funcs netv_soft_funcs = {
+	.name = "soft",
+	.set_mode = netv_soft_set_mode,
+	.set_base = netv_soft_set_base,
+};
+
+static void netv_hw_probe_regs(struct sdrm_device *netv, struct pci_dev *pdev)
+{
+	if ((pci_resource_flags(pdev, 2) & IORESOURCE_MEM) &&
+	    pci_resource_len(pdev, 2) >= PAGE_SIZE &&
+	    pci_request_region(pdev, 2, "netv-drm") == 0) {
+		netv->mmio = ioremap(pci_resource_start(pdev, 2), PAGE_SIZE);
+		if (netv->mmio &&
+		    (netv_dispi_read(netv, VBE_DISPI_INDEX_ID) & 0xfff0) ==
+		    VBE_DISPI_ID0) {
+			netv->hw = &netv_dispi_funcs;
+			return;
+		}
+
+		if (netv->mmio)
+			iounmap(netv->mmio);
+		netv->mmio = NULL;
+		pci_release_region(pdev, 2);
 	}
-#endif
+
+	if (netv_soft_flip)
+		netv->hw = &netv_soft_funcs;
 }
-#else
-#define netv_vga_writeb(netv, ioport, val)
-#define netv_dispi_read(netv, reg)
-#define netv_dispi_write(netv, reg, val)
-#endif
 
 int sdrm_hw_init(struct drm_device *dev, uint32_t flags)
 {
@@ -196,6 +269,9 @@ int sdrm_hw_init(struct drm_device *dev, uint32_t flags)
 		 ioaddr);
 	DRM_INFO("%dx%d @ %d bpp\n", netv->fb_width, netv->fb_height, netv->fb_bpp);
 
+	netv_hw_probe_regs(netv, pdev);
+	DRM_INFO("Page flips: %s\n", netv->hw ? netv->hw->name : "blit");
+
 	/*
 	if (netv->mmio && pdev->revision >= 2) {
 		qext_size = readl(netv->mmio + 0x600);
@@ -222,60 +298,75 @@ void sdrm_hw_fini(struct drm_device *dev)
 {
 	struct sdrm_device *netv = dev->dev_private;
 
-//	if (netv->mmio)
-//		iounmap(netv->mmio);
-//	if (netv->ioports)
-//		release_region(VBE_DISPI_IOPORT_INDEX, 2);
+	if (netv->mmio) {
+		iounmap(netv->mmio);
+		netv->mmio = NULL;
+		pci_release_region(dev->pdev, 2);
+	}
 	if (netv->fb_map)
 		iounmap(netv->fb_map);
+	netv->fb_map = NULL;
 	pci_release_region(dev->pdev, 0);
 }
 
+/**
+ * netv_hw_setmode - program the scanout for @mode
+ * @netv: device
+ * @mode: mode to program
+ *
+ * Atomic commits update planes before enabling the CRTC, so a base
+ * programmed by the plane update is restored afterwards.
+ */
 void netv_hw_setmode(struct sdrm_device *netv,
-		      struct drm_display_mode *mode)
+		     struct drm_display_mode *mode)
 {
-#if 0
-	netv->xres = mode->hdisplay;
-	netv->yres = mode->vdisplay;
-	netv->bpp = 24;
-	netv->stride = mode->hdisplay * (netv->bpp / 8);
-	netv->yres_virtual = netv->fb_size / netv->stride;
+	if (!netv->hw)
+		return;
 
-	DRM_DEBUG_DRIVER("%dx%d @ %d bpp, vy %d\n",
-			 netv->xres, netv->yres, netv->bpp,
-			 netv->yres_virtual);
+	netv->hw->set_mode(netv, mode);
+	if (netv->scanout_base)
+		netv->hw->set_base(netv, netv->scanout_base);
+}
 
-	netv_vga_writeb(netv, 0x3c0, 0x20); /* unblank */
+/**
+ * netv_hw_setbase - scan out from a different place in BAR0
+ * @netv: device
+ * @offset: byte offset of the first pixel into BAR0
+ */
+void netv_hw_setbase(struct sdrm_device *netv, u32 offset)
+{
+	if (!netv->hw || netv->scanout_base == offset)
+		return;
 
-	netv_dispi_write(netv, VBE_DISPI_INDEX_ENABLE,      0);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_BPP,         netv->bpp);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_XRES,        netv->xres);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_YRES,        netv->yres);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_BANK,        0);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_VIRT_WIDTH,  netv->xres);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_VIRT_HEIGHT,
-			  netv->yres_virtual);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_X_OFFSET,    0);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_Y_OFFSET,    0);
+	DRM_DEBUG_DRIVER("scanout base 0x%x -> 0x%x\n",
+			 netv->scanout_base, offset);
 
-	netv_dispi_write(netv, VBE_DISPI_INDEX_ENABLE,
-			  VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
-#endif
+	netv->hw->set_base(netv, offset);
+	netv->scanout_base = offset;
+	netv->flips++;
 }
 
-void netv_hw_setbase(struct sdrm_device *netv,
-		      int x, int y, u64 addr)
+/**
+ * netv_hw_can_flip - check whether @fb can be shown by moving the base
+ * @netv: device
+ * @fb: framebuffer about to be scanned out
+ *
+ * True for buffers in device memory with exactly the scanout's layout.
+ */
+bool netv_hw_can_flip(struct sdrm_device *netv, struct drm_framebuffer *fb)
 {
-#if 0
-	unsigned long offset = (unsigned long)addr +
-		y * netv->stride +
-		x * (netv->bpp / 8);
-	int vy = offset / netv->stride;
-	int vx = (offset % netv->stride) * 8 / netv->bpp;
-
-	DRM_DEBUG_DRIVER("x %d, y %d, addr %llx -> offset %lx, vx %d, vy %d\n",
-			 x, y, addr, offset, vx, vy);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_X_OFFSET, vx);
-	netv_dispi_write(netv, VBE_DISPI_INDEX_Y_OFFSET, vy);
-#endif
+	struct sdrm_framebuffer *sfb = to_sdrm_fb(fb);
+
+	if (!netv->hw || !sdrm_gem_is_vram(sfb->obj))
+		return false;
+
+	/* fake device memory is not in BAR0, only the stand-in can flip it */
+	if (netv->vram_fake && netv->hw != &netv_soft_funcs)
+		return false;
+
+	return fb->pixel_format == netv->fb_format &&
+	       fb->pitches[0] == netv->fb_stride &&
+	       fb->offsets[0] == 0 &&
+	       fb->width == netv->fb_width &&
+	       fb->height == netv->fb_height;
 }
@@ -99,11 +99,38 @@ static const struct drm_crtc_helper_funcs netv_kms_crtc_helper_funcs = {
 	.enable = netv_kms_crtc_enable,
 };
 
+/*
+ * The atomic helper refuses DRM_MODE_PAGE_FLIP_ASYNC, so the flag is
+ * passed to the plane update on the side: async flips move the base and
+ * complete right away instead of at the next vblank. Flips are serialized
+ * by the core and the update consumes the flag, so at worst a concurrent
+ * plain commit completes early.
+ */
+static int netv_kms_crtc_page_flip(struct drm_crtc *crtc,
+				   struct drm_framebuffer *fb,
+				   struct drm_pending_vblank_event *event,
+				   uint32_t flags)
+{
+	struct sdrm_device *pipe;
+	int ret;
+
+	pipe = container_of(crtc, struct sdrm_device, crtc);
+	WRITE_ONCE(pipe->flip_async, !!(flags & DRM_MODE_PAGE_FLIP_ASYNC));
+
+	ret = drm_atomic_helper_page_flip(crtc, fb, event,
+					  flags & ~DRM_MODE_PAGE_FLIP_ASYNC);
+	/* no update ran to consume the flag */
+	if (ret)
+		WRITE_ONCE(pipe->flip_async, false);
+
+	return ret;
+}
+
 static const struct drm_crtc_funcs netv_kms_crtc_funcs = {
 	.reset = drm_atomic_helper_crtc_reset,
 	.destroy = drm_crtc_cleanup,
 	.set_config = drm_atomic_helper_set_config,
-	.page_flip = drm_atomic_helper_page_flip,
+	.page_flip = netv_kms_crtc_page_flip,
 	.atomic_duplicate_state = drm_atomic_helper_crtc_duplicate_state,
 	.atomic_destroy_state = drm_atomic_helper_crtc_destroy_state,
 };
@@ -126,6 +153,7 @@ static int netv_kms_plane_atomic_check(struct drm_plane *plane,
 	struct drm_rect clip = { 0 };
 	struct sdrm_device *pipe;
 	struct drm_crtc_state *crtc_state;
+	int min_scale, max_scale;
 	bool visible;
 	int ret;
 
@@ -138,14 +166,21 @@ static int netv_kms_plane_atomic_check(struct drm_plane *plane,
 	if (!crtc_state->enable)
 		return 0; /* nothing to check when disabling or disabled */
 
+	/* uploads can scale, given scratch space for it, unless turning */
+	min_scale = DRM_PLANE_HELPER_NO_SCALING;
+	max_scale = DRM_PLANE_HELPER_NO_SCALING;
+	if (pipe->scale.scratch && plane_state->rotation == DRM_ROTATE_0) {
+		min_scale = SDRM_PLANE_MIN_SCALE;
+		max_scale = SDRM_PLANE_MAX_SCALE;
+	}
+
 	clip.x2 = crtc_state->adjusted_mode.hdisplay;
 	clip.y2 = crtc_state->adjusted_mode.vdisplay;
 	ret = drm_plane_helper_check_update(plane, &pipe->crtc,
 					    plane_state->fb,
 					    &src, &dest, &clip,
 					    plane_state->rotation,
-					    DRM_PLANE_HELPER_NO_SCALING,
-					    DRM_PLANE_HELPER_NO_SCALING,
+					    min_scale, max_scale,
 					    false, true, &visible);
 	if (ret)
 		return ret;
@@ -153,6 +188,19 @@ static int netv_kms_plane_atomic_check(struct drm_plane *plane,
 	if (!visible)
 		return -EINVAL;
 
+	/*
+	 * Planes that are neither scaled nor turned are shown by moving the
+	 * base through BAR0, which only pans vertically and only as far as
+	 * the memory behind it reaches.
+	 */
+	if (plane_state->rotation == DRM_ROTATE_0 &&
+	    plane_state->src_w >> 16 == plane_state->crtc_w &&
+	    plane_state->src_h >> 16 == plane_state->crtc_h &&
+	    (plane_state->src_x ||
+	     (plane_state->src_y >> 16) + plane_state->crtc_h >
+	     pipe->fb_vheight))
+		return -EINVAL;
+
 	if (!pipe->funcs || !pipe->funcs->check)
 		return 0;
 
@@ -176,7 +224,167 @@ static const struct drm_plane_helper_funcs netv_kms_plane_helper_funcs = {
 	.atomic_update = netv_kms_plane_atomic_update,
 };
 
+static void netv_kms_plane_reset(struct drm_plane *plane)
+{
+	struct sdrm_plane_state *state;
+
+	if (plane->state)
+		__drm_atomic_helper_plane_destroy_state(plane->state);
+	kfree(plane->state ? to_sdrm_plane_state(plane->state) : NULL);
+	plane->state = NULL;
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return;
+
+	state->base.plane = plane;
+	state->base.rotation = DRM_ROTATE_0;
+	plane->state = &state->base;
+}
+
+static struct drm_plane_state *
+netv_kms_plane_duplicate_state(struct drm_plane *plane)
+{
+	struct sdrm_plane_state *state;
+
+	if (WARN_ON(!plane->state))
+		return NULL;
+
+	state = kmemdup(to_sdrm_plane_state(plane->state), sizeof(*state),
+			GFP_KERNEL);
+	if (!state)
+		return NULL;
+
+	__drm_atomic_helper_plane_duplicate_state(plane, &state->base);
+
+	return &state->base;
+}
+
+static void netv_kms_plane_destroy_state(struct drm_plane *plane,
+					 struct drm_plane_state *state)
+{
+	__drm_atomic_helper_plane_destroy_state(state);
+	kfree(to_sdrm_plane_state(state));
+}
+
+static int netv_kms_plane_atomic_set_property(struct drm_plane *plane,
+					      struct drm_plane_state *state,
+					      struct drm_property *property,
+					      uint64_t val)
+{
+	struct sdrm_plane_state *sstate = to_sdrm_plane_state(state);
+	struct sdrm_device *pipe;
+
+	pipe = container_of(plane, struct sdrm_device, plane);
+	if (property == pipe->color_encoding_property)
+		sstate->color_encoding = val;
+	else if (property == pipe->color_range_property)
+		sstate->color_range = val;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int netv_kms_plane_atomic_get_property(struct drm_plane *plane,
+				const struct drm_plane_state *state,
+				struct drm_property *property,
+				uint64_t *val)
+{
+	const struct sdrm_plane_state *sstate =
+		container_of(state, const struct sdrm_plane_state, base);
+	struct sdrm_device *pipe;
+
+	pipe = container_of(plane, struct sdrm_device, plane);
+	if (property == pipe->color_encoding_property)
+		*val = sstate->color_encoding;
+	else if (property == pipe->color_range_property)
+		*val = sstate->color_range;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
 static const struct drm_plane_funcs netv_kms_plane_funcs = {
+	.update_plane		= drm_atomic_helper_update_plane,
+	.disable_plane		= drm_atomic_helper_disable_plane,
+	.destroy		= drm_plane_cleanup,
+	.set_property		= drm_atomic_helper_plane_set_property,
+	.reset			= netv_kms_plane_reset,
+	.atomic_duplicate_state	= netv_kms_plane_duplicate_state,
+	.atomic_destroy_state	= netv_kms_plane_destroy_state,
+	.atomic_set_property	= netv_kms_plane_atomic_set_property,
+	.atomic_get_property	= netv_kms_plane_atomic_get_property,
+};
+
+/*
+ * The cursor plane is blended into uploads in software, anywhere on the
+ * crtc and partly off it, but unscaled and up to SDRM_CURSOR_MAX square.
+ */
+static int netv_kms_cursor_atomic_check(struct drm_plane *plane,
+					struct drm_plane_state *plane_state)
+{
+	struct drm_rect src = {
+		.x1 = plane_state->src_x,
+		.y1 = plane_state->src_y,
+		.x2 = plane_state->src_x + plane_state->src_w,
+		.y2 = plane_state->src_y + plane_state->src_h,
+	};
+	struct drm_rect dest = {
+		.x1 = plane_state->crtc_x,
+		.y1 = plane_state->crtc_y,
+		.x2 = plane_state->crtc_x + plane_state->crtc_w,
+		.y2 = plane_state->crtc_y + plane_state->crtc_h,
+	};
+	struct drm_rect clip = { 0 };
+	struct sdrm_device *pipe;
+	struct drm_crtc_state *crtc_state;
+	bool visible;
+
+	if (!plane_state->fb || !plane_state->crtc)
+		return 0; /* nothing to check when disabling */
+
+	pipe = container_of(plane, struct sdrm_device, cursor);
+	crtc_state = drm_atomic_get_existing_crtc_state(plane_state->state,
+							&pipe->crtc);
+	if (!crtc_state || !crtc_state->enable)
+		return -EINVAL;
+
+	if (plane_state->crtc_w > SDRM_CURSOR_MAX ||
+	    plane_state->crtc_h > SDRM_CURSOR_MAX)
+		return -EINVAL;
+
+	clip.x2 = crtc_state->adjusted_mode.hdisplay;
+	clip.y2 = crtc_state->adjusted_mode.vdisplay;
+
+	return drm_plane_helper_check_update(plane, &pipe->crtc,
+					     plane_state->fb,
+					     &src, &dest, &clip,
+					     plane_state->rotation,
+					     DRM_PLANE_HELPER_NO_SCALING,
+					     DRM_PLANE_HELPER_NO_SCALING,
+					     true, true, &visible);
+}
+
+static void netv_kms_cursor_atomic_update(struct drm_plane *plane,
+					  struct drm_plane_state *pstate)
+{
+	struct sdrm_device *pipe;
+
+	pipe = container_of(plane, struct sdrm_device, cursor);
+	if (!pipe->funcs || !pipe->funcs->cursor_update)
+		return;
+
+	pipe->funcs->cursor_update(pipe, pstate);
+}
+
+static const struct drm_plane_helper_funcs netv_kms_cursor_helper_funcs = {
+	.atomic_check = netv_kms_cursor_atomic_check,
+	.atomic_update = netv_kms_cursor_atomic_update,
+};
+
+static const struct drm_plane_funcs netv_kms_cursor_funcs = {
 	.update_plane		= drm_atomic_helper_update_plane,
 	.disable_plane		= drm_atomic_helper_disable_plane,
 	.destroy		= drm_plane_cleanup,
@@ -185,6 +393,10 @@ static const struct drm_plane_funcs netv_kms_plane_funcs = {
 	.atomic_destroy_state	= drm_atomic_helper_plane_destroy_state,
 };
 
+static const uint32_t netv_kms_cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
+};
+
 /**
  * netv_display_pipe_init - Initialize a simple display pipeline
  * @dev: DRM device
@@ -195,7 +407,8 @@ static const struct drm_plane_funcs netv_kms_plane_funcs = {
  * @connector: connector to attach and register
  *
  * Sets up a display pipeline which consist of a really simple
- * plane-crtc-encoder pipe coupled with the provided connector.
+ * plane-crtc-encoder pipe with a cursor plane, coupled with the provided
+ * connector.
  * Teardown of a simple display pipe is all handled automatically by the drm
  * core through calling drm_mode_config_cleanup(). Drivers afterwards need to
  * release the memory for the structure themselves.
@@ -211,6 +424,7 @@ int netv_simple_display_pipe_init(struct drm_device *dev,
 {
 	struct drm_encoder *encoder = &netv->encoder;
 	struct drm_plane *plane = &netv->plane;
+	struct drm_plane *cursor = &netv->cursor;
 	struct drm_crtc *crtc = &netv->crtc;
 	int ret;
 
@@ -224,8 +438,17 @@ int netv_simple_display_pipe_init(struct drm_device *dev,
 	if (ret)
 		return ret;
 
+	drm_plane_helper_add(cursor, &netv_kms_cursor_helper_funcs);
+	ret = drm_universal_plane_init(dev, cursor, 0,
+				       &netv_kms_cursor_funcs,
+				       netv_kms_cursor_formats,
+				       ARRAY_SIZE(netv_kms_cursor_formats),
+				       DRM_PLANE_TYPE_CURSOR, NULL);
+	if (ret)
+		return ret;
+
 	drm_crtc_helper_add(crtc, &netv_kms_crtc_helper_funcs);
-	ret = drm_crtc_init_with_planes(dev, crtc, plane, NULL,
+	ret = drm_crtc_init_with_planes(dev, crtc, plane, cursor,
 					&netv_kms_crtc_funcs, NULL);
 	if (ret)
 		return ret;
@@ -15,9 +15,42 @@
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_plane_helper.h>
 #include <drm/drm_gem.h>
+#include <drm/drm_mm.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "simpledrm_blit.h"
+#include "simpledrm_region.h"
+
+/* size classes of the buffer pool, by log2 of the page count */
+#define SDRM_POOL_CLASSES 16
+
+/* largest cursor image, and the size suggested to the legacy ioctls */
+#define SDRM_CURSOR_MAX 256
+#define SDRM_CURSOR_SIZE 64
+
+/* primary plane scaling limits, as source/destination in 16.16 */
+#define SDRM_PLANE_MIN_SCALE (DRM_PLANE_HELPER_NO_SCALING / 8)
+#define SDRM_PLANE_MAX_SCALE (8 << 16)
+
+/* primary plane rotations and reflections, unscaled only */
+#define SDRM_PLANE_ROTATIONS						\
+	(DRM_ROTATE_0 | DRM_ROTATE_90 | DRM_ROTATE_180 |		\
+	 DRM_ROTATE_270 | DRM_REFLECT_X | DRM_REFLECT_Y)
 
 struct simplefb_format;
+struct sdrm_blit_band;
+struct sdrm_blit_buf;
+struct sdrm_blit_mirror;
 struct sdrm_device;
+struct sdrm_dma;
+struct sdrm_framebuffer;
+struct sdrm_stats;
 
 struct netv_display_pipe_funcs {
 	void (*enable)(struct sdrm_device *netv,
@@ -28,6 +61,21 @@ struct netv_display_pipe_funcs {
 		     struct drm_crtc_state *crtc_state);
 	void (*update)(struct sdrm_device *netv,
 		       struct drm_plane_state *plane_state);
+	void (*cursor_update)(struct sdrm_device *netv,
+			      struct drm_plane_state *plane_state);
+};
+
+/*
+ * Scanout register interface, see netv_hw.c
+ * @name: backend name for logs and debugfs
+ * @set_mode: program @mode, scanning out from offset 0
+ * @set_base: scan out from byte @offset into BAR0
+ */
+struct netv_hw_funcs {
+	const char *name;
+	void (*set_mode)(struct sdrm_device *netv,
+			 struct drm_display_mode *mode);
+	void (*set_base)(struct sdrm_device *netv, u32 offset);
 };
 
 struct sdrm_device {
@@ -35,6 +83,7 @@ struct sdrm_device {
 	struct drm_crtc crtc;
 	struct drm_encoder encoder;
 	struct drm_plane plane;
+	struct drm_plane cursor;
 	struct drm_connector connector;
 	struct sdrm_fbdev *fbdev;
 
@@ -43,42 +92,198 @@ struct sdrm_device {
 	u32 fb_format;
 	u32 fb_width;
 	u32 fb_height;
+	/* rows of BAR0 fbdev can pan over, see sdrm_vram_init() */
+	u32 fb_vheight;
 	u32 fb_stride;
 	u32 fb_bpp;
 	unsigned long fb_base;
 	unsigned long fb_size;
 	void *fb_map;
 
+	/*
+	 * damage flushing, see simpledrm_damage.c; blit_lock protects
+	 * scanout, its scaling and rotation, the cursor and fb_map against
+	 * the commit path and unload; scale and rotate share their scratch
+	 */
+	struct mutex blit_lock;
+	struct sdrm_framebuffer *scanout;
+	struct sdrm_blit_scale scale;
+	bool scaled;
+	struct sdrm_blit_rotate rotate;
+	bool rotated;
+	struct sdrm_framebuffer *cursor_fb;
+	struct sdrm_blit_cursor cursor_blit;
+	unsigned int vrefresh;
+	spinlock_t damage_lock;
+	ktime_t last_flush;
+	struct workqueue_struct *flush_wq;
+	struct delayed_work flush_work;
+	struct drm_clip_rect flush_clips[SDRM_REGION_MAX_INPUT];
+	struct sdrm_region *flush_region;
+	struct sdrm_region_stats damage_stats;
+	struct sdrm_stats __percpu *stats;
+	struct sdrm_blit_mirror *mirror;
+
+	/* last BAR bandwidth test in MB/s, under blit_lock; see debugfs */
+	u64 bw_mbps[SDRM_BLIT_BW_MODES];
+	bool bw_tested;
+	struct dentry *bw_dentry;
+
+	/* parallel blits, see sdrm_blit_parallel() */
+	struct workqueue_struct *blit_wq;
+	struct sdrm_blit_band *bands;
+	unsigned int num_bands;
+	u64 parallel_blits;
+
+	/* DMA upload backend, NULL if uploads use the CPU */
+	struct sdrm_dma *dma;
+	u64 dma_bytes;
+
+	/* dumb buffers in spare device memory, see simpledrm_vram.c */
+	struct drm_mm vram_mm;
+	struct mutex vram_lock;
+	u8 *vram_map;
+	bool vram_fake;
+	unsigned long vram_fallbacks;
+
+	/* scanout registers, NULL if flips have to be blitted */
+	const struct netv_hw_funcs *hw;
+	void __iomem *mmio;
+	u32 scanout_base;
+	unsigned long flips;
+
+	/* released backing store, see simpledrm_pool.c */
+	spinlock_t pool_lock;
+	struct list_head pool_dirty;
+	struct list_head pool_clean[SDRM_POOL_CLASSES];
+	struct list_head pool_lru;
+	size_t pool_bytes;
+	struct work_struct pool_zero_work;
+	struct shrinker pool_shrinker;
+	bool pool_active;
+	u64 pool_hits;
+	u64 pool_misses;
+	unsigned long pool_shrunk;
+
+	/* vblank emulation, see simpledrm_vblank.c */
+	struct hrtimer vblank_timer;
+	u64 vblank_period_ns;
+	ktime_t vblank_time;
+	bool vblank_enabled;
+	bool flip_async;
+	spinlock_t vblank_lock;
+	bool base_pending;
+	u32 pending_base;
+
+	/* YUV conversion of the scanout, see struct sdrm_plane_state */
+	struct drm_property *color_encoding_property;
+	struct drm_property *color_range_property;
+	enum sdrm_color_encoding color_encoding;
+	enum sdrm_color_range color_range;
+
 	const struct netv_display_pipe_funcs *funcs;
 };
 
+/* primary plane state, with how YUV framebuffers are converted */
+struct sdrm_plane_state {
+	struct drm_plane_state base;
+	enum sdrm_color_encoding color_encoding;
+	enum sdrm_color_range color_range;
+};
+
+#define to_sdrm_plane_state(x) container_of(x, struct sdrm_plane_state, base)
+
 void sdrm_lastclose(struct drm_device *ddev);
 int sdrm_drm_modeset_init(struct sdrm_device *sdrm);
+struct sdrm_framebuffer *sdrm_fb_new(struct drm_device *ddev,
+				     const struct drm_mode_fb_cmd2 *cmd,
+				     struct sdrm_gem_object *obj,
+				     struct sdrm_gem_object *uv);
 int sdrm_drm_mmap(struct file *filp, struct vm_area_struct *vma);
 
+void netv_hw_setmode(struct sdrm_device *netv,
+		     struct drm_display_mode *mode);
+void netv_hw_setbase(struct sdrm_device *netv, u32 offset);
+bool netv_hw_can_flip(struct sdrm_device *netv, struct drm_framebuffer *fb);
+
+int sdrm_vblank_init(struct sdrm_device *sdrm);
+void sdrm_vblank_fini(struct sdrm_device *sdrm);
+void sdrm_vblank_set_mode(struct sdrm_device *sdrm,
+			  const struct drm_display_mode *mode);
+void sdrm_vblank_setbase(struct sdrm_device *sdrm, u32 offset, bool async);
+int sdrm_enable_vblank(struct drm_device *ddev, unsigned int pipe);
+void sdrm_disable_vblank(struct drm_device *ddev, unsigned int pipe);
+int sdrm_get_vblank_timestamp(struct drm_device *ddev, unsigned int pipe,
+			      int *max_error, struct timeval *vblank_time,
+			      unsigned int flags);
+
 int sdrm_dirty(struct drm_framebuffer *fb,
 	       struct drm_file *file,
 	       unsigned int flags, unsigned int color,
 	       struct drm_clip_rect *clips,
 	       unsigned int num_clips);
-int sdrm_dirty_all_locked(struct sdrm_device *sdrm);
-int sdrm_dirty_all_unlocked(struct sdrm_device *sdrm);
+int sdrm_damage_init(struct sdrm_device *sdrm);
+void sdrm_damage_fini(struct sdrm_device *sdrm);
+void sdrm_damage_flush(struct sdrm_device *sdrm);
+u64 sdrm_flush_schedule(struct sdrm_device *sdrm);
+void sdrm_damage_set_scanout(struct sdrm_device *sdrm,
+			     struct sdrm_framebuffer *sfb,
+			     const struct sdrm_blit_scale *scale,
+			     const struct sdrm_blit_rotate *rotate);
+void sdrm_damage_invalidate(struct sdrm_device *sdrm);
+void sdrm_damage_set_cursor(struct sdrm_device *sdrm,
+			    struct sdrm_framebuffer *sfb,
+			    const struct sdrm_blit_cursor *cursor);
+int sdrm_flush_ioctl(struct drm_device *ddev, void *data,
+		     struct drm_file *file);
 
 struct sdrm_gem_object {
 	struct drm_gem_object base;
 	struct sg_table *sg;
-	struct page **pages;
+	struct mutex pages_lock;
+	struct sg_table *pages;
 	void *vmapping;
+	struct drm_mm_node vram;
+	pgoff_t last_fault;
+	/* user-space mappings sharing the store, under pages_lock */
+	unsigned int mappings;
+	/* framebuffers keeping the store, under pages_lock */
+	unsigned int pins;
+	/* pages written through mmap since the last flush, or NULL */
+	unsigned long *wp_dirty;
 };
 
 #define to_sdrm_bo(x) container_of(x, struct sdrm_gem_object, base)
 
+static inline bool sdrm_gem_is_vram(struct sdrm_gem_object *obj)
+{
+	return drm_mm_node_allocated(&obj->vram);
+}
+
 struct sdrm_gem_object *sdrm_gem_alloc_object(struct drm_device *ddev,
 					      size_t size);
 struct drm_gem_object *sdrm_gem_prime_import(struct drm_device *ddev,
 					     struct dma_buf *dma_buf);
 void sdrm_gem_free_object(struct drm_gem_object *obj);
 int sdrm_gem_get_pages(struct sdrm_gem_object *obj);
+void sdrm_gem_pin(struct sdrm_gem_object *obj);
+void sdrm_gem_unpin(struct sdrm_gem_object *obj);
+void sdrm_gem_wp_clean(struct sdrm_gem_object *obj, pgoff_t first,
+		       pgoff_t last);
+void sdrm_gem_free_store(struct sg_table *pages, void *vmapping);
+
+int sdrm_pool_init(struct sdrm_device *sdrm);
+void sdrm_pool_fini(struct sdrm_device *sdrm);
+bool sdrm_pool_get(struct sdrm_device *sdrm, struct sdrm_gem_object *obj);
+bool sdrm_pool_put(struct sdrm_device *sdrm, struct sdrm_gem_object *obj);
+
+int sdrm_vram_init(struct sdrm_device *sdrm);
+void sdrm_vram_fini(struct sdrm_device *sdrm);
+int sdrm_vram_alloc(struct sdrm_device *sdrm, struct sdrm_gem_object *obj,
+		    u32 pitch);
+void sdrm_vram_free(struct sdrm_device *sdrm, struct sdrm_gem_object *obj);
+int sdrm_vram_mmap(struct sdrm_device *sdrm, struct sdrm_gem_object *obj,
+		   struct vm_area_struct *vma);
 
 int sdrm_dumb_create(struct drm_file *file_priv, struct drm_device *ddev,
 		     struct drm_mode_create_dumb *arg);
@@ -87,9 +292,77 @@ int sdrm_dumb_destroy(struct drm_file *file_priv, struct drm_device *ddev,
 int sdrm_dumb_map_offset(struct drm_file *file_priv, struct drm_device *ddev,
 			 uint32_t handle, uint64_t *offset);
 
+int sdrm_dma_init(struct sdrm_device *sdrm);
+void sdrm_dma_fini(struct sdrm_device *sdrm);
+int sdrm_dma_blit(struct sdrm_device *sdrm, const struct sdrm_blit_buf *src,
+		  u32 x, u32 y, u32 width, u32 height);
+void sdrm_dma_sync(struct sdrm_device *sdrm);
+
+#define SDRM_DAMAGE_MAX_CLIPS SDRM_REGION_MAX_INPUT
+/* scanlines blitted between two chances for others to take the blit lock */
+#define SDRM_FLUSH_CHUNK_ROWS 64
+
+/*
+ * damage accumulated since the last flush, protected by damage_lock;
+ * @since is when the oldest of it came in
+ */
+struct sdrm_damage {
+	unsigned int num_clips;
+	struct drm_clip_rect clips[SDRM_DAMAGE_MAX_CLIPS];
+	ktime_t since;
+};
+
+/* how sdrm_blit() uploaded a rect, see the sdrm_blit tracepoint */
+enum sdrm_blit_path {
+	SDRM_BLIT_PATH_CPU,
+	SDRM_BLIT_PATH_PARALLEL,
+	SDRM_BLIT_PATH_DMA,
+	SDRM_BLIT_PATH_PAN,
+	SDRM_BLIT_PATH_SCALED,
+	SDRM_BLIT_PATH_ROTATED,
+	SDRM_BLIT_PATHS
+};
+
+/* the four characters of a DRM_FORMAT_*, as printf() arguments for %c */
+#define sdrm_fourcc_chars(f)						\
+	(f) & 0xff, ((f) >> 8) & 0xff, ((f) >> 16) & 0xff, (f) >> 24
+
+/* source formats told apart by the statistics, at most */
+#define SDRM_STATS_FORMATS 32
+/* log2 buckets of blit durations in ns, the last one takes the rest */
+#define SDRM_STATS_BUCKETS 32
+
+/*
+ * Per-CPU upload statistics, summed up in debugfs
+ * @blits,@bytes: sdrm_blit() calls by path, and bytes stored to BAR0;
+ *	the mirror leaves out spans BAR0 already holds
+ * @pixels: pixels converted, by index of the source format in the primary
+ *	plane's format list; the destination is always fb_format
+ * @dirty_calls,@dirty_clips: DIRTYFB calls and the clips they carried
+ * @lock_waits,@lock_wait_ns: blit lock acquisitions that had to wait
+ * @blit_ns: blits by duration, bucket k counts [2^k, 2^(k+1)) ns
+ */
+struct sdrm_stats {
+	u64 blits[SDRM_BLIT_PATHS];
+	u64 bytes;
+	u64 pixels[SDRM_STATS_FORMATS];
+	u64 dirty_calls;
+	u64 dirty_clips;
+	u64 lock_waits;
+	u64 lock_wait_ns;
+	u64 blit_ns[SDRM_STATS_BUCKETS];
+};
+
+/*
+ * @obj: buffer of plane 0
+ * @uv: buffer of the chroma plane of semi-planar formats, or NULL; holds
+ *	a reference of its own even if it is @obj
+ */
 struct sdrm_framebuffer {
 	struct drm_framebuffer base;
 	struct sdrm_gem_object *obj;
+	struct sdrm_gem_object *uv;
+	struct sdrm_damage damage;
 };
 
 int netv_simple_display_pipe_init(struct drm_device *dev,
@@ -100,6 +373,13 @@ int netv_simple_display_pipe_init(struct drm_device *dev,
 
 #define to_sdrm_fb(x) container_of(x, struct sdrm_framebuffer, base)
 
+#ifdef CONFIG_DEBUG_FS
+
+int sdrm_debugfs_init(struct drm_minor *minor);
+void sdrm_debugfs_cleanup(struct drm_minor *minor);
+
+#endif
+
 #ifdef CONFIG_FB
 
 void sdrm_fbdev_init(struct sdrm_device *sdrm);
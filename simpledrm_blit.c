@@ -0,0 +1,1855 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ * Copyright (c) 2012-2014 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Pixel conversion and clipping core. This unit has no DRM object
+ * dependencies and is built both into the module and into the userspace
+ * benchmark in tools/, which supplies the kernel helpers it relies on.
+ */
+
+#ifdef __KERNEL__
+#include <asm/barrier.h>
+#include <asm/simd.h>
+#include <asm/unaligned.h>
+#include <drm/drm_blend.h>
+#include <drm/drm_fourcc.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#if defined(CONFIG_X86)
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#elif defined(CONFIG_KERNEL_MODE_NEON)
+#include <asm/neon.h>
+#endif
+#endif
+
+#include "simpledrm_blit.h"
+#include "simpledrm_simd.h"
+
+bool sdrm_blit_simd = true;
+
+/* rows converted per FPU section; bounds the preempt-off window */
+#define SDRM_SIMD_ROWS 32
+
+/* write-combine buffer size, the unit streamed stores go out in */
+#define SDRM_WC_LINE 64
+
+/* mirror compare granularity, one write-combine line */
+#define SDRM_MIRROR_TILE SDRM_WC_LINE
+
+/* bounce segment for converted rows, whole lines at 2, 3 and 4 cpp */
+#define SDRM_WC_SEG_PX 192
+
+/*
+ * Conversion matrix. Every format is unpacked into 16-bit channels, MSB
+ * aligned with the low bits clear, and packed again by truncation. Row
+ * converters for every (source, scanout) pair are generated from the two
+ * format lists below, so there is no per-pixel format switch; the SIMD
+ * converters must stay bit-identical to them, since they only handle full
+ * vector steps and leave the row tail to the scalar ones.
+ *
+ * Formats that only differ in what their unused bits mean share the
+ * entries of their X variant, see sdrm_format_base().
+ */
+
+static inline void sdrm_load_rgb565(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	u32 v = get_unaligned((const u16 *)p);
+
+	*r = v & 0xf800;
+	*g = (v & 0x07e0) << 5;
+	*b = (v & 0x001f) << 11;
+}
+
+static inline void sdrm_store_rgb565(u8 *p, u32 r, u32 g, u32 b)
+{
+	put_unaligned((u16)((r & 0xf800) | ((g >> 5) & 0x07e0) | (b >> 11)),
+		      (u16 *)p);
+}
+
+static inline void sdrm_load_xrgb1555(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	u32 v = get_unaligned((const u16 *)p);
+
+	*r = (v & 0x7c00) << 1;
+	*g = (v & 0x03e0) << 6;
+	*b = (v & 0x001f) << 11;
+}
+
+static inline void sdrm_store_xrgb1555(u8 *p, u32 r, u32 g, u32 b)
+{
+	put_unaligned((u16)(((r >> 1) & 0x7c00) | ((g >> 6) & 0x03e0) |
+			    (b >> 11)), (u16 *)p);
+}
+
+#ifdef __LITTLE_ENDIAN
+#define SDRM_RGB888_R 2
+#define SDRM_RGB888_B 0
+#elif defined(__BIG_ENDIAN)
+#define SDRM_RGB888_R 0
+#define SDRM_RGB888_B 2
+#endif
+
+static inline void sdrm_load_rgb888(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	*r = p[SDRM_RGB888_R] << 8;
+	*g = p[1] << 8;
+	*b = p[SDRM_RGB888_B] << 8;
+}
+
+static inline void sdrm_store_rgb888(u8 *p, u32 r, u32 g, u32 b)
+{
+	p[SDRM_RGB888_R] = r >> 8;
+	p[1] = g >> 8;
+	p[SDRM_RGB888_B] = b >> 8;
+}
+
+static inline void sdrm_load_bgr888(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	*r = p[SDRM_RGB888_B] << 8;
+	*g = p[1] << 8;
+	*b = p[SDRM_RGB888_R] << 8;
+}
+
+static inline void sdrm_load_xrgb8888(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	u32 v = get_unaligned((const u32 *)p);
+
+	*r = (v >> 8) & 0xff00;
+	*g = v & 0xff00;
+	*b = (v << 8) & 0xff00;
+}
+
+static inline void sdrm_store_xrgb8888(u8 *p, u32 r, u32 g, u32 b)
+{
+	put_unaligned(((r & 0xff00) << 8) | (g & 0xff00) | (b >> 8),
+		      (u32 *)p);
+}
+
+static inline void sdrm_load_xbgr8888(const u8 *p, u32 *r, u32 *g, u32 *b)
+{
+	u32 v = get_unaligned((const u32 *)p);
+
+	*r = (v << 8) & 0xff00;
+	*g = v & 0xff00;
+	*b = (v >> 8) & 0xff00;
+}
+
+static inline void sdrm_store_xbgr8888(u8 *p, u32 r, u32 g, u32 b)
+{
+	put_unaligned((r >> 8) | (g & 0xff00) | ((b & 0xff00) << 8),
+		      (u32 *)p);
+}
+
+static inline void sdrm_load_xrgb2101010(const u8 *p, u32 *r, u32 *g,
+					 u32 *b)
+{
+	u32 v = get_unaligned((const u32 *)p);
+
+	*r = (v >> 14) & 0xffc0;
+	*g = (v >> 4) & 0xffc0;
+	*b = (v << 6) & 0xffc0;
+}
+
+static inline void sdrm_store_xrgb2101010(u8 *p, u32 r, u32 g, u32 b)
+{
+	put_unaligned(((r & 0xffc0) << 14) | ((g & 0xffc0) << 4) | (b >> 6),
+		      (u32 *)p);
+}
+
+/* X(name, DRM_FORMAT_ suffix, cpp) for every advertised source format */
+#define SDRM_SRC_FORMATS(X)				\
+	X(rgb565, RGB565, 2)				\
+	X(xrgb1555, XRGB1555, 2)			\
+	X(rgb888, RGB888, 3)				\
+	X(bgr888, BGR888, 3)				\
+	X(xrgb8888, XRGB8888, 4)			\
+	X(xbgr8888, XBGR8888, 4)			\
+	X(xrgb2101010, XRGB2101010, 4)
+
+/* X(source..., name, DRM_FORMAT_ suffix, cpp) for every scanout format */
+#define SDRM_DST_FORMATS(X, s, S, scpp)			\
+	X(s, S, scpp, rgb565, RGB565, 2)		\
+	X(s, S, scpp, xrgb1555, XRGB1555, 2)		\
+	X(s, S, scpp, rgb888, RGB888, 3)		\
+	X(s, S, scpp, xrgb8888, XRGB8888, 4)		\
+	X(s, S, scpp, xbgr8888, XBGR8888, 4)		\
+	X(s, S, scpp, xrgb2101010, XRGB2101010, 4)
+
+#define SDRM_ROW_CONV(s, S, scpp, d, D, dcpp)				\
+static void sdrm_row_##s##_to_##d(u8 *dst, const u8 *src, u32 width)	\
+{									\
+	u32 r, g, b, i;							\
+									\
+	for (i = 0; i < width; ++i) {					\
+		sdrm_load_##s(src + i * scpp, &r, &g, &b);		\
+		sdrm_store_##d(dst + i * dcpp, r, g, b);		\
+	}								\
+}
+
+#define SDRM_ROW_CONVS(s, S, scpp) SDRM_DST_FORMATS(SDRM_ROW_CONV, s, S, scpp)
+
+SDRM_SRC_FORMATS(SDRM_ROW_CONVS)
+
+struct sdrm_conv {
+	u32 src_four_cc;
+	u32 dst_four_cc;
+	void (*scalar)(u8 *dst, const u8 *src, u32 width);
+};
+
+#define SDRM_CONV(s, S, scpp, d, D, dcpp) \
+	{ DRM_FORMAT_##S, DRM_FORMAT_##D, sdrm_row_##s##_to_##d },
+
+#define SDRM_CONVS(s, S, scpp) SDRM_DST_FORMATS(SDRM_CONV, s, S, scpp)
+
+static const struct sdrm_conv sdrm_convs[] = {
+	SDRM_SRC_FORMATS(SDRM_CONVS)
+};
+
+/*
+ * 16bpp sources widened to 32bpp go through two 256-entry tables, one per
+ * source byte, instead of shifting and masking every channel; that is
+ * about a third faster. Every source bit lands in exactly one destination
+ * bit for these pairs, so the two halves can simply be or'ed together.
+ * The tables are generated from the scalar converters by sdrm_blit_init().
+ *
+ * X(source name, DRM_FORMAT_ suffix, scanout name, DRM_FORMAT_ suffix)
+ */
+#define SDRM_LUT_FORMATS(X)					\
+	X(rgb565, RGB565, xrgb8888, XRGB8888)			\
+	X(rgb565, RGB565, xbgr8888, XBGR8888)			\
+	X(rgb565, RGB565, xrgb2101010, XRGB2101010)		\
+	X(xrgb1555, XRGB1555, xrgb8888, XRGB8888)		\
+	X(xrgb1555, XRGB1555, xbgr8888, XBGR8888)		\
+	X(xrgb1555, XRGB1555, xrgb2101010, XRGB2101010)
+
+#define SDRM_LUT_CONV(s, S, d, D)					\
+static u32 sdrm_lut_##s##_to_##d[2][256];				\
+									\
+static void sdrm_row_##s##_to_##d##_lut(u8 *dst, const u8 *src,	\
+					u32 width)			\
+{									\
+	const u32 (*lut)[256] = sdrm_lut_##s##_to_##d;			\
+	u32 i;								\
+									\
+	for (i = 0; i < width; ++i)					\
+		put_unaligned(lut[0][src[2 * i]] | lut[1][src[2 * i + 1]], \
+			      (u32 *)(dst + 4 * i));			\
+}
+
+SDRM_LUT_FORMATS(SDRM_LUT_CONV)
+
+#define SDRM_LUT_ENTRY(s, S, d, D) \
+	{ DRM_FORMAT_##S, DRM_FORMAT_##D, sdrm_row_##s##_to_##d##_lut },
+
+static const struct sdrm_conv sdrm_lut_convs[] = {
+	SDRM_LUT_FORMATS(SDRM_LUT_ENTRY)
+};
+
+static void sdrm_lut_fill(u32 (*lut)[256],
+			  void (*scalar)(u8 *dst, const u8 *src, u32 width))
+{
+	u8 px[2];
+	u32 i;
+
+	for (i = 0; i < 256; i++) {
+		px[0] = i;
+		px[1] = 0;
+		scalar((u8 *)&lut[0][i], px, 1);
+		px[0] = 0;
+		px[1] = i;
+		scalar((u8 *)&lut[1][i], px, 1);
+	}
+}
+
+#define SDRM_LUT_INIT(s, S, d, D) \
+	sdrm_lut_fill(sdrm_lut_##s##_to_##d, sdrm_row_##s##_to_##d);
+
+void sdrm_blit_init(void)
+{
+	SDRM_LUT_FORMATS(SDRM_LUT_INIT)
+}
+
+static u32 sdrm_format_base(u32 four_cc)
+{
+	switch (four_cc) {
+	case DRM_FORMAT_ARGB1555:
+		return DRM_FORMAT_XRGB1555;
+	case DRM_FORMAT_ARGB8888:
+		return DRM_FORMAT_XRGB8888;
+	case DRM_FORMAT_ABGR8888:
+		return DRM_FORMAT_XBGR8888;
+	case DRM_FORMAT_ARGB2101010:
+		return DRM_FORMAT_XRGB2101010;
+	}
+
+	return four_cc;
+}
+
+static const struct sdrm_conv *sdrm_conv_search(const struct sdrm_conv *convs,
+						unsigned int num_convs,
+						u32 src_four_cc,
+						u32 dst_four_cc)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_convs; i++)
+		if (convs[i].src_four_cc == src_four_cc &&
+		    convs[i].dst_four_cc == dst_four_cc)
+			return &convs[i];
+
+	return NULL;
+}
+
+static const struct sdrm_conv *sdrm_conv_find(u32 src_four_cc,
+					      u32 dst_four_cc)
+{
+	const struct sdrm_conv *c;
+
+	src_four_cc = sdrm_format_base(src_four_cc);
+	dst_four_cc = sdrm_format_base(dst_four_cc);
+
+	c = sdrm_conv_search(sdrm_lut_convs, ARRAY_SIZE(sdrm_lut_convs),
+			     src_four_cc, dst_four_cc);
+	if (c)
+		return c;
+
+	return sdrm_conv_search(sdrm_convs, ARRAY_SIZE(sdrm_convs),
+				src_four_cc, dst_four_cc);
+}
+
+/*
+ * YUV sources. Chroma is shared by pixel pairs, so the converters take the
+ * start of the row and convert pixels [@x, @x + @width) of it; then any
+ * span can be converted, whatever the parity of its first pixel. Chroma is
+ * not interpolated.
+ *
+ * The arithmetic is laid out for 16-bit vector lanes, with 6 fractional
+ * bits. Luma is widened to 16 bits (Y * 257) and scaled by the high half
+ * of an unsigned multiply; @y_sub removes the offset of limited range and
+ * adds the rounding bias. Chroma coefficients are plain 6-bit fixed point.
+ * No intermediate result can overflow, except for blue, which the SIMD
+ * converters saturate and which is clamped to 255 either way. Every output
+ * is within one level of the exact BT.601/BT.709 result.
+ */
+#define SDRM_YUV_LANES(v) { v, v, v, v, v, v, v, v }
+#define SDRM_YUV_COEFFS(y_mul, y_sub, v_r, u_g, v_g, u_b) {		\
+	SDRM_YUV_LANES(y_mul), SDRM_YUV_LANES(y_sub),			\
+	SDRM_YUV_LANES(v_r), SDRM_YUV_LANES(u_g),			\
+	SDRM_YUV_LANES(v_g), SDRM_YUV_LANES(u_b) }
+
+static const struct sdrm_yuv_coeffs sdrm_yuv_coeffs[2][2] = {
+	[SDRM_COLOR_YCBCR_BT601] = {
+		[SDRM_COLOR_YCBCR_LIMITED_RANGE] =
+			SDRM_YUV_COEFFS(19003, 1160, 102, -25, -52, 129),
+		[SDRM_COLOR_YCBCR_FULL_RANGE] =
+			SDRM_YUV_COEFFS(16320, -32, 90, -22, -46, 113),
+	},
+	[SDRM_COLOR_YCBCR_BT709] = {
+		[SDRM_COLOR_YCBCR_LIMITED_RANGE] =
+			SDRM_YUV_COEFFS(19003, 1160, 115, -14, -34, 135),
+		[SDRM_COLOR_YCBCR_FULL_RANGE] =
+			SDRM_YUV_COEFFS(16320, -32, 101, -12, -30, 119),
+	},
+};
+
+static inline u32 sdrm_yuv_clamp(s32 v)
+{
+	v >>= 6;
+
+	return v < 0 ? 0 : v > 255 ? 0xff00 : v << 8;
+}
+
+static inline void sdrm_yuv_to_rgb(const struct sdrm_yuv_coeffs *k,
+				   s32 y, s32 u, s32 v,
+				   u32 *r, u32 *g, u32 *b)
+{
+	y = ((u32)y * 257 * k->y_mul[0] >> 16) - k->y_sub[0];
+	u -= 128;
+	v -= 128;
+
+	*r = sdrm_yuv_clamp(y + v * k->v_r[0]);
+	*g = sdrm_yuv_clamp(y + u * k->u_g[0] + v * k->v_g[0]);
+	*b = sdrm_yuv_clamp(y + u * k->u_b[0]);
+}
+
+static inline void sdrm_load_yuyv(const u8 *src, const u8 *uv, u32 i,
+				  const struct sdrm_yuv_coeffs *k,
+				  u32 *r, u32 *g, u32 *b)
+{
+	const u8 *p = src + (i & ~1U) * 2;
+
+	sdrm_yuv_to_rgb(k, p[(i & 1) * 2], p[1], p[3], r, g, b);
+}
+
+static inline void sdrm_load_uyvy(const u8 *src, const u8 *uv, u32 i,
+				  const struct sdrm_yuv_coeffs *k,
+				  u32 *r, u32 *g, u32 *b)
+{
+	const u8 *p = src + (i & ~1U) * 2;
+
+	sdrm_yuv_to_rgb(k, p[(i & 1) * 2 + 1], p[0], p[2], r, g, b);
+}
+
+static inline void sdrm_load_nv12(const u8 *src, const u8 *uv, u32 i,
+				  const struct sdrm_yuv_coeffs *k,
+				  u32 *r, u32 *g, u32 *b)
+{
+	const u8 *p = uv + (i & ~1U);
+
+	sdrm_yuv_to_rgb(k, src[i], p[0], p[1], r, g, b);
+}
+
+/* X(name, DRM_FORMAT_ suffix, cpp of the luma plane) */
+#define SDRM_YUV_FORMATS(X)				\
+	X(yuyv, YUYV, 2)				\
+	X(uyvy, UYVY, 2)				\
+	X(nv12, NV12, 1)
+
+#define SDRM_YUV_ROW_CONV(s, S, scpp, d, D, dcpp)			\
+static void sdrm_row_##s##_to_##d(u8 *dst, const u8 *src, const u8 *uv, \
+				  u32 x, u32 width,			\
+				  const struct sdrm_yuv_coeffs *k)	\
+{									\
+	u32 r, g, b, i;							\
+									\
+	for (i = 0; i < width; ++i) {					\
+		sdrm_load_##s(src, uv, x + i, k, &r, &g, &b);		\
+		sdrm_store_##d(dst + i * dcpp, r, g, b);		\
+	}								\
+}
+
+#define SDRM_YUV_ROW_CONVS(s, S, scpp) \
+	SDRM_DST_FORMATS(SDRM_YUV_ROW_CONV, s, S, scpp)
+
+SDRM_YUV_FORMATS(SDRM_YUV_ROW_CONVS)
+
+typedef void (*sdrm_yuv_row_fn)(u8 *dst, const u8 *src, const u8 *uv,
+				u32 x, u32 width,
+				const struct sdrm_yuv_coeffs *k);
+
+struct sdrm_yuv_conv {
+	u32 src_four_cc;
+	u32 dst_four_cc;
+	sdrm_yuv_row_fn scalar;
+};
+
+#define SDRM_YUV_CONV(s, S, scpp, d, D, dcpp) \
+	{ DRM_FORMAT_##S, DRM_FORMAT_##D, sdrm_row_##s##_to_##d },
+
+#define SDRM_YUV_CONVS(s, S, scpp) \
+	SDRM_DST_FORMATS(SDRM_YUV_CONV, s, S, scpp)
+
+static const struct sdrm_yuv_conv sdrm_yuv_convs[] = {
+	SDRM_YUV_FORMATS(SDRM_YUV_CONVS)
+};
+
+static const struct sdrm_yuv_conv *sdrm_yuv_conv_find(u32 src_four_cc,
+						      u32 dst_four_cc)
+{
+	unsigned int i;
+
+	dst_four_cc = sdrm_format_base(dst_four_cc);
+
+	for (i = 0; i < ARRAY_SIZE(sdrm_yuv_convs); i++)
+		if (sdrm_yuv_convs[i].src_four_cc == src_four_cc &&
+		    sdrm_yuv_convs[i].dst_four_cc == dst_four_cc)
+			return &sdrm_yuv_convs[i];
+
+	return NULL;
+}
+
+/*
+ * Cursor. Its premultiplied pixels are blended over rows that are already
+ * converted to the scanout format, so there is one blend per scanout format
+ * rather than per pair, and the mirror compares the composited rows like
+ * any others. The blend is exact in 16-bit channels and then truncated.
+ */
+#define SDRM_BLEND_ROW(s, S, scpp, d, D, dcpp)				\
+static void sdrm_blend_##s##_to_##d(u8 *dst, const u8 *src, u32 width)	\
+{									\
+	u32 r, g, b, cr, cg, cb, a, i;					\
+									\
+	for (i = 0; i < width; ++i, src += scpp, dst += dcpp) {		\
+		a = src[3];						\
+		if (!a)							\
+			continue;					\
+									\
+		sdrm_load_xrgb8888(src, &cr, &cg, &cb);			\
+		cr |= cr >> 8;						\
+		cg |= cg >> 8;						\
+		cb |= cb >> 8;						\
+		if (a != 0xff) {					\
+			sdrm_load_##d(dst, &r, &g, &b);			\
+			cr = min(cr + (r * (255 - a) + 127) / 255, 0xffffU); \
+			cg = min(cg + (g * (255 - a) + 127) / 255, 0xffffU); \
+			cb = min(cb + (b * (255 - a) + 127) / 255, 0xffffU); \
+		}							\
+		sdrm_store_##d(dst, cr, cg, cb);			\
+	}								\
+}
+
+SDRM_DST_FORMATS(SDRM_BLEND_ROW, argb8888, ARGB8888, 4)
+
+#define SDRM_BLEND(s, S, scpp, d, D, dcpp) \
+	{ DRM_FORMAT_##S, DRM_FORMAT_##D, sdrm_blend_##s##_to_##d },
+
+static const struct sdrm_conv sdrm_blends[] = {
+	SDRM_DST_FORMATS(SDRM_BLEND, argb8888, ARGB8888, 4)
+};
+
+/*
+ * Row converter of a blit: either an RGB pair, with @simd/@scalar, or a
+ * YUV source, with @yuv_simd/@yuv and the coefficients @k. Rows under
+ * @cursor are then blended with @blend.
+ */
+struct sdrm_row_conv {
+	sdrm_simd_row_fn simd;
+	void (*scalar)(u8 *dst, const u8 *src, u32 width);
+	sdrm_simd_yuv_fn yuv_simd;
+	sdrm_yuv_row_fn yuv;
+	const struct sdrm_yuv_coeffs *k;
+	void (*blend)(u8 *dst, const u8 *src, u32 width);
+	const struct sdrm_blit_cursor *cursor;
+};
+
+#if defined(CONFIG_X86)
+
+static sdrm_simd_row_fn sdrm_simd_select(u32 src_four_cc)
+{
+	bool avx2 = false;
+
+#ifdef CONFIG_AS_AVX2
+	avx2 = boot_cpu_has(X86_FEATURE_AVX) &&
+	       boot_cpu_has(X86_FEATURE_AVX2) &&
+	       cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL);
+#endif
+
+	switch (src_four_cc) {
+	case DRM_FORMAT_XRGB8888:
+#ifdef CONFIG_AS_AVX2
+		if (avx2)
+			return sdrm_simd_xrgb8888_to_abgr8888_avx2;
+#endif
+#ifdef CONFIG_AS_SSSE3
+		if (boot_cpu_has(X86_FEATURE_SSSE3))
+			return sdrm_simd_xrgb8888_to_abgr8888_ssse3;
+#endif
+		break;
+	case DRM_FORMAT_RGB565:
+#ifdef CONFIG_AS_AVX2
+		if (avx2)
+			return sdrm_simd_rgb565_to_abgr8888_avx2;
+#endif
+		if (boot_cpu_has(X86_FEATURE_XMM2))
+			return sdrm_simd_rgb565_to_abgr8888_sse2;
+		break;
+	}
+
+	return NULL;
+}
+
+static sdrm_simd_yuv_fn sdrm_simd_yuv_select(u32 src_four_cc)
+{
+	if (!boot_cpu_has(X86_FEATURE_XMM2))
+		return NULL;
+
+	switch (src_four_cc) {
+	case DRM_FORMAT_YUYV:
+		return sdrm_simd_yuyv_to_abgr8888_sse2;
+	case DRM_FORMAT_UYVY:
+		return sdrm_simd_uyvy_to_abgr8888_sse2;
+	case DRM_FORMAT_NV12:
+		return sdrm_simd_nv12_to_abgr8888_sse2;
+	}
+
+	return NULL;
+}
+
+static sdrm_simd_stream_fn sdrm_stream_select(void)
+{
+#ifdef CONFIG_X86_64
+	return sdrm_simd_stream_movnti;
+#else
+	return NULL;
+#endif
+}
+
+static inline void sdrm_simd_begin(void)
+{
+	kernel_fpu_begin();
+}
+
+static inline void sdrm_simd_end(void)
+{
+	kernel_fpu_end();
+}
+
+#elif defined(CONFIG_KERNEL_MODE_NEON)
+
+static sdrm_simd_row_fn sdrm_simd_select(u32 src_four_cc)
+{
+#ifdef CONFIG_ARM
+	if (!cpu_has_neon())
+		return NULL;
+#endif
+
+	switch (src_four_cc) {
+	case DRM_FORMAT_XRGB8888:
+		return sdrm_simd_xrgb8888_to_abgr8888_neon;
+	case DRM_FORMAT_RGB565:
+		return sdrm_simd_rgb565_to_abgr8888_neon;
+	}
+
+	return NULL;
+}
+
+static sdrm_simd_yuv_fn sdrm_simd_yuv_select(u32 src_four_cc)
+{
+#ifdef CONFIG_ARM
+	if (!cpu_has_neon())
+		return NULL;
+#endif
+
+	switch (src_four_cc) {
+	case DRM_FORMAT_YUYV:
+		return sdrm_simd_yuyv_to_abgr8888_neon;
+	case DRM_FORMAT_UYVY:
+		return sdrm_simd_uyvy_to_abgr8888_neon;
+	case DRM_FORMAT_NV12:
+		return sdrm_simd_nv12_to_abgr8888_neon;
+	}
+
+	return NULL;
+}
+
+static sdrm_simd_stream_fn sdrm_stream_select(void)
+{
+#ifdef CONFIG_ARM64
+	return sdrm_simd_stream_stnp;
+#else
+	return NULL;
+#endif
+}
+
+static inline void sdrm_simd_begin(void)
+{
+	kernel_neon_begin();
+}
+
+static inline void sdrm_simd_end(void)
+{
+	kernel_neon_end();
+}
+
+#else
+
+static sdrm_simd_row_fn sdrm_simd_select(u32 src_four_cc)
+{
+	return NULL;
+}
+
+static sdrm_simd_yuv_fn sdrm_simd_yuv_select(u32 src_four_cc)
+{
+	return NULL;
+}
+
+static sdrm_simd_stream_fn sdrm_stream_select(void)
+{
+	return NULL;
+}
+
+static inline void sdrm_simd_begin(void)
+{
+}
+
+static inline void sdrm_simd_end(void)
+{
+}
+
+#endif
+
+static bool sdrm_select_row_conv(struct sdrm_row_conv *conv,
+				 const struct sdrm_blit_buf *src,
+				 u32 dst_four_cc)
+{
+	const struct sdrm_yuv_conv *y;
+	const struct sdrm_conv *c;
+	bool simd;
+
+	memset(conv, 0, sizeof(*conv));
+
+	/* vectorized converters only exist for the NeTV's own scanout */
+	simd = sdrm_format_base(dst_four_cc) == DRM_FORMAT_XBGR8888 &&
+	       sdrm_blit_simd && may_use_simd();
+
+	y = sdrm_yuv_conv_find(src->four_cc, dst_four_cc);
+	if (y) {
+		conv->yuv = y->scalar;
+		conv->k = &sdrm_yuv_coeffs[!!src->color_encoding]
+					  [!!src->color_range];
+		if (simd)
+			conv->yuv_simd = sdrm_simd_yuv_select(y->src_four_cc);
+		return true;
+	}
+
+	c = sdrm_conv_find(src->four_cc, dst_four_cc);
+	if (!c)
+		return false;
+
+	conv->scalar = c->scalar;
+	if (simd)
+		conv->simd = sdrm_simd_select(c->src_four_cc);
+
+	return true;
+}
+
+static inline bool sdrm_conv_uses_simd(const struct sdrm_row_conv *conv)
+{
+	return conv->simd || conv->yuv_simd;
+}
+
+/* blend the part of the cursor covering pixels [@x, @x + @width) of row @y */
+static void sdrm_cursor_row(const struct sdrm_row_conv *conv, u8 *dst,
+			    u32 dst_cpp, u32 x, u32 y, u32 width)
+{
+	const struct sdrm_blit_cursor *cursor = conv->cursor;
+	s64 x1 = max_t(s64, x, cursor->x);
+	s64 x2 = min_t(s64, (s64)x + width, (s64)cursor->x + cursor->width);
+	s64 row = (s64)y - cursor->y;
+
+	if (row < 0 || row >= cursor->height || x1 >= x2)
+		return;
+
+	conv->blend(dst + (x1 - x) * dst_cpp,
+		    cursor->map + row * cursor->stride + (x1 - cursor->x) * 4,
+		    x2 - x1);
+}
+
+static void sdrm_conv_yuv_row(const struct sdrm_row_conv *conv, u8 *dst,
+			      u32 dst_cpp, const struct sdrm_blit_buf *src,
+			      u32 x, u32 y, u32 width)
+{
+	const u8 *row = src->map + y * src->stride;
+	const u8 *uv = NULL;
+	u32 done = 0;
+
+	if (src->uv)
+		uv = src->uv + y / 2 * src->uv_stride;
+
+	/* vector steps start on a chroma pair */
+	if (conv->yuv_simd && (x & 1) && width) {
+		conv->yuv(dst, row, uv, x, 1, conv->k);
+		done = 1;
+	}
+
+	if (conv->yuv_simd)
+		done += conv->yuv_simd(dst + done * dst_cpp,
+				       row + (x + done) * src->cpp,
+				       uv ? uv + x + done : NULL,
+				       width - done, conv->k);
+
+	conv->yuv(dst + done * dst_cpp, row, uv, x + done, width - done,
+		  conv->k);
+}
+
+/*
+ * Convert @width pixels of @src starting at (@x, @y) into @dst. Callers
+ * hold the SIMD unit if sdrm_conv_uses_simd().
+ */
+static void sdrm_conv_row(const struct sdrm_row_conv *conv, u8 *dst,
+			  u32 dst_cpp, const struct sdrm_blit_buf *src,
+			  u32 x, u32 y, u32 width)
+{
+	const u8 *row = src->map + y * src->stride + x * src->cpp;
+	u32 done = 0;
+
+	if (conv->yuv) {
+		sdrm_conv_yuv_row(conv, dst, dst_cpp, src, x, y, width);
+	} else if (!conv->scalar) {
+		/* identical formats, only here to be blended */
+		memcpy(dst, row, width * dst_cpp);
+	} else {
+		if (conv->simd)
+			done = conv->simd(dst, row, width);
+		conv->scalar(dst + done * dst_cpp, row + done * src->cpp,
+			     width - done);
+	}
+
+	if (conv->cursor)
+		sdrm_cursor_row(conv, dst, dst_cpp, x, y, width);
+}
+
+static void sdrm_blit_rows(const struct sdrm_row_conv *conv,
+			   const struct sdrm_blit_buf *dst,
+			   const struct sdrm_blit_buf *src,
+			   u32 x, u32 y, u32 width, u32 height)
+{
+	bool simd = sdrm_conv_uses_simd(conv);
+	u8 *d = dst->map + y * dst->stride + x * dst->cpp;
+	u32 rows;
+
+	while (height) {
+		rows = min_t(u32, height, SDRM_SIMD_ROWS);
+		height -= rows;
+
+		if (simd)
+			sdrm_simd_begin();
+
+		for (; rows--; d += dst->stride, y++)
+			sdrm_conv_row(conv, d, dst->cpp, src, x, y, width);
+
+		if (simd)
+			sdrm_simd_end();
+	}
+}
+
+/*
+ * Copy @len bytes to a write-combined destination. The unaligned head and
+ * tail of @dst use plain stores, every whole line in between goes out as a
+ * single non-temporal burst. Without @stream this is a plain memcpy().
+ */
+static void sdrm_wc_copy(sdrm_simd_stream_fn stream, u8 *dst, const u8 *src,
+			 u32 len)
+{
+	u32 head, lines;
+
+	head = -(unsigned long)dst & (SDRM_WC_LINE - 1);
+	if (!stream || len < head + SDRM_WC_LINE) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	len -= head;
+
+	lines = len / SDRM_WC_LINE;
+	stream(dst, src, lines);
+
+	len -= lines * SDRM_WC_LINE;
+	memcpy(dst + lines * SDRM_WC_LINE, src + lines * SDRM_WC_LINE, len);
+}
+
+/*
+ * Pixels from @dst up to the first line boundary that is also a pixel
+ * boundary, so that all later bounce segments start on a line.
+ */
+static u32 sdrm_wc_head_px(const u8 *dst, u32 cpp)
+{
+	u32 head = -(unsigned long)dst & (SDRM_WC_LINE - 1);
+	u32 i;
+
+	for (i = 0; i < cpp; i++, head += SDRM_WC_LINE)
+		if (head % cpp == 0)
+			return head / cpp ?: SDRM_WC_SEG_PX;
+
+	return SDRM_WC_SEG_PX;
+}
+
+static void sdrm_blit_lines(const u8 *src, u32 src_stride,
+			    u8 *dst, u32 dst_stride,
+			    u32 bpp, u32 width, u32 height,
+			    sdrm_simd_stream_fn stream)
+{
+	u32 len;
+
+	len = width * bpp;
+
+	/* contiguous rows on both sides go out as one copy */
+	if (src_stride == dst_stride && len == dst_stride) {
+		len *= height;
+		height = 1;
+	}
+
+	while (height--) {
+		sdrm_wc_copy(stream, dst, src, len);
+		src += src_stride;
+		dst += dst_stride;
+	}
+}
+
+/*
+ * Converting straight into write-combined memory issues scattered 2-4 byte
+ * stores that the CPU may flush as partial bus writes. Instead, convert
+ * each row segment by segment into a cached bounce buffer and stream every
+ * segment out in whole lines.
+ */
+static void sdrm_blit_bounced(const struct sdrm_row_conv *conv,
+			      const struct sdrm_blit_buf *dst,
+			      const struct sdrm_blit_buf *src,
+			      u32 x, u32 y, u32 width, u32 height,
+			      sdrm_simd_stream_fn stream)
+{
+	u8 bounce[SDRM_WC_SEG_PX * 4] __aligned(SDRM_WC_LINE);
+	u8 *d = dst->map + y * dst->stride + x * dst->cpp;
+	bool simd = sdrm_conv_uses_simd(conv);
+	u32 rows, px, seg;
+
+	while (height) {
+		rows = min_t(u32, height, SDRM_SIMD_ROWS);
+		height -= rows;
+
+		if (simd)
+			sdrm_simd_begin();
+
+		for (; rows--; d += dst->stride, y++) {
+			seg = sdrm_wc_head_px(d, dst->cpp);
+			for (px = 0; px < width; px += seg) {
+				if (px)
+					seg = SDRM_WC_SEG_PX;
+				seg = min(seg, width - px);
+
+				sdrm_conv_row(conv, bounce, dst->cpp, src,
+					      x + px, y, seg);
+
+				sdrm_wc_copy(stream, d + px * dst->cpp,
+					     bounce, seg * dst->cpp);
+			}
+		}
+
+		if (simd)
+			sdrm_simd_end();
+	}
+}
+
+static bool sdrm_mirror_equal(const u8 *a, const u8 *b, u32 len)
+{
+	unsigned long diff = 0;
+
+	for (; len >= sizeof(diff); len -= sizeof(diff)) {
+		diff |= get_unaligned((const unsigned long *)a) ^
+			get_unaligned((const unsigned long *)b);
+		a += sizeof(diff);
+		b += sizeof(diff);
+	}
+
+	while (len--)
+		diff |= *a++ ^ *b++;
+
+	return !diff;
+}
+
+static void sdrm_mirror_store(struct sdrm_blit_mirror *mirror, u8 *m, u8 *d,
+			      const u8 *row, u32 len,
+			      sdrm_simd_stream_fn stream)
+{
+	memcpy(m, row, len);
+	sdrm_wc_copy(stream, d, m, len);
+	mirror->written += len;
+}
+
+/*
+ * Store one converted row of @width pixels at (@x, @y) of @dst. Tiles are
+ * aligned to the destination address so that changed spans go out as whole
+ * write-combine lines wherever possible; runs of changed tiles are stored
+ * with a single copy.
+ */
+static void sdrm_mirror_row(const struct sdrm_blit_buf *dst, u32 x, u32 y,
+			    const u8 *row, u32 width,
+			    sdrm_simd_stream_fn stream)
+{
+	struct sdrm_blit_mirror *mirror = dst->mirror;
+	u32 off, n, run, len;
+	u8 *m, *d;
+
+	off = y * dst->stride + x * dst->cpp;
+	m = mirror->map + off;
+	d = dst->map + off;
+	len = width * dst->cpp;
+
+	mirror->checked += len;
+
+	if (!mirror->rows[y]) {
+		sdrm_mirror_store(mirror, m, d, row, len, stream);
+		if (width == dst->width)
+			mirror->rows[y] = 1;
+		return;
+	}
+
+	/* @run is the start of the pending changed span, @len if none */
+	run = len;
+	n = SDRM_MIRROR_TILE - ((unsigned long)d & (SDRM_MIRROR_TILE - 1));
+	for (off = 0; off < len; off += n, n = SDRM_MIRROR_TILE) {
+		n = min(n, len - off);
+
+		if (!sdrm_mirror_equal(m + off, row + off, n)) {
+			if (run == len)
+				run = off;
+			continue;
+		}
+
+		if (run != len) {
+			sdrm_mirror_store(mirror, m + run, d + run, row + run,
+					  off - run, stream);
+			run = len;
+		}
+	}
+
+	if (run != len)
+		sdrm_mirror_store(mirror, m + run, d + run, row + run,
+				  len - run, stream);
+}
+
+/*
+ * Mirrored variant of the blit paths above: every row is converted
+ * into the mirror's scratch line (or taken from the source as is, if the
+ * formats match) and only then compared and stored. @conv is NULL if
+ * the formats match.
+ */
+static void sdrm_blit_mirrored(const struct sdrm_row_conv *conv,
+			       const struct sdrm_blit_buf *dst,
+			       const struct sdrm_blit_buf *src,
+			       u32 x, u32 y, u32 width, u32 height,
+			       sdrm_simd_stream_fn stream)
+{
+	bool simd = conv && sdrm_conv_uses_simd(conv);
+	u8 *line = dst->mirror->line;
+	u32 rows;
+	const u8 *s;
+
+	s = src->map + y * src->stride + x * src->cpp;
+
+	while (height) {
+		rows = min_t(u32, height, SDRM_SIMD_ROWS);
+		height -= rows;
+
+		if (simd)
+			sdrm_simd_begin();
+
+		for (; rows--; s += src->stride, y++) {
+			if (!conv) {
+				sdrm_mirror_row(dst, x, y, s, width, stream);
+				continue;
+			}
+
+			sdrm_conv_row(conv, line, dst->cpp, src, x, y, width);
+			sdrm_mirror_row(dst, x, y, line, width, stream);
+		}
+
+		if (simd)
+			sdrm_simd_end();
+	}
+}
+
+bool sdrm_blit_supported(u32 src_four_cc, u32 dst_four_cc)
+{
+	return src_four_cc == dst_four_cc ||
+	       sdrm_conv_find(src_four_cc, dst_four_cc) ||
+	       sdrm_yuv_conv_find(src_four_cc, dst_four_cc);
+}
+
+/*
+ * Blit rows that either all lie under @cursor or none of them does, with
+ * @cursor NULL. Rows under the cursor always take the row converter
+ * paths, with a plain copy as converter if the formats match, so that
+ * they are blended in cached memory before they are stored.
+ */
+static void sdrm_blit_span(const struct sdrm_blit_buf *dst,
+			   const struct sdrm_blit_buf *src,
+			   const struct sdrm_blit_cursor *cursor,
+			   u32 x, u32 y, u32 width, u32 height,
+			   sdrm_simd_stream_fn stream)
+{
+	struct sdrm_row_conv conv;
+	bool same = src->four_cc == dst->four_cc;
+	const struct sdrm_conv *blend = NULL;
+	const u8 *s;
+	u8 *d;
+
+	if (!height)
+		return;
+
+	if (cursor)
+		blend = sdrm_conv_search(sdrm_blends, ARRAY_SIZE(sdrm_blends),
+					 DRM_FORMAT_ARGB8888,
+					 sdrm_format_base(dst->four_cc));
+
+	/* unsupported pairs are refused when the framebuffer is created */
+	memset(&conv, 0, sizeof(conv));
+	if (!same && !sdrm_select_row_conv(&conv, src, dst->four_cc))
+		return;
+
+	if (blend) {
+		conv.blend = blend->scalar;
+		conv.cursor = cursor;
+		same = false;
+	}
+
+	if (dst->mirror) {
+		sdrm_blit_mirrored(same ? NULL : &conv, dst, src, x, y,
+				   width, height, stream);
+		return;
+	}
+
+	/* if formats are identical, do a line-by-line copy.. */
+	if (same) {
+		/* buffers are guaranteed to be big enough; no size checks */
+		s = src->map + y * src->stride + x * src->cpp;
+		d = dst->map + y * dst->stride + x * dst->cpp;
+		sdrm_blit_lines(s, src->stride, d, dst->stride,
+				src->cpp, width, height, stream);
+		return;
+	}
+
+	/* ..otherwise use the row converter of the pair */
+	if (stream || (conv.cursor && dst->wc))
+		sdrm_blit_bounced(&conv, dst, src, x, y, width, height, stream);
+	else
+		sdrm_blit_rows(&conv, dst, src, x, y, width, height);
+}
+
+static void sdrm_blit_clipped(const struct sdrm_blit_buf *dst,
+			      const struct sdrm_blit_buf *src,
+			      u32 x, u32 y, u32 width, u32 height,
+			      sdrm_simd_stream_fn stream)
+{
+	const struct sdrm_blit_cursor *cursor = &src->cursor;
+	s64 y1, y2;
+
+	/* rows above and below the cursor take the plain paths */
+	y1 = max_t(s64, y, cursor->y);
+	y2 = min_t(s64, (s64)y + height, (s64)cursor->y + cursor->height);
+	if (!cursor->map || y1 >= y2 ||
+	    (s64)cursor->x + cursor->width <= x ||
+	    cursor->x >= (s64)x + width) {
+		sdrm_blit_span(dst, src, NULL, x, y, width, height, stream);
+		return;
+	}
+
+	sdrm_blit_span(dst, src, NULL, x, y, width, y1 - y, stream);
+	sdrm_blit_span(dst, src, cursor, x, y1, width, y2 - y1, stream);
+	sdrm_blit_span(dst, src, NULL, x, y2, width, y + height - y2, stream);
+}
+
+void sdrm_blit_rect(const struct sdrm_blit_buf *dst,
+		    const struct sdrm_blit_buf *src,
+		    u32 x, u32 y, u32 width, u32 height)
+{
+	sdrm_simd_stream_fn stream = NULL;
+	u32 x2, y2;
+
+	/* empty dirty-region, nothing to do */
+	if (!width || !height)
+		return;
+	if (x >= src->width || y >= src->height)
+		return;
+
+	/* sanity checks */
+	if (x + width < x)
+		width = src->width - x;
+	if (y + height < y)
+		height = src->height - y;
+
+	/* get intersection of dirty region and scan-out region */
+	x2 = min(x + width, dst->width);
+	y2 = min(y + height, dst->height);
+	if (x2 <= x || y2 <= y)
+		return;
+	width = x2 - x;
+	height = y2 - y;
+
+	if (dst->wc)
+		stream = sdrm_stream_select();
+
+	sdrm_blit_clipped(dst, src, x, y, width, height, stream);
+
+	/* one fence covers all non-temporal stores of this blit */
+	if (stream)
+		wmb();
+}
+
+/*
+ * Scaling. Every source row that is sampled is converted to XRGB8888 once
+ * and kept for as long as consecutive output rows sample it, so however
+ * much it is scaled up, the source crosses the memory bus only once. The
+ * output rows are resampled from these rows and then take the row
+ * converter to the scanout format, vectorized where it is, and the
+ * usual store paths.
+ *
+ * Output pixel d samples source position (d + 0.5) * src / dst - 0.5, in
+ * 16.16 fixed point. Bilinear filtering weighs 8-bit channels with 8-bit
+ * fractions, so 10-bit sources lose their low bits when scaled. Sizes are
+ * bounded by the mode, which keeps all of this within 32 bits.
+ */
+struct sdrm_scale_ctx {
+	const struct sdrm_blit_scale *scale;
+	const struct sdrm_blit_buf *src;
+	struct sdrm_row_conv in;
+	u32 step_x;
+	u32 step_y;
+	/* converted columns of the source rect */
+	u32 col;
+	u32 cols;
+	u32 row[2];
+	u32 *line[2];
+	u32 *mid;
+	u8 *out;
+};
+
+static inline s32 sdrm_scale_pos(u32 d, u32 step)
+{
+	return (s32)(d * step + step / 2) - 0x8000;
+}
+
+/* source pixels @i and @j sampled at @pos, and the weight @f of @j */
+static inline void sdrm_scale_sample(s32 pos, u32 size, bool bilinear,
+				     u32 *i, u32 *j, u32 *f)
+{
+	if (!bilinear) {
+		*i = min_t(u32, (pos + 0x8000) >> 16, size - 1);
+		*j = *i;
+		*f = 0;
+		return;
+	}
+
+	pos = clamp_t(s32, pos, 0, (s32)(size - 1) << 16);
+	*i = pos >> 16;
+	*j = min(*i + 1, size - 1);
+	*f = (pos >> 8) & 0xff;
+}
+
+static inline u32 sdrm_scale_lerp(u32 a, u32 b, u32 f)
+{
+	u32 rb = ((a & 0xff00ff) * (256 - f) + (b & 0xff00ff) * f) >> 8;
+	u32 g = ((a & 0xff00) * (256 - f) + (b & 0xff00) * f) >> 8;
+
+	return (rb & 0xff00ff) | (g & 0xff00);
+}
+
+/* source row @row of the rect, converted; keeps the cached row @keep */
+static const u32 *sdrm_scale_line(struct sdrm_scale_ctx *c, u32 row, u32 keep)
+{
+	unsigned int slot;
+
+	if (c->row[0] == row)
+		return c->line[0];
+	if (c->row[1] == row)
+		return c->line[1];
+
+	slot = c->row[0] == keep;
+	c->row[slot] = row;
+	sdrm_conv_row(&c->in, (u8 *)c->line[slot], 4, c->src,
+		      c->scale->src_x + c->col, c->scale->src_y + row,
+		      c->cols);
+
+	return c->line[slot];
+}
+
+/* resample output pixels [@x1, @x2) of output row @y into @mid */
+static void sdrm_scale_row(struct sdrm_scale_ctx *c, u32 x1, u32 x2, u32 y)
+{
+	const struct sdrm_blit_scale *scale = c->scale;
+	const u32 *l0, *l1;
+	u32 r0, r1, fy, i, j, fx, k;
+	s32 pos;
+
+	sdrm_scale_sample(sdrm_scale_pos(y, c->step_y), scale->src_h,
+			  scale->bilinear, &r0, &r1, &fy);
+	l0 = sdrm_scale_line(c, r0, r1);
+	l1 = sdrm_scale_line(c, r1, r0);
+
+	pos = sdrm_scale_pos(x1, c->step_x);
+	for (k = 0; k < x2 - x1; k++, pos += c->step_x) {
+		sdrm_scale_sample(pos, scale->src_w, scale->bilinear,
+				  &i, &j, &fx);
+		i -= c->col;
+		j -= c->col;
+
+		if (!scale->bilinear)
+			c->mid[k] = l0[i];
+		else
+			c->mid[k] = sdrm_scale_lerp(
+				sdrm_scale_lerp(l0[i], l1[i], fy),
+				sdrm_scale_lerp(l0[j], l1[j], fy), fx);
+	}
+}
+
+/*
+ * Output pixels [*@d1, *@d2) that sample source pixels [@pos, @pos + @len)
+ * of a rect at @src_pos, @src_len long and scaled to @dst_len. A source
+ * pixel is sampled from up to half an output pixel plus one source pixel
+ * away, so the span is widened by that much.
+ */
+static bool sdrm_scale_span(u32 pos, u32 len, u32 src_pos, u32 src_len,
+			    u32 dst_len, u32 *d1, u32 *d2)
+{
+	u32 a, b, margin = DIV_ROUND_UP(dst_len, src_len) + 1;
+
+	if (!len || pos >= src_pos + src_len || pos + len <= src_pos)
+		return false;
+
+	a = max(pos, src_pos) - src_pos;
+	b = min(pos + len, src_pos + src_len) - src_pos;
+
+	a = a * dst_len / src_len;
+	*d1 = a > margin ? a - margin : 0;
+	*d2 = min(DIV_ROUND_UP(b * dst_len, src_len) + margin, dst_len);
+
+	return *d1 < *d2;
+}
+
+/**
+ * sdrm_blit_scaled - scale and convert part of a source rect
+ * @dst: destination buffer
+ * @src: source buffer; its cursor is placed in @dst coordinates
+ * @scale: source rect and how it is scaled onto @dst
+ * @x,@y,@width,@height: damaged source rect
+ *
+ * Converts every destination pixel that samples the damaged rect.
+ */
+void sdrm_blit_scaled(const struct sdrm_blit_buf *dst,
+		      const struct sdrm_blit_buf *src,
+		      const struct sdrm_blit_scale *scale,
+		      u32 x, u32 y, u32 width, u32 height)
+{
+	const struct sdrm_conv *blend = NULL;
+	struct sdrm_row_conv out, cursor;
+	struct sdrm_blit_buf mid;
+	struct sdrm_scale_ctx c;
+	sdrm_simd_stream_fn stream = NULL;
+	u32 x1, x2, y1, y2, rows, i, j, f;
+	bool simd;
+
+	if (!scale->src_w || !scale->src_h || !scale->dst_w || !scale->dst_h)
+		return;
+	if (!sdrm_scale_span(x, width, scale->src_x, scale->src_w,
+			     scale->dst_w, &x1, &x2) ||
+	    !sdrm_scale_span(y, height, scale->src_y, scale->src_h,
+			     scale->dst_h, &y1, &y2))
+		return;
+
+	x2 = min(x2, dst->width);
+	y2 = min(y2, dst->height);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	c.scale = scale;
+	c.src = src;
+	c.step_x = (scale->src_w << 16) / scale->dst_w;
+	c.step_y = (scale->src_h << 16) / scale->dst_h;
+	c.row[0] = U32_MAX;
+	c.row[1] = U32_MAX;
+	c.line[0] = (u32 *)scale->scratch;
+	c.line[1] = c.line[0] + scale->src_w;
+	c.mid = c.line[1] + scale->src_w;
+	c.out = (u8 *)(c.mid + scale->dst_w);
+
+	/* only the source columns that [x1, x2) samples are converted */
+	sdrm_scale_sample(sdrm_scale_pos(x1, c.step_x), scale->src_w,
+			  scale->bilinear, &c.col, &j, &f);
+	sdrm_scale_sample(sdrm_scale_pos(x2 - 1, c.step_x), scale->src_w,
+			  scale->bilinear, &i, &j, &f);
+	c.cols = j + 1 - c.col;
+
+	memset(&c.in, 0, sizeof(c.in));
+	if (sdrm_format_base(src->four_cc) != DRM_FORMAT_XRGB8888 &&
+	    !sdrm_select_row_conv(&c.in, src, DRM_FORMAT_XRGB8888))
+		return;
+
+	memset(&mid, 0, sizeof(mid));
+	mid.map = (u8 *)c.mid;
+	mid.four_cc = DRM_FORMAT_XRGB8888;
+	mid.cpp = 4;
+
+	memset(&out, 0, sizeof(out));
+	if (sdrm_format_base(dst->four_cc) != DRM_FORMAT_XRGB8888 &&
+	    !sdrm_select_row_conv(&out, &mid, dst->four_cc))
+		return;
+
+	memset(&cursor, 0, sizeof(cursor));
+	if (src->cursor.map)
+		blend = sdrm_conv_search(sdrm_blends, ARRAY_SIZE(sdrm_blends),
+					 DRM_FORMAT_ARGB8888,
+					 sdrm_format_base(dst->four_cc));
+	if (blend) {
+		cursor.blend = blend->scalar;
+		cursor.cursor = &src->cursor;
+	}
+
+	if (dst->wc)
+		stream = sdrm_stream_select();
+	simd = sdrm_conv_uses_simd(&out);
+
+	while (y1 < y2) {
+		rows = min_t(u32, y2 - y1, SDRM_SIMD_ROWS);
+
+		if (simd)
+			sdrm_simd_begin();
+
+		for (; rows--; y1++) {
+			sdrm_scale_row(&c, x1, x2, y1);
+			sdrm_conv_row(&out, c.out, dst->cpp, &mid, 0, 0,
+				      x2 - x1);
+			if (cursor.cursor)
+				sdrm_cursor_row(&cursor, c.out, dst->cpp, x1, y1,
+						x2 - x1);
+
+			if (dst->mirror)
+				sdrm_mirror_row(dst, x1, y1, c.out, x2 - x1,
+						stream);
+			else
+				sdrm_wc_copy(stream, dst->map +
+					     y1 * dst->stride + x1 * dst->cpp,
+					     c.out, (x2 - x1) * dst->cpp);
+		}
+
+		if (simd)
+			sdrm_simd_end();
+	}
+
+	if (stream)
+		wmb();
+}
+
+/* source pixels sampled by output pixels [*@pos, *@pos + *@len) */
+static void sdrm_scale_span_to_src(u32 *pos, u32 *len, u32 src_pos,
+				   u32 src_len, u32 dst_len)
+{
+	u32 a = *pos, b = *pos + *len;
+
+	a = min(a * src_len / dst_len, src_len);
+	a = a ? a - 1 : 0;
+	b = min(DIV_ROUND_UP(b * src_len, dst_len) + 1, src_len);
+
+	*pos = src_pos + a;
+	*len = b > a ? b - a : 0;
+}
+
+/**
+ * sdrm_blit_scale_to_src - source rect an output rect is scaled from
+ * @scale: scaling
+ * @x,@y,@width,@height: rect in destination coordinates, replaced by
+ *	the source rect it samples
+ *
+ * Damage in destination coordinates, such as the cursor's, is turned into
+ * source damage with this; sdrm_blit_scaled() then redoes at least the
+ * original destination rect.
+ */
+void sdrm_blit_scale_to_src(const struct sdrm_blit_scale *scale,
+			    u32 *x, u32 *y, u32 *width, u32 *height)
+{
+	sdrm_scale_span_to_src(x, width, scale->src_x, scale->src_w,
+			       scale->dst_w);
+	sdrm_scale_span_to_src(y, height, scale->src_y, scale->src_h,
+			       scale->dst_h);
+}
+
+/*
+ * Rotation and reflection. Turned by 90 or 270 degrees, source columns
+ * become destination rows; converting them pixel by pixel would fetch a
+ * source cache line, and on large buffers a TLB entry, for every pixel.
+ * Instead, the destination is walked in tiles of SDRM_BLIT_ROTATE_TILE_W
+ * by SDRM_BLIT_ROTATE_TILE_H pixels. The source rows of a tile are
+ * converted four at a time, in segments as long as the tile is high,
+ * transposed into the columns of a cached tile buffer and then stored as
+ * destination rows. Tall tiles make for long runs on every source row,
+ * which is visited once per band of tiles; narrow ones keep the tile
+ * within the L1 cache. Unturned, reflections only take rows in reverse
+ * order or reverse them.
+ *
+ * Destination pixel (X, Y) shows source rect pixel (u, v), where u is
+ * taken from Y if the rect is turned and from X otherwise, counted from
+ * the far edge if @flip_u, and likewise v from the other axis.
+ */
+#define SDRM_ROTATE_SEGS 4
+
+struct sdrm_rotate_ctx {
+	const struct sdrm_blit_rotate *rotate;
+	const struct sdrm_blit_buf *src;
+	const struct sdrm_blit_buf *dst;
+	struct sdrm_row_conv conv;
+	struct sdrm_row_conv cursor;
+	sdrm_simd_stream_fn stream;
+	bool swap;
+	bool flip_u;
+	bool flip_v;
+	u8 *tile;
+	u8 *seg[SDRM_ROTATE_SEGS];
+	u8 *line[2];
+};
+
+static void sdrm_rotate_axes(unsigned int rotation, bool *swap, bool *flip_u,
+			     bool *flip_v)
+{
+	unsigned int rot = rotation & DRM_ROTATE_MASK;
+
+	*swap = rot == DRM_ROTATE_90 || rot == DRM_ROTATE_270;
+	*flip_u = (rot == DRM_ROTATE_90 || rot == DRM_ROTATE_180) ^
+		  !!(rotation & DRM_REFLECT_X);
+	*flip_v = (rot == DRM_ROTATE_180 || rot == DRM_ROTATE_270) ^
+		  !!(rotation & DRM_REFLECT_Y);
+}
+
+/* [*@a, *@b) of an axis @size long, counted from its far edge if @flip */
+static inline void sdrm_rotate_flip(u32 *a, u32 *b, u32 size, bool flip)
+{
+	u32 t = *a;
+
+	if (flip) {
+		*a = size - *b;
+		*b = size - t;
+	}
+}
+
+/* @n pixels of @src to every @step bytes of @dst, last first if @flip */
+static void sdrm_rotate_scatter(u8 *dst, u32 step, const u8 *src, u32 n,
+				u32 cpp, bool flip)
+{
+	s32 inc = flip ? -(s32)step : (s32)step;
+	u32 i;
+
+	if (flip)
+		dst += (n - 1) * step;
+
+	switch (cpp) {
+	case 4:
+		for (i = 0; i < n; ++i, dst += inc)
+			*(u32 *)dst = ((const u32 *)src)[i];
+		break;
+	case 2:
+		for (i = 0; i < n; ++i, dst += inc)
+			*(u16 *)dst = ((const u16 *)src)[i];
+		break;
+	default:
+		for (i = 0; i < n; ++i, dst += inc, src += cpp)
+			memcpy(dst, src, cpp);
+		break;
+	}
+}
+
+/*
+ * Transpose @n pixels of each of the first @count source segments into as
+ * many adjacent columns of the tile. A full set of 4-byte segments goes
+ * out 16 bytes per tile row, everything else a pixel at a time.
+ */
+static void sdrm_rotate_transpose(const struct sdrm_rotate_ctx *c, u8 *tile,
+				  u32 count, u32 n, u32 cpp)
+{
+	u32 pitch = SDRM_BLIT_ROTATE_TILE_W * cpp;
+	const u32 *s0, *s1, *s2, *s3;
+	s32 inc = pitch;
+	u32 *t, i;
+
+	if (cpp != 4 || count != SDRM_ROTATE_SEGS) {
+		for (i = 0; i < count; ++i)
+			sdrm_rotate_scatter(tile + i * cpp, pitch, c->seg[i], n,
+					    cpp, c->flip_u);
+		return;
+	}
+
+	if (c->flip_u) {
+		tile += (n - 1) * pitch;
+		inc = -inc;
+	}
+
+	s0 = (const u32 *)c->seg[0];
+	s1 = (const u32 *)c->seg[1];
+	s2 = (const u32 *)c->seg[2];
+	s3 = (const u32 *)c->seg[3];
+	for (i = 0; i < n; ++i, tile += inc) {
+		t = (u32 *)tile;
+		t[0] = s0[i];
+		t[1] = s1[i];
+		t[2] = s2[i];
+		t[3] = s3[i];
+	}
+}
+
+/* blend and store @width converted pixels at (@x, @y) */
+static void sdrm_rotate_store(const struct sdrm_rotate_ctx *c, u8 *row,
+			      u32 x, u32 y, u32 width)
+{
+	const struct sdrm_blit_buf *dst = c->dst;
+
+	if (c->cursor.cursor)
+		sdrm_cursor_row(&c->cursor, row, dst->cpp, x, y, width);
+
+	if (dst->mirror)
+		sdrm_mirror_row(dst, x, y, row, width, c->stream);
+	else
+		sdrm_wc_copy(c->stream, dst->map + y * dst->stride +
+			     x * dst->cpp, row, width * dst->cpp);
+}
+
+/* destination rows [@y1, @y2), unturned */
+static void sdrm_rotate_rows(const struct sdrm_rotate_ctx *c,
+			     u32 x1, u32 x2, u32 y1, u32 y2)
+{
+	const struct sdrm_blit_rotate *rotate = c->rotate;
+	bool simd = sdrm_conv_uses_simd(&c->conv);
+	u32 cpp = c->dst->cpp, u1 = x1, u2 = x2, v, rows;
+
+	sdrm_rotate_flip(&u1, &u2, rotate->src_w, c->flip_u);
+
+	while (y1 < y2) {
+		rows = min_t(u32, y2 - y1, SDRM_SIMD_ROWS);
+
+		if (simd)
+			sdrm_simd_begin();
+
+		for (; rows--; y1++) {
+			v = c->flip_v ? rotate->src_h - 1 - y1 : y1;
+			sdrm_conv_row(&c->conv, c->line[0], cpp, c->src,
+				      rotate->src_x + u1, rotate->src_y + v,
+				      u2 - u1);
+			if (c->flip_u) {
+				sdrm_rotate_scatter(c->line[1], cpp, c->line[0],
+						    u2 - u1, cpp, true);
+				sdrm_rotate_store(c, c->line[1], x1, y1,
+						  x2 - x1);
+			} else {
+				sdrm_rotate_store(c, c->line[0], x1, y1,
+						  x2 - x1);
+			}
+		}
+
+		if (simd)
+			sdrm_simd_end();
+	}
+}
+
+/* destination rows [@y1, @y2), turned, one band of tiles at a time */
+static void sdrm_rotate_tiles(const struct sdrm_rotate_ctx *c,
+			      u32 x1, u32 x2, u32 y1, u32 y2)
+{
+	const struct sdrm_blit_rotate *rotate = c->rotate;
+	const struct sdrm_blit_buf *dst = c->dst;
+	bool simd = sdrm_conv_uses_simd(&c->conv);
+	u32 cpp = dst->cpp, pitch = SDRM_BLIT_ROTATE_TILE_W * cpp;
+	u32 y, yn, x, xn, u1, u2, v, i, k, count;
+
+	/* tiles sit on multiples of their size, for aligned row stores */
+	for (y = y1; y < y2; y = yn) {
+		yn = min(round_down(y, SDRM_BLIT_ROTATE_TILE_H) +
+			 SDRM_BLIT_ROTATE_TILE_H, y2);
+		u1 = y;
+		u2 = yn;
+		sdrm_rotate_flip(&u1, &u2, rotate->src_w, c->flip_u);
+
+		for (x = x1; x < x2; x = xn) {
+			xn = min(round_down(x, SDRM_BLIT_ROTATE_TILE_W) +
+				 SDRM_BLIT_ROTATE_TILE_W, x2);
+
+			if (simd)
+				sdrm_simd_begin();
+
+			/* destination column x + i + k is source row v */
+			for (i = 0; i < xn - x; i += count) {
+				count = min_t(u32, xn - x - i,
+					      SDRM_ROTATE_SEGS);
+				for (k = 0; k < count; ++k) {
+					v = x + i + k;
+					if (c->flip_v)
+						v = rotate->src_h - 1 - v;
+					sdrm_conv_row(&c->conv, c->seg[k], cpp,
+						      c->src,
+						      rotate->src_x + u1,
+						      rotate->src_y + v,
+						      u2 - u1);
+				}
+				sdrm_rotate_transpose(c, c->tile + i * cpp,
+						      count, u2 - u1, cpp);
+			}
+
+			for (i = 0; i < yn - y; ++i)
+				sdrm_rotate_store(c, c->tile + i * pitch, x,
+						  y + i, xn - x);
+
+			if (simd)
+				sdrm_simd_end();
+		}
+
+		/* rows stored tile by tile are only whole at the end */
+		if (dst->mirror && x1 == 0 && x2 == dst->width)
+			memset(dst->mirror->rows + y, 1, yn - y);
+	}
+}
+
+/**
+ * sdrm_blit_rotated - rotate, reflect and convert part of a source rect
+ * @dst: destination buffer
+ * @src: source buffer; its cursor is placed in @dst coordinates
+ * @rotate: source rect and how it is turned onto @dst
+ * @x,@y,@width,@height: damaged source rect
+ */
+void sdrm_blit_rotated(const struct sdrm_blit_buf *dst,
+		       const struct sdrm_blit_buf *src,
+		       const struct sdrm_blit_rotate *rotate,
+		       u32 x, u32 y, u32 width, u32 height)
+{
+	const struct sdrm_conv *blend = NULL;
+	struct sdrm_rotate_ctx c;
+	u32 u1, u2, v1, v2, x1, x2, y1, y2, i;
+
+	/* the damage within the source rect, in rect coordinates */
+	u1 = max(x, rotate->src_x);
+	v1 = max(y, rotate->src_y);
+	u2 = min_t(u64, (u64)x + width, (u64)rotate->src_x + rotate->src_w);
+	v2 = min_t(u64, (u64)y + height, (u64)rotate->src_y + rotate->src_h);
+	if (u1 >= u2 || v1 >= v2)
+		return;
+	u1 -= rotate->src_x;
+	u2 -= rotate->src_x;
+	v1 -= rotate->src_y;
+	v2 -= rotate->src_y;
+
+	memset(&c, 0, sizeof(c));
+	c.rotate = rotate;
+	c.src = src;
+	c.dst = dst;
+	sdrm_rotate_axes(rotate->rotation, &c.swap, &c.flip_u, &c.flip_v);
+
+	sdrm_rotate_flip(&u1, &u2, rotate->src_w, c.flip_u);
+	sdrm_rotate_flip(&v1, &v2, rotate->src_h, c.flip_v);
+	x1 = c.swap ? v1 : u1;
+	x2 = min(c.swap ? v2 : u2, dst->width);
+	y1 = c.swap ? u1 : v1;
+	y2 = min(c.swap ? u2 : v2, dst->height);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	/* identical formats take the plain copy of sdrm_conv_row() */
+	if (src->four_cc != dst->four_cc &&
+	    !sdrm_select_row_conv(&c.conv, src, dst->four_cc))
+		return;
+
+	if (src->cursor.map)
+		blend = sdrm_conv_search(sdrm_blends, ARRAY_SIZE(sdrm_blends),
+					 DRM_FORMAT_ARGB8888,
+					 sdrm_format_base(dst->four_cc));
+	if (blend) {
+		c.cursor.blend = blend->scalar;
+		c.cursor.cursor = &src->cursor;
+	}
+
+	c.tile = rotate->scratch;
+	c.seg[0] = c.tile +
+		   4 * SDRM_BLIT_ROTATE_TILE_W * SDRM_BLIT_ROTATE_TILE_H;
+	for (i = 1; i < SDRM_ROTATE_SEGS; ++i)
+		c.seg[i] = c.seg[i - 1] + 4 * SDRM_BLIT_ROTATE_TILE_H;
+	c.line[0] = c.seg[SDRM_ROTATE_SEGS - 1] + 4 * SDRM_BLIT_ROTATE_TILE_H;
+	c.line[1] = c.line[0] + 4 * dst->width;
+
+	if (dst->wc)
+		c.stream = sdrm_stream_select();
+
+	if (c.swap)
+		sdrm_rotate_tiles(&c, x1, x2, y1, y2);
+	else
+		sdrm_rotate_rows(&c, x1, x2, y1, y2);
+
+	if (c.stream)
+		wmb();
+}
+
+/**
+ * sdrm_blit_rotate_to_src - source rect an output rect is turned from
+ * @rotate: rotation
+ * @x,@y,@width,@height: rect in destination coordinates, replaced by
+ *	the source rect shown in the part of it within the destination rect
+ */
+void sdrm_blit_rotate_to_src(const struct sdrm_blit_rotate *rotate,
+			     u32 *x, u32 *y, u32 *width, u32 *height)
+{
+	u32 u1, u2, v1, v2;
+	bool swap, flip_u, flip_v;
+
+	sdrm_rotate_axes(rotate->rotation, &swap, &flip_u, &flip_v);
+
+	u1 = swap ? *y : *x;
+	u2 = min_t(u64, (u64)u1 + (swap ? *height : *width), rotate->src_w);
+	v1 = swap ? *x : *y;
+	v2 = min_t(u64, (u64)v1 + (swap ? *width : *height), rotate->src_h);
+	u1 = min(u1, u2);
+	v1 = min(v1, v2);
+	sdrm_rotate_flip(&u1, &u2, rotate->src_w, flip_u);
+	sdrm_rotate_flip(&v1, &v2, rotate->src_h, flip_v);
+
+	*x = rotate->src_x + u1;
+	*y = rotate->src_y + v1;
+	*width = u2 - u1;
+	*height = v2 - v1;
+}
+
+/**
+ * sdrm_blit_mirror_invalidate - forget what the mirror knows
+ * @mirror: mirror to reset
+ * @height: rows of the destination
+ *
+ * Must be called whenever the destination is written behind the blit
+ * core's back. The next blit of each row is then written through in full.
+ */
+void sdrm_blit_mirror_invalidate(struct sdrm_blit_mirror *mirror, u32 height)
+{
+	memset(mirror->rows, 0, height);
+}
+
+/**
+ * sdrm_blit_bandwidth - write a rect to measure the destination's bandwidth
+ * @dst: destination, usually fb_map
+ * @src: cached source laid out like @dst
+ * @stride: bytes per line of both
+ * @len: bytes written per line
+ * @rows: lines written
+ * @mode: how the lines are written
+ *
+ * Write-combined memory takes 32-bit stores about as fast as wide ones,
+ * since they are merged into line bursts anyway, while uncached memory
+ * issues a bus transaction per store. Comparing the modes therefore tells
+ * whether a mapping is really write-combined. Returns false if @mode is
+ * not available on this CPU.
+ */
+bool sdrm_blit_bandwidth(u8 *dst, const u8 *src, u32 stride, u32 len,
+			 u32 rows, enum sdrm_blit_bw mode)
+{
+	sdrm_simd_stream_fn stream;
+	const u32 *s;
+	u32 *d;
+	u32 i, y;
+
+	if (!len || !rows)
+		return true;
+
+	switch (mode) {
+	case SDRM_BLIT_BW_MEMCPY:
+		memcpy(dst, src, (size_t)stride * (rows - 1) + len);
+		break;
+	case SDRM_BLIT_BW_STREAM:
+		stream = sdrm_stream_select();
+		if (!stream)
+			return false;
+		for (y = 0; y < rows; ++y)
+			sdrm_wc_copy(stream, dst + y * stride,
+				     src + y * stride, len);
+		break;
+	case SDRM_BLIT_BW_ROWS:
+		for (y = 0; y < rows; ++y)
+			memcpy(dst + y * stride, src + y * stride, len);
+		break;
+	case SDRM_BLIT_BW_DWORD:
+		/* volatile, so the compiler cannot merge them again */
+		for (y = 0; y < rows; ++y) {
+			d = (u32 *)(dst + y * stride);
+			s = (const u32 *)(src + y * stride);
+			for (i = 0; i < len / 4; ++i)
+				WRITE_ONCE(d[i], s[i]);
+			memcpy(d + i, s + i, len & 3);
+		}
+		break;
+	default:
+		return false;
+	}
+
+	wmb();
+	return true;
+}
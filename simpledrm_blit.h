@@ -0,0 +1,219 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SDRM_BLIT_H
+#define SDRM_BLIT_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#else
+#include "tools/sdrm_user.h"
+#endif
+
+/*
+ * Cached RAM copy of what was last stored to a destination buffer. With a
+ * mirror attached, sdrm_blit_rect() compares every converted row against
+ * it and only writes the spans that actually changed.
+ * @map: same layout (stride, format) as the destination
+ * @line: scratch space for one converted row, at least one stride
+ * @rows: per row, nonzero if @map matches the destination; rows that are
+ *	  not known to match are written through in full
+ * @checked,@written: bytes compared and bytes actually stored
+ */
+struct sdrm_blit_mirror {
+	u8 *map;
+	u8 *line;
+	u8 *rows;
+	u64 checked;
+	u64 written;
+};
+
+/* YCbCr to RGB conversion of YUV sources, values of the plane properties */
+enum sdrm_color_encoding {
+	SDRM_COLOR_YCBCR_BT601,
+	SDRM_COLOR_YCBCR_BT709,
+};
+
+enum sdrm_color_range {
+	SDRM_COLOR_YCBCR_LIMITED_RANGE,
+	SDRM_COLOR_YCBCR_FULL_RANGE,
+};
+
+/*
+ * Premultiplied ARGB8888 image blended over a source on its way to the
+ * destination, i.e. the cursor plane
+ * @map: address of the image's pixel (0, 0), NULL if there is no cursor
+ * @stride: bytes per line
+ * @x,@y: position in source coordinates, may be partly outside
+ * @width,@height: size in pixels
+ */
+struct sdrm_blit_cursor {
+	const u8 *map;
+	u32 stride;
+	s32 x;
+	s32 y;
+	u32 width;
+	u32 height;
+};
+
+/*
+ * Linear CPU-visible pixel buffer, as seen by the blit core
+ * @map: address of pixel (0, 0)
+ * @four_cc: DRM_FORMAT_* of the buffer
+ * @width,height: size in pixels; blits are clipped against it
+ * @stride: bytes per line
+ * @cpp: bytes per pixel, of the luma plane for semi-planar YUV
+ * @uv: interleaved chroma plane of semi-planar YUV sources; its row y / 2
+ *	holds the chroma of row y of @map
+ * @uv_stride: bytes per chroma line
+ * @color_encoding,@color_range: how YUV sources are converted
+ * @cursor: image composited over a source, see struct sdrm_blit_cursor
+ * @mirror: RAM copy of @map for destinations, or NULL
+ * @wc: destination is write-combined; stores are streamed out in whole
+ *	64-byte lines and fenced once per blit
+ */
+struct sdrm_blit_buf {
+	u8 *map;
+	u32 four_cc;
+	u32 width;
+	u32 height;
+	u32 stride;
+	u32 cpp;
+	u8 *uv;
+	u32 uv_stride;
+	enum sdrm_color_encoding color_encoding;
+	enum sdrm_color_range color_range;
+	struct sdrm_blit_cursor cursor;
+	struct sdrm_blit_mirror *mirror;
+	bool wc;
+};
+
+/*
+ * Scaling of a source rect onto the destination rect (0, 0, @dst_w, @dst_h)
+ * @src_x,@src_y,@src_w,@src_h: source rect, in whole pixels
+ * @dst_w,@dst_h: size it is scaled to
+ * @bilinear: filter bilinearly, else pick the nearest pixel
+ * @scratch: cached memory of SDRM_BLIT_SCALE_SCRATCH(@src_w, @dst_w) bytes
+ */
+struct sdrm_blit_scale {
+	u32 src_x;
+	u32 src_y;
+	u32 src_w;
+	u32 src_h;
+	u32 dst_w;
+	u32 dst_h;
+	bool bilinear;
+	u8 *scratch;
+};
+
+/* two converted source rows, a resampled row and the converted output */
+#define SDRM_BLIT_SCALE_SCRATCH(src_w, dst_w) (8 * (src_w) + 8 * (dst_w))
+
+/*
+ * Rotation and reflection of a source rect onto the destination rect
+ * (0, 0, @src_w, @src_h), or (0, 0, @src_h, @src_w) if it is turned by 90
+ * or 270 degrees
+ * @src_x,@src_y,@src_w,@src_h: source rect, in whole pixels
+ * @rotation: DRM_ROTATE_* and DRM_REFLECT_* flags of the plane
+ * @scratch: cached memory of SDRM_BLIT_ROTATE_SCRATCH(destination width)
+ *	bytes
+ */
+struct sdrm_blit_rotate {
+	u32 src_x;
+	u32 src_y;
+	u32 src_w;
+	u32 src_h;
+	unsigned int rotation;
+	u8 *scratch;
+};
+
+/* turned rects are transposed in tiles this many pixels wide and high */
+#define SDRM_BLIT_ROTATE_TILE_W 32
+#define SDRM_BLIT_ROTATE_TILE_H 128
+
+/* a tile, four converted source segments and two converted rows */
+#define SDRM_BLIT_ROTATE_SCRATCH(dst_w)					\
+	(4 * SDRM_BLIT_ROTATE_TILE_W * SDRM_BLIT_ROTATE_TILE_H +	\
+	 16 * SDRM_BLIT_ROTATE_TILE_H + 8 * (dst_w))
+
+extern bool sdrm_blit_simd;
+
+void sdrm_blit_init(void);
+bool sdrm_blit_supported(u32 src_four_cc, u32 dst_four_cc);
+void sdrm_blit_rect(const struct sdrm_blit_buf *dst,
+		    const struct sdrm_blit_buf *src,
+		    u32 x, u32 y, u32 width, u32 height);
+void sdrm_blit_scaled(const struct sdrm_blit_buf *dst,
+		      const struct sdrm_blit_buf *src,
+		      const struct sdrm_blit_scale *scale,
+		      u32 x, u32 y, u32 width, u32 height);
+void sdrm_blit_scale_to_src(const struct sdrm_blit_scale *scale,
+			    u32 *x, u32 *y, u32 *width, u32 *height);
+void sdrm_blit_rotated(const struct sdrm_blit_buf *dst,
+		       const struct sdrm_blit_buf *src,
+		       const struct sdrm_blit_rotate *rotate,
+		       u32 x, u32 y, u32 width, u32 height);
+void sdrm_blit_rotate_to_src(const struct sdrm_blit_rotate *rotate,
+			     u32 *x, u32 *y, u32 *width, u32 *height);
+void sdrm_blit_mirror_invalidate(struct sdrm_blit_mirror *mirror,
+				 u32 height);
+
+/* ways sdrm_blit_bandwidth() writes a rect */
+enum sdrm_blit_bw {
+	SDRM_BLIT_BW_MEMCPY,	/* one memcpy() over all rows */
+	SDRM_BLIT_BW_STREAM,	/* non-temporal stores, row by row */
+	SDRM_BLIT_BW_ROWS,	/* one memcpy() per row */
+	SDRM_BLIT_BW_DWORD,	/* separate 32-bit stores */
+	SDRM_BLIT_BW_MODES
+};
+
+bool sdrm_blit_bandwidth(u8 *dst, const u8 *src, u32 stride, u32 len,
+			 u32 rows, enum sdrm_blit_bw mode);
+
+/*
+ * Parallel blits split a rect into row bands and run sdrm_blit_rect() on
+ * each band concurrently. Bands never share a destination row, so they can
+ * share a mirror's @map and @rows, but each needs its own scratch @line and
+ * counters: sdrm_blit_mirror_fork() sets up a band's view of @mirror and
+ * sdrm_blit_mirror_join() adds its counters back once it is done.
+ */
+
+/* rows of band @index of @count; advances *@y to the first row of the band */
+static inline u32 sdrm_blit_band(u32 *y, u32 height, unsigned int index,
+				 unsigned int count)
+{
+	u32 rows = (height + count - 1) / count;
+	u32 start = rows * index;
+
+	if (start >= height)
+		return 0;
+
+	*y += start;
+	return min(rows, height - start);
+}
+
+static inline void sdrm_blit_mirror_fork(struct sdrm_blit_mirror *band,
+					 const struct sdrm_blit_mirror *mirror,
+					 u8 *line)
+{
+	*band = *mirror;
+	band->line = line;
+	band->checked = 0;
+	band->written = 0;
+}
+
+static inline void sdrm_blit_mirror_join(struct sdrm_blit_mirror *mirror,
+					 const struct sdrm_blit_mirror *band)
+{
+	mirror->checked += band->checked;
+	mirror->written += band->written;
+}
+
+#endif /* SDRM_BLIT_H */
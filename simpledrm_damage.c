@@ -8,121 +8,177 @@
  * any later version.
  */
 
-#include <asm/unaligned.h>
 #include <drm/drmP.h>
 #include <drm/drm_crtc.h>
+#include <linux/bitops.h>
 #include <linux/dma-buf.h>
 #include <linux/kernel.h>
-#include <linux/string.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "simpledrm.h"
+#include "simpledrm_blit.h"
+#include "simpledrm_region.h"
+#include "simpledrm_trace.h"
+
+module_param_named(simd, sdrm_blit_simd, bool, 0644);
+MODULE_PARM_DESC(simd, "Use SIMD row converters if available (default: true)");
+
+static unsigned int sdrm_max_flush_rate;
+module_param_named(max_flush_rate, sdrm_max_flush_rate, uint, 0644);
+MODULE_PARM_DESC(max_flush_rate,
+		 "Maximum damage flushes per second, 0 = refresh rate (default: 0)");
+
+static bool sdrm_mirror_enable = true;
+module_param_named(mirror, sdrm_mirror_enable, bool, 0444);
+MODULE_PARM_DESC(mirror,
+		 "Keep a RAM copy of the scanout and only upload changed spans (default: true)");
+
+static unsigned int sdrm_blit_cpus = 1;
+module_param_named(blit_cpus, sdrm_blit_cpus, uint, 0444);
+MODULE_PARM_DESC(blit_cpus,
+		 "CPUs converting large blits in parallel, 0 = all online (default: 1)");
+
+static bool sdrm_scale_bilinear = true;
+module_param_named(scale_bilinear, sdrm_scale_bilinear, bool, 0644);
+MODULE_PARM_DESC(scale_bilinear,
+		 "Filter scaled planes bilinearly, else pick the nearest pixel (default: true)");
+
+static unsigned int sdrm_blit_threshold = 65536;
+module_param_named(blit_threshold, sdrm_blit_threshold, uint, 0644);
+MODULE_PARM_DESC(blit_threshold,
+		 "Smallest blit in pixels that is split across CPUs (default: 65536)");
+
+#define SDRM_BLIT_MAX_BANDS 8
+/* smaller bands cost more to hand out than they save */
+#define SDRM_BLIT_MIN_BAND_ROWS 8
+
+struct sdrm_blit_band {
+	struct work_struct work;
+	struct sdrm_blit_buf src;
+	struct sdrm_blit_buf dst;
+	struct sdrm_blit_mirror mirror;
+	u8 *line;
+	u32 x, y, width, height;
+};
+
+static void sdrm_blit_band_work(struct work_struct *work)
+{
+	struct sdrm_blit_band *band = container_of(work, struct sdrm_blit_band,
+						   work);
 
-static inline void sdrm_put(u8 *dst, u32 four_cc, u16 r, u16 g, u16 b)
-{
-	switch (four_cc) {
-	case DRM_FORMAT_RGB565:
-		r >>= 11;
-		g >>= 10;
-		b >>= 11;
-		put_unaligned((u16)((r << 11) | (g << 5) | b), (u16 *)dst);
-		break;
-	case DRM_FORMAT_XRGB1555:
-	case DRM_FORMAT_ARGB1555:
-		r >>= 11;
-		g >>= 11;
-		b >>= 11;
-		put_unaligned((u16)((r << 10) | (g << 5) | b), (u16 *)dst);
-		break;
-	case DRM_FORMAT_RGB888:
-		r >>= 8;
-		g >>= 8;
-		b >>= 8;
-#ifdef __LITTLE_ENDIAN
-		dst[2] = r;
-		dst[1] = g;
-		dst[0] = b;
-#elif defined(__BIG_ENDIAN)
-		dst[0] = r;
-		dst[1] = g;
-		dst[2] = b;
-#endif
-		break;
-	case DRM_FORMAT_XRGB8888:
-	case DRM_FORMAT_ARGB8888:
-		r >>= 8;
-		g >>= 8;
-		b >>= 8;
-		put_unaligned((u32)((r << 16) | (g << 8) | b), (u32 *)dst);
-		break;
-	case DRM_FORMAT_ABGR8888:
-		r >>= 8;
-		g >>= 8;
-		b >>= 8;
-		put_unaligned((u32)((b << 16) | (g << 8) | r), (u32 *)dst);
-		break;
-	case DRM_FORMAT_XRGB2101010:
-	case DRM_FORMAT_ARGB2101010:
-		r >>= 4;
-		g >>= 4;
-		b >>= 4;
-		put_unaligned((u32)((r << 20) | (g << 10) | b), (u32 *)dst);
-		break;
-	}
+	sdrm_blit_rect(&band->dst, &band->src, band->x, band->y,
+		       band->width, band->height);
 }
 
-static void sdrm_blit_from_xrgb8888(const u8 *src, u32 src_stride, u32 src_bpp,
-				    u8 *dst, u32 dst_stride, u32 dst_bpp,
-				    u32 dst_four_cc, u32 width, u32 height)
+/*
+ * Convert a large rect as row bands on several CPUs. The caller converts
+ * the first band itself while the others run on the unbound blit
+ * workqueue. All bands store through the same write-combining mapping, so
+ * the gain is bounded by the bus rather than by the number of CPUs.
+ * Returns false if the rect is not worth splitting.
+ */
+static bool sdrm_blit_parallel(struct sdrm_device *sdrm,
+			       const struct sdrm_blit_buf *src,
+			       const struct sdrm_blit_buf *dst,
+			       u32 x, u32 y, u32 width, u32 height)
 {
-	u32 val, i;
-
-	while (height--) {
-		for (i = 0; i < width; ++i) {
-			val = get_unaligned((const u32 *)&src[i * src_bpp]);
-			sdrm_put(&dst[i * dst_bpp], dst_four_cc,
-				 (val & 0x00ff0000U) >> 8,
-				 (val & 0x0000ff00U),
-				 (val & 0x000000ffU) << 8);
+	struct sdrm_blit_band *band;
+	unsigned int i, count;
+
+	if (!sdrm->num_bands || (u64)width * height < sdrm_blit_threshold)
+		return false;
+
+	count = min_t(unsigned int, sdrm->num_bands,
+		      height / SDRM_BLIT_MIN_BAND_ROWS);
+	if (count < 2)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		band = &sdrm->bands[i];
+		band->src = *src;
+		band->dst = *dst;
+		if (dst->mirror) {
+			sdrm_blit_mirror_fork(&band->mirror, dst->mirror,
+					      band->line);
+			band->dst.mirror = &band->mirror;
 		}
 
-		src += src_stride;
-		dst += dst_stride;
+		band->x = x;
+		band->y = y;
+		band->width = width;
+		band->height = sdrm_blit_band(&band->y, height, i, count);
+
+		if (i && band->height)
+			queue_work(sdrm->blit_wq, &band->work);
 	}
+
+	sdrm_blit_band_work(&sdrm->bands[0].work);
+
+	for (i = 1; i < count; i++)
+		flush_work(&sdrm->bands[i].work);
+
+	if (dst->mirror)
+		for (i = 0; i < count; i++)
+			sdrm_blit_mirror_join(dst->mirror,
+					      &sdrm->bands[i].mirror);
+
+	sdrm->parallel_blits++;
+
+	return true;
 }
 
-static void sdrm_blit_from_rgb565(const u8 *src, u32 src_stride, u32 src_bpp,
-				  u8 *dst, u32 dst_stride, u32 dst_bpp,
-				  u32 dst_four_cc, u32 width, u32 height)
+/* index of @four_cc in the primary plane's formats, for the statistics */
+static int sdrm_stats_format(struct sdrm_device *sdrm, u32 four_cc)
 {
-	u32 val, i;
+	unsigned int i, count;
 
-	while (height--) {
-		for (i = 0; i < width; ++i) {
-			val = get_unaligned((const u16 *)&src[i * src_bpp]);
-			sdrm_put(&dst[i * dst_bpp], dst_four_cc,
-				 (val & 0xf800),
-				 (val & 0x07e0) << 5,
-				 (val & 0x001f) << 11);
-		}
+	count = min_t(unsigned int, sdrm->plane.format_count,
+		      SDRM_STATS_FORMATS);
+	for (i = 0; i < count; i++)
+		if (sdrm->plane.format_types[i] == four_cc)
+			return i;
 
-		src += src_stride;
-		dst += dst_stride;
-	}
+	return -1;
 }
 
-static void sdrm_blit_lines(const u8 *src, u32 src_stride,
-			    u8 *dst, u32 dst_stride,
-			    u32 bpp, u32 width, u32 height)
+/*
+ * Account a blit that started at @start, and trace it. @written is the
+ * mirror's count of stored bytes before the blit and is moved past it, as
+ * the mirror skips whatever BAR0 already holds.
+ */
+static void sdrm_blit_done(struct sdrm_device *sdrm,
+			   const struct sdrm_blit_buf *src,
+			   const struct sdrm_blit_buf *dst,
+			   u32 x, u32 y, u32 width, u32 height,
+			   enum sdrm_blit_path path, ktime_t start,
+			   u64 *written)
 {
-	u32 len;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	int format = sdrm_stats_format(sdrm, src->four_cc);
+	struct sdrm_stats *stats;
+	u64 bytes;
+
+	if (dst->mirror) {
+		bytes = dst->mirror->written - *written;
+		*written = dst->mirror->written;
+	} else {
+		bytes = (u64)width * height * dst->cpp;
+	}
 
-	len = width * bpp;
+	stats = get_cpu_ptr(sdrm->stats);
+	stats->blits[path]++;
+	stats->bytes += bytes;
+	if (format >= 0)
+		stats->pixels[format] += (u64)width * height;
+	stats->blit_ns[min(ilog2(ns | 1), SDRM_STATS_BUCKETS - 1)]++;
+	put_cpu_ptr(sdrm->stats);
 
-	while (height--) {
-		memcpy(dst, src, len);
-		src += src_stride;
-		dst += dst_stride;
-	}
+	trace_sdrm_blit(src, dst, x, y, width, height, path, bytes, ns);
 }
 
 static void sdrm_blit(struct sdrm_framebuffer *sfb, u32 x, u32 y,
@@ -131,93 +187,602 @@ static void sdrm_blit(struct sdrm_framebuffer *sfb, u32 x, u32 y,
 	struct drm_framebuffer *fb = &sfb->base;
 	struct drm_device *ddev = fb->dev;
 	struct sdrm_device *sdrm = ddev->dev_private;
-	u32 src_bpp, dst_bpp, x2, y2;
-	u8 *src, *dst;
+	struct sdrm_blit_buf src, dst, direct;
+	enum sdrm_blit_path path;
+	ktime_t start = ktime_get();
+	u64 written = 0;
+	u32 rows;
 
 	/* already unmapped; ongoing handover? */
 	if (!sdrm->fb_map)
 		return;
 
-	/* empty dirty-region, nothing to do */
-	if (!width || !height)
+	src.map = (u8 *)sfb->obj->vmapping + fb->offsets[0];
+	src.four_cc = fb->pixel_format;
+	src.width = fb->width;
+	src.height = fb->height;
+	src.stride = fb->pitches[0];
+	src.cpp = drm_format_plane_cpp(fb->pixel_format, 0);
+	src.mirror = NULL;
+	src.wc = false;
+	src.uv = NULL;
+	src.uv_stride = 0;
+	if (sfb->uv) {
+		src.uv = (u8 *)sfb->uv->vmapping + fb->offsets[1];
+		src.uv_stride = fb->pitches[1];
+	}
+	src.color_encoding = READ_ONCE(sdrm->color_encoding);
+	src.color_range = READ_ONCE(sdrm->color_range);
+	src.cursor = sdrm->cursor_blit;
+
+	/* DMA chunks have to start on a chroma row */
+	if (src.uv && (y & 1)) {
+		y--;
+		height++;
+	}
+
+	dst.map = sdrm->fb_map;
+	dst.four_cc = sdrm->fb_format;
+	dst.width = sdrm->fb_width;
+	dst.height = sdrm->fb_vheight;
+	dst.stride = sdrm->fb_stride;
+	dst.cpp = (sdrm->fb_bpp + 7) / 8;
+	dst.mirror = sdrm->mirror;
+	dst.wc = true;
+	if (dst.mirror)
+		written = dst.mirror->written;
+
+	/* for the rows that bypass the mirror */
+	direct = dst;
+	direct.mirror = NULL;
+
+	/* scaled planes are resampled row by row, in one piece */
+	if (sdrm->scaled) {
+		sdrm_blit_scaled(&dst, &src, &sdrm->scale, x, y, width, height);
+		sdrm_blit_done(sdrm, &src, &dst, x, y, width, height,
+			       SDRM_BLIT_PATH_SCALED, start, &written);
 		return;
-	if (x >= fb->width || y >= fb->height)
+	}
+
+	/* and turned ones tile by tile */
+	if (sdrm->rotated) {
+		sdrm_blit_rotated(&dst, &src, &sdrm->rotate,
+				  x, y, width, height);
+		sdrm_blit_done(sdrm, &src, &dst, x, y, width, height,
+			       SDRM_BLIT_PATH_ROTATED, start, &written);
 		return;
+	}
 
-	/* sanity checks */
-	if (x + width < x)
-		width = fb->width - x;
-	if (y + height < y)
-		height = fb->height - y;
+	/* the DMA stages hold one chunk, larger blits take several */
+	while (sdrm->dma && height) {
+		rows = min_t(u32, height, SDRM_FLUSH_CHUNK_ROWS);
+		if (sdrm_dma_blit(sdrm, &src, x, y, width, rows))
+			break;
 
-	/* get intersection of dirty region and scan-out region */
-	x2 = min(x + width, sdrm->fb_width);
-	y2 = min(y + height, sdrm->fb_height);
-	if (x2 <= x || y2 <= y)
-		return;
-	width = x2 - x;
-	height = y2 - y;
+		/* queued only, the copy itself completes in sdrm_dma_sync() */
+		sdrm_blit_done(sdrm, &src, &direct, x, y, width, rows,
+			       SDRM_BLIT_PATH_DMA, start, &written);
+		start = ktime_get();
 
-	/* get buffer offsets */
-	src = sfb->obj->vmapping;
-	dst = sdrm->fb_map;
+		/* the mirror did not see these rows */
+		if (sdrm->mirror && y < sdrm->fb_height)
+			memset(sdrm->mirror->rows + y, 0,
+			       min(rows, sdrm->fb_height - y));
 
-	/* bo is guaranteed to be big enough; size checks not needed */
-	src_bpp = (fb->bits_per_pixel + 7) / 8;
-	src += fb->offsets[0] + y * fb->pitches[0] + x * src_bpp;
+		y += rows;
+		height -= rows;
+	}
 
-	dst_bpp = (sdrm->fb_bpp + 7) / 8;
-	dst += y * sdrm->fb_stride + x * dst_bpp;
+	/* the mirror covers frame 0 only, fbdev's panning area is written through */
+	if (height && dst.mirror && y + height > sdrm->fb_height) {
+		rows = y < sdrm->fb_height ? sdrm->fb_height - y : 0;
+		sdrm_blit_rect(&direct, &src, x, y + rows, width,
+			       height - rows);
+		sdrm_blit_done(sdrm, &src, &direct, x, y + rows, width,
+			       height - rows, SDRM_BLIT_PATH_PAN, start,
+			       &written);
+		start = ktime_get();
+		height = rows;
+	}
 
-	/* if formats are identical, do a line-by-line copy.. */
-	if (fb->pixel_format == sdrm->fb_format) {
-		sdrm_blit_lines(src, fb->pitches[0],
-				dst, sdrm->fb_stride,
-				src_bpp, width, height);
+	if (!height)
 		return;
-	}
 
-	/* ..otherwise call slow blit-function */
-	switch (fb->pixel_format) {
-	case DRM_FORMAT_ARGB8888:
-		/* fallthrough */
-	case DRM_FORMAT_XRGB8888:
-		sdrm_blit_from_xrgb8888(src, fb->pitches[0], src_bpp,
-					dst, sdrm->fb_stride, dst_bpp,
-					sdrm->fb_format, width, height);
-		break;
-	case DRM_FORMAT_RGB565:
-		sdrm_blit_from_rgb565(src, fb->pitches[0], src_bpp,
-				      dst, sdrm->fb_stride, dst_bpp,
-				      sdrm->fb_format, width, height);
-		break;
+	path = SDRM_BLIT_PATH_PARALLEL;
+	if (!sdrm_blit_parallel(sdrm, &src, &dst, x, y, width, height)) {
+		sdrm_blit_rect(&dst, &src, x, y, width, height);
+		path = SDRM_BLIT_PATH_CPU;
 	}
+	sdrm_blit_done(sdrm, &src, &dst, x, y, width, height, path, start,
+		       &written);
 }
 
-static int sdrm_begin_access(struct sdrm_framebuffer *sfb)
+static int sdrm_obj_begin_access(struct sdrm_gem_object *obj)
 {
 	int r;
 
-	r = sdrm_gem_get_pages(sfb->obj);
+	r = sdrm_gem_get_pages(obj);
 	if (r)
 		return r;
 
-	if (!sfb->obj->base.import_attach)
+	if (!obj->base.import_attach)
 		return 0;
 
-	return dma_buf_begin_cpu_access(sfb->obj->base.import_attach->dmabuf,
+	return dma_buf_begin_cpu_access(obj->base.import_attach->dmabuf,
 					DMA_FROM_DEVICE);
 }
 
-static void sdrm_end_access(struct sdrm_framebuffer *sfb)
+static void sdrm_obj_end_access(struct sdrm_gem_object *obj)
 {
-	if (!sfb->obj->base.import_attach)
+	if (!obj->base.import_attach)
 		return;
 
-	dma_buf_end_cpu_access(sfb->obj->base.import_attach->dmabuf,
+	dma_buf_end_cpu_access(obj->base.import_attach->dmabuf,
 			       DMA_FROM_DEVICE);
 }
 
+static int sdrm_begin_access(struct sdrm_framebuffer *sfb)
+{
+	int r;
+
+	r = sdrm_obj_begin_access(sfb->obj);
+	if (r || !sfb->uv)
+		return r;
+
+	r = sdrm_obj_begin_access(sfb->uv);
+	if (r)
+		sdrm_obj_end_access(sfb->obj);
+
+	return r;
+}
+
+static void sdrm_end_access(struct sdrm_framebuffer *sfb)
+{
+	if (sfb->uv)
+		sdrm_obj_end_access(sfb->uv);
+	sdrm_obj_end_access(sfb->obj);
+}
+
+static void sdrm_damage_add(struct sdrm_damage *damage,
+			    const struct drm_clip_rect *clip)
+{
+	struct drm_clip_rect *c;
+	unsigned int i;
+
+	if (!damage->num_clips)
+		damage->since = ktime_get();
+
+	for (i = 0; i < damage->num_clips; i++) {
+		c = &damage->clips[i];
+		if (clip->x1 >= c->x1 && clip->x2 <= c->x2 &&
+		    clip->y1 >= c->y1 && clip->y2 <= c->y2)
+			return;
+	}
+
+	if (damage->num_clips < SDRM_DAMAGE_MAX_CLIPS) {
+		damage->clips[damage->num_clips++] = *clip;
+		return;
+	}
+
+	/* out of slots, collapse everything into the bounding box */
+	c = &damage->clips[0];
+	for (i = 1; i < damage->num_clips; i++) {
+		c->x1 = min(c->x1, damage->clips[i].x1);
+		c->y1 = min(c->y1, damage->clips[i].y1);
+		c->x2 = max(c->x2, damage->clips[i].x2);
+		c->y2 = max(c->y2, damage->clips[i].y2);
+	}
+	c->x1 = min(c->x1, clip->x1);
+	c->y1 = min(c->y1, clip->y1);
+	c->x2 = max(c->x2, clip->x2);
+	c->y2 = max(c->y2, clip->y2);
+	damage->num_clips = 1;
+}
+
+static u64 sdrm_flush_interval_ns(struct sdrm_device *sdrm)
+{
+	unsigned int rate = sdrm->vrefresh ?: 60;
+
+	if (sdrm_max_flush_rate && sdrm_max_flush_rate < rate)
+		rate = sdrm_max_flush_rate;
+
+	return NSEC_PER_SEC / rate;
+}
+
+/*
+ * Queue the flush worker for the next refresh slot. The first damage after
+ * an idle period is flushed right away; bursts are coalesced so that at
+ * most one flush runs per refresh interval. Returns the wait in ns.
+ */
+u64 sdrm_flush_schedule(struct sdrm_device *sdrm)
+{
+	unsigned long delay = 0;
+	ktime_t next;
+	s64 wait;
+
+	spin_lock(&sdrm->damage_lock);
+	next = ktime_add_ns(sdrm->last_flush, sdrm_flush_interval_ns(sdrm));
+	spin_unlock(&sdrm->damage_lock);
+
+	wait = ktime_to_ns(ktime_sub(next, ktime_get()));
+	if (wait > 0)
+		delay = nsecs_to_jiffies(wait);
+
+	queue_delayed_work(sdrm->flush_wq, &sdrm->flush_work, delay);
+
+	return max_t(s64, wait, 0);
+}
+
+/* damage the rows of @plane stored in bytes [start, end) of its object */
+static void sdrm_damage_wp_range(struct sdrm_framebuffer *sfb,
+				 unsigned int plane, u64 start, u64 end)
+{
+	struct sdrm_device *sdrm = sfb->base.dev->dev_private;
+	struct drm_framebuffer *fb = &sfb->base;
+	u32 offset = fb->offsets[plane];
+	u32 pitch = fb->pitches[plane];
+	u32 vsub = 1;
+	struct drm_clip_rect clip;
+
+	if (end <= offset)
+		return;
+
+	start = start > offset ? start - offset : 0;
+	end -= offset;
+
+	/* a chroma row covers vsub pixel rows */
+	if (plane)
+		vsub = drm_format_vert_chroma_subsampling(fb->pixel_format);
+
+	clip.x1 = 0;
+	clip.x2 = fb->width;
+	clip.y1 = min_t(u64, div_u64(start, pitch) * vsub, fb->height);
+	clip.y2 = min_t(u64, div_u64(end + pitch - 1, pitch) * vsub,
+			fb->height);
+	if (clip.y1 >= clip.y2)
+		return;
+
+	spin_lock(&sdrm->damage_lock);
+	sdrm_damage_add(&sfb->damage, &clip);
+	spin_unlock(&sdrm->damage_lock);
+}
+
+static void sdrm_damage_wp_collect_obj(struct sdrm_framebuffer *sfb,
+				       struct sdrm_gem_object *obj)
+{
+	unsigned long num = obj->base.size >> PAGE_SHIFT;
+	unsigned long first, last = 0;
+	u64 start, end;
+
+	if (!obj->wp_dirty)
+		return;
+
+	for (;;) {
+		first = find_next_bit(obj->wp_dirty, num, last);
+		if (first >= num)
+			break;
+		last = find_next_zero_bit(obj->wp_dirty, num, first);
+
+		sdrm_gem_wp_clean(obj, first, last);
+
+		start = (u64)first << PAGE_SHIFT;
+		end = (u64)last << PAGE_SHIFT;
+		if (obj == sfb->obj)
+			sdrm_damage_wp_range(sfb, 0, start, end);
+		if (obj == sfb->uv)
+			sdrm_damage_wp_range(sfb, 1, start, end);
+	}
+}
+
+/*
+ * Turn the pages of @sfb written through mmap since the last flush into
+ * damage, see sdrm_gem_wp_clean(). Runs of dirty pages become full-width
+ * row ranges of every plane stored in them. Caller holds the blit lock.
+ */
+static void sdrm_damage_wp_collect(struct sdrm_framebuffer *sfb)
+{
+	sdrm_damage_wp_collect_obj(sfb, sfb->obj);
+	if (sfb->uv && sfb->uv != sfb->obj)
+		sdrm_damage_wp_collect_obj(sfb, sfb->uv);
+}
+
+/* take the blit lock, accounting any time spent waiting for it */
+static void sdrm_blit_lock(struct sdrm_device *sdrm)
+{
+	ktime_t start;
+
+	if (mutex_trylock(&sdrm->blit_lock))
+		return;
+
+	start = ktime_get();
+	mutex_lock(&sdrm->blit_lock);
+	this_cpu_inc(sdrm->stats->lock_waits);
+	this_cpu_add(sdrm->stats->lock_wait_ns,
+		     ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+/*
+ * Drop the blit lock between chunks so that flips and unload never wait
+ * for more than one chunk. Returns false if the blit has to be abandoned,
+ * either because the device went away or because @sfb is no longer
+ * scanned out (the flip queued a full upload of the new buffer).
+ */
+static bool sdrm_flush_yield(struct sdrm_device *sdrm,
+			     struct sdrm_framebuffer *sfb)
+{
+	mutex_unlock(&sdrm->blit_lock);
+	cond_resched();
+	sdrm_blit_lock(sdrm);
+
+	return sdrm->scanout == sfb && sdrm->fb_map &&
+	       !drm_device_is_unplugged(sdrm->ddev);
+}
+
+static void sdrm_flush_work(struct work_struct *work)
+{
+	struct sdrm_device *sdrm = container_of(to_delayed_work(work),
+						struct sdrm_device,
+						flush_work);
+	struct sdrm_region *rgn = sdrm->flush_region;
+	struct drm_clip_rect *clips = sdrm->flush_clips;
+	struct sdrm_framebuffer *sfb;
+	unsigned int i, num_clips, rows, budget;
+	ktime_t since, start;
+	bool aborted = true;
+	u64 pixels = 0;
+	u32 y;
+
+	sdrm_blit_lock(sdrm);
+
+	sfb = sdrm->scanout;
+	if (!sfb || drm_device_is_unplugged(sdrm->ddev)) {
+		mutex_unlock(&sdrm->blit_lock);
+		return;
+	}
+
+	sdrm_damage_wp_collect(sfb);
+
+	spin_lock(&sdrm->damage_lock);
+	num_clips = sfb->damage.num_clips;
+	memcpy(clips, sfb->damage.clips, num_clips * sizeof(*clips));
+	sfb->damage.num_clips = 0;
+	since = sfb->damage.since;
+	start = ktime_get();
+	sdrm->last_flush = start;
+	spin_unlock(&sdrm->damage_lock);
+
+	if (!num_clips) {
+		mutex_unlock(&sdrm->blit_lock);
+		return;
+	}
+
+	/* drop overlaps and pick the cheapest cover before touching the bus */
+	sdrm_region_build(rgn, clips, num_clips, sfb->base.width,
+			  sfb->base.height, &sdrm->damage_stats);
+	clips = rgn->rects;
+	num_clips = rgn->num_rects;
+
+	/* keeps @sfb alive while the lock is dropped between chunks */
+	drm_framebuffer_reference(&sfb->base);
+
+	if (sdrm_begin_access(sfb))
+		goto unlock;
+
+	budget = SDRM_FLUSH_CHUNK_ROWS;
+	for (i = 0; i < num_clips; i++) {
+		for (y = clips[i].y1; y < clips[i].y2; y += rows) {
+			if (!budget) {
+				if (!sdrm_flush_yield(sdrm, sfb))
+					goto end_access;
+				budget = SDRM_FLUSH_CHUNK_ROWS;
+			}
+
+			rows = min_t(u32, budget, clips[i].y2 - y);
+			budget -= rows;
+
+			sdrm_blit(sfb, clips[i].x1, y,
+				  clips[i].x2 - clips[i].x1, rows);
+			pixels += (u64)(clips[i].x2 - clips[i].x1) * rows;
+		}
+	}
+	aborted = false;
+
+end_access:
+	sdrm_dma_sync(sdrm);
+	sdrm_end_access(sfb);
+unlock:
+	mutex_unlock(&sdrm->blit_lock);
+	trace_sdrm_flush(&sfb->base, num_clips, pixels, since, start, aborted);
+	drm_framebuffer_unreference(&sfb->base);
+}
+
+/* replace any pending damage of @sfb by all of it and flush right away */
+static void sdrm_damage_full(struct sdrm_framebuffer *sfb)
+{
+	struct sdrm_device *sdrm = sfb->base.dev->dev_private;
+	struct drm_clip_rect full_clip;
+
+	full_clip.x1 = 0;
+	full_clip.x2 = sfb->base.width;
+	full_clip.y1 = 0;
+	full_clip.y2 = sfb->base.height;
+
+	spin_lock(&sdrm->damage_lock);
+	sfb->damage.num_clips = 0;
+	sdrm_damage_add(&sfb->damage, &full_clip);
+	spin_unlock(&sdrm->damage_lock);
+
+	mod_delayed_work(sdrm->flush_wq, &sdrm->flush_work, 0);
+}
+
+/**
+ * sdrm_damage_set_scanout - switch the buffer the flush worker uploads from
+ * @sdrm: device
+ * @sfb: new scanout buffer, or NULL if nothing of ours is scanned out
+ * @scale: how @sfb is scaled onto the mode, or NULL if it is shown 1:1
+ * @rotate: how @sfb is turned onto the mode, or NULL; not with @scale
+ *
+ * Called from the commit path. Only the blit lock is taken, which is held
+ * for at most one blit chunk, and the full upload of the new buffer is
+ * left to the flush worker.
+ */
+void sdrm_damage_set_scanout(struct sdrm_device *sdrm,
+			     struct sdrm_framebuffer *sfb,
+			     const struct sdrm_blit_scale *scale,
+			     const struct sdrm_blit_rotate *rotate)
+{
+	sdrm_blit_lock(sdrm);
+	WRITE_ONCE(sdrm->scanout, sfb);
+	sdrm->scaled = scale;
+	if (scale) {
+		sdrm->scale.src_x = scale->src_x;
+		sdrm->scale.src_y = scale->src_y;
+		sdrm->scale.src_w = scale->src_w;
+		sdrm->scale.src_h = scale->src_h;
+		sdrm->scale.dst_w = scale->dst_w;
+		sdrm->scale.dst_h = scale->dst_h;
+		sdrm->scale.bilinear = READ_ONCE(sdrm_scale_bilinear);
+	}
+	sdrm->rotated = rotate;
+	if (rotate) {
+		sdrm->rotate.src_x = rotate->src_x;
+		sdrm->rotate.src_y = rotate->src_y;
+		sdrm->rotate.src_w = rotate->src_w;
+		sdrm->rotate.src_h = rotate->src_h;
+		sdrm->rotate.rotation = rotate->rotation;
+	}
+	/* fb_map is no longer kept in sync with anything */
+	if (!sfb && sdrm->mirror)
+		sdrm_blit_mirror_invalidate(sdrm->mirror, sdrm->fb_height);
+	mutex_unlock(&sdrm->blit_lock);
+
+	if (sfb)
+		sdrm_damage_full(sfb);
+}
+
+/*
+ * Upload the whole scanout again after BAR0 was written behind the
+ * mirror's back. The flush worker does it in chunks, like any damage.
+ */
+void sdrm_damage_invalidate(struct sdrm_device *sdrm)
+{
+	sdrm_blit_lock(sdrm);
+	if (sdrm->mirror)
+		sdrm_blit_mirror_invalidate(sdrm->mirror, sdrm->fb_height);
+	if (sdrm->scanout)
+		sdrm_damage_full(sdrm->scanout);
+	mutex_unlock(&sdrm->blit_lock);
+}
+
+/* damage the part of @sfb under @cursor */
+static void sdrm_damage_add_cursor(struct sdrm_framebuffer *sfb,
+				   const struct sdrm_blit_cursor *cursor)
+{
+	struct sdrm_device *sdrm = sfb->base.dev->dev_private;
+	struct drm_clip_rect clip;
+	u32 x, y, width, height, mode_w, mode_h;
+	s64 x2, y2;
+
+	if (!cursor->map)
+		return;
+
+	x2 = (s64)cursor->x + cursor->width;
+	y2 = (s64)cursor->y + cursor->height;
+
+	/* a scaled or turned plane's cursor sits on the mode, not the buffer */
+	if (sdrm->scaled || sdrm->rotated) {
+		if (sdrm->scaled) {
+			mode_w = sdrm->scale.dst_w;
+			mode_h = sdrm->scale.dst_h;
+		} else {
+			mode_w = sdrm->rotate.src_w;
+			mode_h = sdrm->rotate.src_h;
+			if (sdrm->rotate.rotation &
+			    (DRM_ROTATE_90 | DRM_ROTATE_270))
+				swap(mode_w, mode_h);
+		}
+
+		x = clamp_t(s64, cursor->x, 0, mode_w);
+		y = clamp_t(s64, cursor->y, 0, mode_h);
+		width = clamp_t(s64, x2, 0, mode_w) - x;
+		height = clamp_t(s64, y2, 0, mode_h) - y;
+		if (!width || !height)
+			return;
+
+		if (sdrm->scaled)
+			sdrm_blit_scale_to_src(&sdrm->scale, &x, &y,
+					       &width, &height);
+		else
+			sdrm_blit_rotate_to_src(&sdrm->rotate, &x, &y,
+						&width, &height);
+		clip.x1 = x;
+		clip.y1 = y;
+		clip.x2 = x + width;
+		clip.y2 = y + height;
+	} else {
+		clip.x1 = clamp_t(s64, cursor->x, 0, sfb->base.width);
+		clip.y1 = clamp_t(s64, cursor->y, 0, sfb->base.height);
+		clip.x2 = clamp_t(s64, x2, 0, sfb->base.width);
+		clip.y2 = clamp_t(s64, y2, 0, sfb->base.height);
+	}
+	if (clip.x1 >= clip.x2 || clip.y1 >= clip.y2)
+		return;
+
+	sdrm_damage_add(&sfb->damage, &clip);
+}
+
+/**
+ * sdrm_damage_set_cursor - move, change or hide the cursor
+ * @sdrm: device
+ * @sfb: framebuffer holding the cursor image, or NULL to hide it
+ * @cursor: image and position, in scanout buffer coordinates, or in mode
+ *	coordinates while the scanout is scaled or turned
+ *
+ * Called from the commit path with the image mapped. The cursor is blended
+ * into uploads, so only what it covered and what it covers now is damaged:
+ * the primary contents underneath are simply uploaded again, and nothing
+ * has to be redrawn by the client.
+ */
+void sdrm_damage_set_cursor(struct sdrm_device *sdrm,
+			    struct sdrm_framebuffer *sfb,
+			    const struct sdrm_blit_cursor *cursor)
+{
+	struct sdrm_framebuffer *old_fb, *scanout;
+	struct sdrm_blit_cursor old;
+
+	/* cursor_blit keeps a pointer into the store, which must stay put */
+	if (sfb) {
+		drm_framebuffer_reference(&sfb->base);
+		sdrm_gem_pin(sfb->obj);
+	}
+
+	sdrm_blit_lock(sdrm);
+	old_fb = sdrm->cursor_fb;
+	old = sdrm->cursor_blit;
+	sdrm->cursor_fb = sfb;
+	if (sfb)
+		sdrm->cursor_blit = *cursor;
+	else
+		memset(&sdrm->cursor_blit, 0, sizeof(sdrm->cursor_blit));
+	scanout = sdrm->scanout;
+
+	if (scanout) {
+		spin_lock(&sdrm->damage_lock);
+		sdrm_damage_add_cursor(scanout, &old);
+		sdrm_damage_add_cursor(scanout, &sdrm->cursor_blit);
+		spin_unlock(&sdrm->damage_lock);
+	}
+	mutex_unlock(&sdrm->blit_lock);
+
+	if (old_fb) {
+		sdrm_gem_unpin(old_fb->obj);
+		drm_framebuffer_unreference(&old_fb->base);
+	}
+
+	if (scanout)
+		sdrm_flush_schedule(sdrm);
+}
+
 int sdrm_dirty(struct drm_framebuffer *fb,
 	       struct drm_file *file,
 	       unsigned int flags, unsigned int color,
@@ -227,9 +792,13 @@ int sdrm_dirty(struct drm_framebuffer *fb,
 	struct sdrm_framebuffer *sfb = to_sdrm_fb(fb);
 	struct drm_device *ddev = fb->dev;
 	struct sdrm_device *sdrm = ddev->dev_private;
-	struct drm_clip_rect full_clip;
+	struct drm_clip_rect full_clip, bbox;
 	unsigned int i;
-	int r;
+	u64 delay;
+
+	/* damage on anything but the scanout is picked up by the next flip */
+	if (READ_ONCE(sdrm->scanout) != sfb)
+		return 0;
 
 	if (!clips || !num_clips) {
 		full_clip.x1 = 0;
@@ -240,63 +809,211 @@ int sdrm_dirty(struct drm_framebuffer *fb,
 		num_clips = 1;
 	}
 
-	drm_modeset_lock_all(ddev);
-
-	if (sdrm->plane.fb != fb) {
-		r = 0;
-		goto unlock;
-	}
-
-	r = sdrm_begin_access(sfb);
-	if (r)
-		goto unlock;
-
+	bbox = clips[0];
+	spin_lock(&sdrm->damage_lock);
 	for (i = 0; i < num_clips; i++) {
 		if (clips[i].x2 <= clips[i].x1 ||
 		    clips[i].y2 <= clips[i].y1)
 			continue;
 
-		sdrm_blit(sfb, clips[i].x1, clips[i].y1,
-			  clips[i].x2 - clips[i].x1,
-			  clips[i].y2 - clips[i].y1);
+		sdrm_damage_add(&sfb->damage, &clips[i]);
+		bbox.x1 = min(bbox.x1, clips[i].x1);
+		bbox.y1 = min(bbox.y1, clips[i].y1);
+		bbox.x2 = max(bbox.x2, clips[i].x2);
+		bbox.y2 = max(bbox.y2, clips[i].y2);
 	}
+	spin_unlock(&sdrm->damage_lock);
 
-	sdrm_end_access(sfb);
+	this_cpu_inc(sdrm->stats->dirty_calls);
+	this_cpu_add(sdrm->stats->dirty_clips, num_clips);
+
+	delay = sdrm_flush_schedule(sdrm);
+	trace_sdrm_dirty(fb, num_clips, &bbox, delay);
 
-unlock:
-	drm_modeset_unlock_all(ddev);
 	return 0;
 }
 
-int sdrm_dirty_all_locked(struct sdrm_device *sdrm)
+/**
+ * sdrm_damage_flush - flush pending damage of the scanout buffer now
+ * @sdrm: device
+ *
+ * Runs the flush worker immediately instead of at the next refresh slot and
+ * waits for it. Used by latency-sensitive clients via DRM_IOCTL_NETV_FLUSH.
+ */
+void sdrm_damage_flush(struct sdrm_device *sdrm)
 {
-	struct drm_framebuffer *fb;
-	struct sdrm_framebuffer *sfb;
-	int r;
+	mod_delayed_work(sdrm->flush_wq, &sdrm->flush_work, 0);
+	flush_delayed_work(&sdrm->flush_work);
+}
 
-	fb = sdrm->plane.fb;
-	if (!fb)
-		return 0;
+int sdrm_flush_ioctl(struct drm_device *ddev, void *data,
+		     struct drm_file *file)
+{
+	sdrm_damage_flush(ddev->dev_private);
+	return 0;
+}
 
-	sfb = to_sdrm_fb(fb);
-	r = sdrm_begin_access(sfb);
-	if (r)
-		return r;
+static void sdrm_mirror_free(struct sdrm_blit_mirror *mirror)
+{
+	if (!mirror)
+		return;
 
-	sdrm_blit(sfb, 0, 0, fb->width, fb->height);
+	kfree(mirror->rows);
+	kfree(mirror->line);
+	vfree(mirror->map);
+	kfree(mirror);
+}
 
-	sdrm_end_access(sfb);
+/*
+ * Clients tend to re-render unchanged content and to send full-frame
+ * DIRTYFB calls; with a mirror of fb_map those only cost a compare in RAM
+ * instead of a full upload across PCIe. The mirror is an optimization, so
+ * failing to allocate it is not fatal.
+ */
+static struct sdrm_blit_mirror *sdrm_mirror_alloc(struct sdrm_device *sdrm)
+{
+	struct sdrm_blit_mirror *mirror;
+
+	mirror = kzalloc(sizeof(*mirror), GFP_KERNEL);
+	if (!mirror)
+		return NULL;
+
+	mirror->map = vmalloc((size_t)sdrm->fb_stride * sdrm->fb_height);
+	mirror->line = kmalloc(sdrm->fb_stride, GFP_KERNEL);
+	mirror->rows = kzalloc(sdrm->fb_height, GFP_KERNEL);
+	if (!mirror->map || !mirror->line || !mirror->rows) {
+		sdrm_mirror_free(mirror);
+		return NULL;
+	}
+
+	return mirror;
+}
+
+static void sdrm_blit_bands_free(struct sdrm_device *sdrm)
+{
+	unsigned int i;
+
+	if (sdrm->blit_wq) {
+		destroy_workqueue(sdrm->blit_wq);
+		sdrm->blit_wq = NULL;
+	}
+
+	if (sdrm->bands)
+		for (i = 0; i < sdrm->num_bands; i++)
+			kfree(sdrm->bands[i].line);
+	kfree(sdrm->bands);
+	sdrm->bands = NULL;
+	sdrm->num_bands = 0;
+}
+
+/* like the mirror, parallel blits are optional and fail quietly */
+static void sdrm_blit_bands_alloc(struct sdrm_device *sdrm)
+{
+	unsigned int i, count;
+
+	count = min3(sdrm_blit_cpus ?: num_online_cpus(), num_online_cpus(),
+		     (unsigned int)SDRM_BLIT_MAX_BANDS);
+	if (count < 2)
+		return;
+
+	sdrm->bands = kcalloc(count, sizeof(*sdrm->bands), GFP_KERNEL);
+	if (!sdrm->bands)
+		goto err_free;
+	sdrm->num_bands = count;
+
+	for (i = 0; i < count; i++) {
+		INIT_WORK(&sdrm->bands[i].work, sdrm_blit_band_work);
+		if (!sdrm->mirror)
+			continue;
+
+		sdrm->bands[i].line = kmalloc(sdrm->fb_stride, GFP_KERNEL);
+		if (!sdrm->bands[i].line)
+			goto err_free;
+	}
+
+	sdrm->blit_wq = alloc_workqueue("netvdrm-blit",
+					WQ_UNBOUND | WQ_HIGHPRI, count);
+	if (!sdrm->blit_wq)
+		goto err_free;
+
+	DRM_INFO("Converting large blits on up to %u CPUs\n", count);
+	return;
+
+err_free:
+	sdrm_blit_bands_free(sdrm);
+	DRM_INFO("No memory for parallel blits, disabled\n");
+}
+
+int sdrm_damage_init(struct sdrm_device *sdrm)
+{
+	u32 src_w;
+
+	mutex_init(&sdrm->blit_lock);
+	spin_lock_init(&sdrm->damage_lock);
+	INIT_DELAYED_WORK(&sdrm->flush_work, sdrm_flush_work);
+
+	sdrm->stats = alloc_percpu(struct sdrm_stats);
+	if (!sdrm->stats)
+		return -ENOMEM;
+
+	sdrm->flush_region = kzalloc(sizeof(*sdrm->flush_region), GFP_KERNEL);
+	if (!sdrm->flush_region)
+		return -ENOMEM;
+
+	sdrm->flush_wq = alloc_ordered_workqueue("netvdrm-flush", WQ_HIGHPRI);
+	if (!sdrm->flush_wq)
+		return -ENOMEM;
+
+	if (sdrm_mirror_enable) {
+		sdrm->mirror = sdrm_mirror_alloc(sdrm);
+		if (!sdrm->mirror)
+			DRM_INFO("No memory for scanout mirror, disabled\n");
+	}
+
+	sdrm_blit_bands_alloc(sdrm);
+
+	/*
+	 * the plane's source may be as wide as the mode is tall, for turning
+	 * it; scaling and rotation are never combined and share the scratch
+	 */
+	src_w = max(sdrm->fb_width, sdrm->fb_height);
+	sdrm->scale.scratch =
+		vmalloc(max_t(size_t,
+			      SDRM_BLIT_SCALE_SCRATCH(src_w, sdrm->fb_width),
+			      SDRM_BLIT_ROTATE_SCRATCH(sdrm->fb_width)));
+	sdrm->rotate.scratch = sdrm->scale.scratch;
+	if (!sdrm->scale.scratch)
+		DRM_INFO("No memory for plane scaling or rotation, disabled\n");
 
 	return 0;
 }
 
-int sdrm_dirty_all_unlocked(struct sdrm_device *sdrm)
+void sdrm_damage_fini(struct sdrm_device *sdrm)
 {
-	int r;
+	if (sdrm->flush_wq) {
+		cancel_delayed_work_sync(&sdrm->flush_work);
+		destroy_workqueue(sdrm->flush_wq);
+		sdrm->flush_wq = NULL;
+	}
 
-	drm_modeset_lock_all(sdrm->ddev);
-	r = sdrm_dirty_all_locked(sdrm);
-	drm_modeset_unlock_all(sdrm->ddev);
+	kfree(sdrm->flush_region);
+	sdrm->flush_region = NULL;
 
-	return r;
+	free_percpu(sdrm->stats);
+	sdrm->stats = NULL;
+
+	sdrm_blit_bands_free(sdrm);
+
+	sdrm_mirror_free(sdrm->mirror);
+	sdrm->mirror = NULL;
+
+	vfree(sdrm->scale.scratch);
+	sdrm->scale.scratch = NULL;
+	sdrm->rotate.scratch = NULL;
+
+	if (sdrm->cursor_fb) {
+		sdrm_gem_unpin(sdrm->cursor_fb->obj);
+		drm_framebuffer_unreference(&sdrm->cursor_fb->base);
+	}
+	sdrm->cursor_fb = NULL;
 }
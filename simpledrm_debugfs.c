@@ -0,0 +1,375 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <drm/drmP.h>
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+
+#include "simpledrm.h"
+#include "simpledrm_blit.h"
+
+static int sdrm_debugfs_damage(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct sdrm_device *sdrm = node->minor->dev->dev_private;
+	struct sdrm_region_stats *stats = &sdrm->damage_stats;
+
+	seq_printf(m, "flushes:          %llu\n", stats->flushes);
+	seq_printf(m, "clips:            %llu\n", stats->clips);
+	seq_printf(m, "rects uploaded:   %llu\n", stats->rects);
+	seq_printf(m, "bbox collapses:   %llu\n", stats->bbox);
+	seq_printf(m, "full collapses:   %llu\n", stats->full);
+	seq_printf(m, "px damaged:       %llu\n", stats->damaged);
+	seq_printf(m, "px after merge:   %llu\n", stats->merged);
+	seq_printf(m, "px uploaded:      %llu\n", stats->uploaded);
+	seq_printf(m, "px saved (merge): %llu\n",
+		   stats->damaged - stats->merged);
+
+	if (sdrm->mirror) {
+		seq_printf(m, "mirror checked:   %llu bytes\n",
+			   sdrm->mirror->checked);
+		seq_printf(m, "mirror written:   %llu bytes\n",
+			   sdrm->mirror->written);
+	}
+	if (sdrm->num_bands)
+		seq_printf(m, "parallel blits:   %llu\n", sdrm->parallel_blits);
+	if (sdrm->dma)
+		seq_printf(m, "dma uploaded:     %llu bytes\n", sdrm->dma_bytes);
+
+	return 0;
+}
+
+static int sdrm_debugfs_vram(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct sdrm_device *sdrm = node->minor->dev->dev_private;
+	int r = 0;
+
+	mutex_lock(&sdrm->vram_lock);
+	seq_printf(m, "fallbacks to system memory: %lu\n",
+		   sdrm->vram_fallbacks);
+	if (drm_mm_initialized(&sdrm->vram_mm))
+		r = drm_mm_dump_table(m, &sdrm->vram_mm);
+	mutex_unlock(&sdrm->vram_lock);
+
+	return r;
+}
+
+static int sdrm_debugfs_pool(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct sdrm_device *sdrm = node->minor->dev->dev_private;
+
+	spin_lock(&sdrm->pool_lock);
+	seq_printf(m, "hits:          %llu\n", sdrm->pool_hits);
+	seq_printf(m, "misses:        %llu\n", sdrm->pool_misses);
+	seq_printf(m, "cached:        %zu bytes\n", sdrm->pool_bytes);
+	seq_printf(m, "shrunk:        %lu pages\n", sdrm->pool_shrunk);
+	spin_unlock(&sdrm->pool_lock);
+
+	return 0;
+}
+
+static int sdrm_debugfs_scanout(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct sdrm_device *sdrm = node->minor->dev->dev_private;
+
+	seq_printf(m, "backend: %s\n", sdrm->hw ? sdrm->hw->name : "blit");
+	seq_printf(m, "base:    0x%x\n", sdrm->scanout_base);
+	seq_printf(m, "flips:   %lu\n", sdrm->flips);
+
+	return 0;
+}
+
+static const char * const sdrm_blit_path_names[SDRM_BLIT_PATHS] = {
+	[SDRM_BLIT_PATH_CPU] = "cpu",
+	[SDRM_BLIT_PATH_PARALLEL] = "parallel",
+	[SDRM_BLIT_PATH_DMA] = "dma",
+	[SDRM_BLIT_PATH_PAN] = "pan",
+	[SDRM_BLIT_PATH_SCALED] = "scaled",
+	[SDRM_BLIT_PATH_ROTATED] = "rotated",
+};
+
+static int sdrm_debugfs_stats(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct sdrm_device *sdrm = node->minor->dev->dev_private;
+	const struct sdrm_stats *pcpu;
+	struct sdrm_stats *sum;
+	unsigned int i, cpu;
+	u32 src, dst;
+	u64 blits = 0;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	/* unlocked, the counters only ever grow */
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(sdrm->stats, cpu);
+		for (i = 0; i < SDRM_BLIT_PATHS; i++)
+			sum->blits[i] += pcpu->blits[i];
+		sum->bytes += pcpu->bytes;
+		for (i = 0; i < SDRM_STATS_FORMATS; i++)
+			sum->pixels[i] += pcpu->pixels[i];
+		sum->dirty_calls += pcpu->dirty_calls;
+		sum->dirty_clips += pcpu->dirty_clips;
+		sum->lock_waits += pcpu->lock_waits;
+		sum->lock_wait_ns += pcpu->lock_wait_ns;
+		for (i = 0; i < SDRM_STATS_BUCKETS; i++)
+			sum->blit_ns[i] += pcpu->blit_ns[i];
+	}
+
+	for (i = 0; i < SDRM_BLIT_PATHS; i++)
+		blits += sum->blits[i];
+	seq_printf(m, "blits:            %llu\n", blits);
+	for (i = 0; i < SDRM_BLIT_PATHS; i++)
+		if (sum->blits[i])
+			seq_printf(m, "  %-15s %llu\n", sdrm_blit_path_names[i],
+				   sum->blits[i]);
+	seq_printf(m, "bytes uploaded:   %llu\n", sum->bytes);
+	seq_printf(m, "dirty calls:      %llu\n", sum->dirty_calls);
+	seq_printf(m, "dirty clips:      %llu\n", sum->dirty_clips);
+	seq_printf(m, "lock waits:       %llu\n", sum->lock_waits);
+	seq_printf(m, "lock wait time:   %llu ns\n", sum->lock_wait_ns);
+
+	seq_puts(m, "pixels converted:\n");
+	dst = sdrm->fb_format;
+	for (i = 0; i < SDRM_STATS_FORMATS; i++) {
+		if (!sum->pixels[i])
+			continue;
+		src = sdrm->plane.format_types[i];
+		seq_printf(m, "  %c%c%c%c -> %c%c%c%c    %llu\n",
+			   sdrm_fourcc_chars(src), sdrm_fourcc_chars(dst),
+			   sum->pixels[i]);
+	}
+
+	seq_puts(m, "blit durations:\n");
+	for (i = 0; i < SDRM_STATS_BUCKETS; i++) {
+		if (!sum->blit_ns[i])
+			continue;
+		seq_printf(m, "  >= %10llu ns %llu\n", 1ULL << i,
+			   sum->blit_ns[i]);
+	}
+
+	kfree(sum);
+
+	return 0;
+}
+
+/* each way of writing is timed for at least this long */
+#define SDRM_BW_TEST_NS (100 * NSEC_PER_MSEC)
+
+static const char * const sdrm_bw_names[SDRM_BLIT_BW_MODES] = {
+	[SDRM_BLIT_BW_MEMCPY] = "memcpy",
+	[SDRM_BLIT_BW_STREAM] = "non-temporal",
+	[SDRM_BLIT_BW_ROWS] = "per row",
+	[SDRM_BLIT_BW_DWORD] = "32-bit stores",
+};
+
+/*
+ * Time writes of frame 0 in each mode, in chunks under the blit lock like
+ * uploads; returns the bandwidth in MB/s, or 0 if @mode is unavailable.
+ */
+static u64 sdrm_bw_measure(struct sdrm_device *sdrm, const u8 *src,
+			   enum sdrm_blit_bw mode)
+{
+	u32 len = sdrm->fb_width * ((sdrm->fb_bpp + 7) / 8);
+	u32 stride = sdrm->fb_stride;
+	u64 bytes = 0, ns = 0;
+	ktime_t start;
+	u32 y, rows;
+	bool ok;
+
+	while (ns < SDRM_BW_TEST_NS) {
+		for (y = 0; y < sdrm->fb_height; y += rows) {
+			rows = min_t(u32, sdrm->fb_height - y,
+				     SDRM_FLUSH_CHUNK_ROWS);
+
+			mutex_lock(&sdrm->blit_lock);
+			if (!sdrm->fb_map) {
+				mutex_unlock(&sdrm->blit_lock);
+				return 0;
+			}
+			start = ktime_get();
+			ok = sdrm_blit_bandwidth(sdrm->fb_map + y * stride,
+						 src + y * stride, stride,
+						 len, rows, mode);
+			ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+			mutex_unlock(&sdrm->blit_lock);
+			if (!ok)
+				return 0;
+
+			bytes += (u64)len * rows;
+			cond_resched();
+		}
+	}
+
+	return div64_u64(bytes * 1000, ns);
+}
+
+/*
+ * Writing 1 to "bar_bandwidth" runs the test, reading it shows the last
+ * results. The test is destructive: frame 0 of BAR0 is overwritten with
+ * grey in every mode, for at least SDRM_BW_TEST_NS each, and only then is
+ * the scanout uploaded again. On write-combined memory 32-bit stores are
+ * merged into bursts and reach at least half of the best mode; on memory
+ * that ended up uncached despite ioremap_wc(), e.g. for lack of PAT or due
+ * to a conflicting MTRR, each store is a bus transaction of its own.
+ */
+static int sdrm_bw_run(struct sdrm_device *sdrm)
+{
+	size_t size = (size_t)sdrm->fb_stride * sdrm->fb_height;
+	u64 mbps[SDRM_BLIT_BW_MODES];
+	unsigned int i;
+	u8 *src;
+
+	src = vmalloc(size);
+	if (!src)
+		return -ENOMEM;
+	memset(src, 0x80, size);
+
+	for (i = 0; i < SDRM_BLIT_BW_MODES; i++)
+		mbps[i] = sdrm_bw_measure(sdrm, src, i);
+
+	vfree(src);
+
+	/* the mirror no longer matches, and the scanout was overwritten */
+	sdrm_damage_invalidate(sdrm);
+
+	mutex_lock(&sdrm->blit_lock);
+	memcpy(sdrm->bw_mbps, mbps, sizeof(mbps));
+	sdrm->bw_tested = true;
+	mutex_unlock(&sdrm->blit_lock);
+
+	return 0;
+}
+
+static int sdrm_bw_show(struct seq_file *m, void *data)
+{
+	struct sdrm_device *sdrm = m->private;
+	u64 mbps[SDRM_BLIT_BW_MODES], best = 0;
+	unsigned int i, pct;
+	bool tested;
+
+	mutex_lock(&sdrm->blit_lock);
+	memcpy(mbps, sdrm->bw_mbps, sizeof(mbps));
+	tested = sdrm->bw_tested;
+	mutex_unlock(&sdrm->blit_lock);
+
+	if (!tested) {
+		seq_puts(m, "not run; write 1 to run it, which overwrites the display for about half a second\n");
+		return 0;
+	}
+
+	for (i = 0; i < SDRM_BLIT_BW_MODES; i++) {
+		best = max(best, mbps[i]);
+		if (mbps[i])
+			seq_printf(m, "%-15s %llu MB/s\n", sdrm_bw_names[i],
+				   mbps[i]);
+		else
+			seq_printf(m, "%-15s n/a\n", sdrm_bw_names[i]);
+	}
+
+	if (!best || !mbps[SDRM_BLIT_BW_DWORD]) {
+		seq_puts(m, "write-combined: unknown\n");
+		return 0;
+	}
+
+	pct = div64_u64(mbps[SDRM_BLIT_BW_DWORD] * 100, best);
+	if (pct >= 50)
+		seq_printf(m, "write-combined: yes, 32-bit stores at %u%%\n",
+			   pct);
+	else
+		seq_printf(m, "write-combined: NO, 32-bit stores at %u%%, the mapping behaves uncached\n",
+			   pct);
+
+	return 0;
+}
+
+static int sdrm_bw_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sdrm_bw_show, inode->i_private);
+}
+
+static ssize_t sdrm_bw_write(struct file *file, const char __user *ubuf,
+			     size_t len, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	bool run;
+	int r;
+
+	r = kstrtobool_from_user(ubuf, len, &run);
+	if (r)
+		return r;
+
+	if (run) {
+		r = sdrm_bw_run(m->private);
+		if (r)
+			return r;
+	}
+
+	return len;
+}
+
+static const struct file_operations sdrm_bw_fops = {
+	.owner = THIS_MODULE,
+	.open = sdrm_bw_open,
+	.read = seq_read,
+	.write = sdrm_bw_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct drm_info_list sdrm_debugfs_list[] = {
+	{ "damage", sdrm_debugfs_damage, 0 },
+	{ "stats", sdrm_debugfs_stats, 0 },
+	{ "vram", sdrm_debugfs_vram, 0 },
+	{ "pool", sdrm_debugfs_pool, 0 },
+	{ "scanout", sdrm_debugfs_scanout, 0 },
+};
+
+int sdrm_debugfs_init(struct drm_minor *minor)
+{
+	struct sdrm_device *sdrm = minor->dev->dev_private;
+	int r;
+
+	r = drm_debugfs_create_files(sdrm_debugfs_list,
+				     ARRAY_SIZE(sdrm_debugfs_list),
+				     minor->debugfs_root, minor);
+	if (r)
+		return r;
+
+	/* not a drm_info_list entry, as reading must not run the test */
+	sdrm->bw_dentry = debugfs_create_file("bar_bandwidth", 0644,
+					      minor->debugfs_root, sdrm,
+					      &sdrm_bw_fops);
+	if (!sdrm->bw_dentry) {
+		sdrm_debugfs_cleanup(minor);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void sdrm_debugfs_cleanup(struct drm_minor *minor)
+{
+	struct sdrm_device *sdrm = minor->dev->dev_private;
+
+	debugfs_remove(sdrm->bw_dentry);
+	sdrm->bw_dentry = NULL;
+	drm_debugfs_remove_files(sdrm_debugfs_list,
+				 ARRAY_SIZE(sdrm_debugfs_list), minor);
+}
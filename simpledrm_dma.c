@@ -0,0 +1,326 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * DMA upload backend. Instead of storing every pixel through the WC
+ * mapping, each flush chunk is converted into one of two RAM staging
+ * buffers, laid out like the BAR, and copied into the BAR by a dmaengine
+ * DMA_MEMCPY channel. While the engine copies one chunk, the CPU converts
+ * the next one into the other buffer. Any memcpy-capable provider will
+ * do. Without one, or if the engine stalls, uploads fall back to the CPU.
+ */
+
+#include <drm/drmP.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/gfp.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#include "simpledrm.h"
+#include "simpledrm_blit.h"
+
+static bool sdrm_dma_enable;
+module_param_named(dma, sdrm_dma_enable, bool, 0444);
+MODULE_PARM_DESC(dma,
+		 "Upload damage with a DMA memcpy channel if one is available (default: false)");
+
+#define SDRM_DMA_TIMEOUT_MS 100
+
+struct sdrm_dma_stage {
+	void *vaddr;
+	dma_addr_t addr;
+	struct completion done;
+	bool busy;
+};
+
+struct sdrm_dma {
+	struct dma_chan *chan;
+	struct device *dev;
+	dma_addr_t bar;
+	size_t bar_size;
+	size_t stage_size;
+	unsigned int next;
+	bool broken;
+	struct sdrm_dma_stage stage[2];
+};
+
+static void sdrm_dma_done(void *data)
+{
+	struct sdrm_dma_stage *stage = data;
+
+	complete(&stage->done);
+}
+
+static int sdrm_dma_wait(struct sdrm_dma *dma, struct sdrm_dma_stage *stage)
+{
+	unsigned int i;
+
+	if (!stage->busy)
+		return 0;
+
+	if (wait_for_completion_timeout(&stage->done,
+					msecs_to_jiffies(SDRM_DMA_TIMEOUT_MS))) {
+		stage->busy = false;
+		return 0;
+	}
+
+	DRM_ERROR("DMA upload timed out, uploading with the CPU\n");
+	dmaengine_terminate_all(dma->chan);
+	for (i = 0; i < ARRAY_SIZE(dma->stage); i++)
+		dma->stage[i].busy = false;
+	dma->broken = true;
+
+	return -ETIMEDOUT;
+}
+
+/**
+ * sdrm_dma_sync - wait until all queued DMA uploads reached the device
+ * @sdrm: device
+ *
+ * Caller holds the blit lock.
+ */
+void sdrm_dma_sync(struct sdrm_device *sdrm)
+{
+	struct sdrm_dma *dma = sdrm->dma;
+	unsigned int i;
+
+	if (!dma)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(dma->stage); i++)
+		sdrm_dma_wait(dma, &dma->stage[i]);
+}
+
+/* copy what could not be queued, once the queued part is done */
+static void sdrm_dma_cpu_rows(struct sdrm_device *sdrm,
+			      struct sdrm_dma_stage *stage, dma_cookie_t cookie,
+			      u32 off, u32 y, u32 row, u32 height, u32 len)
+{
+	struct sdrm_dma *dma = sdrm->dma;
+	u32 stride = sdrm->fb_stride;
+
+	if (cookie > 0 && dma_sync_wait(dma->chan, cookie) != DMA_COMPLETE)
+		row = 0;
+
+	for (; row < height; row++)
+		memcpy_toio((u8 __iomem *)sdrm->fb_map + (y + row) * stride + off,
+			    (u8 *)stage->vaddr + row * stride + off, len);
+}
+
+/**
+ * sdrm_dma_blit - upload a rect through the DMA engine
+ * @sdrm: device
+ * @src: source buffer
+ * @x,@y,@width,@height: rect, at most SDRM_FLUSH_CHUNK_ROWS high
+ *
+ * Returns once the rect is converted and its copy is queued. Caller holds
+ * the blit lock and calls sdrm_dma_sync() before dropping access to the
+ * device. Returns a negative error code if the caller has to upload with
+ * the CPU instead.
+ */
+int sdrm_dma_blit(struct sdrm_device *sdrm, const struct sdrm_blit_buf *src,
+		  u32 x, u32 y, u32 width, u32 height)
+{
+	struct sdrm_dma *dma = sdrm->dma;
+	struct dma_async_tx_descriptor *tx;
+	struct sdrm_dma_stage *stage;
+	struct sdrm_blit_buf s, d;
+	dma_cookie_t cookie = 0;
+	u32 stride = sdrm->fb_stride;
+	u32 cpp = (sdrm->fb_bpp + 7) / 8;
+	u32 off, len, row, rows;
+	unsigned long flags;
+
+	if (!dma || dma->broken)
+		return -ENODEV;
+	/* the staged rows must start on a chroma row */
+	if (src->uv && (y & 1))
+		return -EINVAL;
+	if (x >= sdrm->fb_width || y >= sdrm->fb_vheight ||
+	    y >= src->height)
+		return 0;
+
+	width = min(width, sdrm->fb_width - x);
+	height = min3(height, sdrm->fb_vheight - y, src->height - y);
+	if ((size_t)height * stride > dma->stage_size)
+		return -E2BIG;
+
+	stage = &dma->stage[dma->next];
+	if (sdrm_dma_wait(dma, stage))
+		return -ETIMEDOUT;
+
+	/* convert into the stage, which is laid out like rows [y, y+h) */
+	s = *src;
+	s.map += y * src->stride;
+	if (s.uv)
+		s.uv += y / 2 * src->uv_stride;
+	s.cursor.y -= y;
+	s.height = height;
+
+	d.map = stage->vaddr;
+	d.four_cc = sdrm->fb_format;
+	d.width = sdrm->fb_width;
+	d.height = height;
+	d.stride = stride;
+	d.cpp = cpp;
+	d.mirror = NULL;
+	d.wc = false;
+
+	dma_sync_single_for_cpu(dma->dev, stage->addr, dma->stage_size,
+				DMA_TO_DEVICE);
+	sdrm_blit_rect(&d, &s, x, 0, width, height);
+	dma_sync_single_for_device(dma->dev, stage->addr, dma->stage_size,
+				   DMA_TO_DEVICE);
+
+	off = x * cpp;
+	len = width * cpp;
+
+	/* full-width rows are contiguous on both sides */
+	rows = height;
+	if (len == stride) {
+		len *= height;
+		rows = 1;
+	}
+
+	reinit_completion(&stage->done);
+
+	for (row = 0; row < rows; row++) {
+		flags = DMA_CTRL_ACK;
+		if (row == rows - 1)
+			flags |= DMA_PREP_INTERRUPT;
+
+		tx = dmaengine_prep_dma_memcpy(dma->chan,
+					       dma->bar + (y + row) * stride + off,
+					       stage->addr + row * stride + off,
+					       len, flags);
+		if (!tx)
+			break;
+
+		if (row == rows - 1) {
+			tx->callback = sdrm_dma_done;
+			tx->callback_param = stage;
+		}
+
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie))
+			break;
+	}
+
+	dma_async_issue_pending(dma->chan);
+
+	if (row < rows) {
+		/* out of descriptors, no completion is coming for this stage */
+		sdrm_dma_cpu_rows(sdrm, stage, row ? cookie : 0, off, y, row,
+				  rows, len);
+		return 0;
+	}
+
+	stage->busy = true;
+	dma->next = (dma->next + 1) % ARRAY_SIZE(dma->stage);
+	sdrm->dma_bytes += (u64)len * rows;
+
+	return 0;
+}
+
+static void sdrm_dma_free(struct sdrm_dma *dma)
+{
+	struct sdrm_dma_stage *stage;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(dma->stage); i++) {
+		stage = &dma->stage[i];
+		if (!stage->vaddr)
+			continue;
+
+		if (!dma_mapping_error(dma->dev, stage->addr))
+			dma_unmap_single(dma->dev, stage->addr,
+					 dma->stage_size, DMA_TO_DEVICE);
+		free_pages_exact(stage->vaddr, dma->stage_size);
+	}
+
+	if (dma->bar_size)
+		dma_unmap_resource(dma->dev, dma->bar, dma->bar_size,
+				   DMA_FROM_DEVICE, 0);
+
+	dma_release_channel(dma->chan);
+	kfree(dma);
+}
+
+int sdrm_dma_init(struct sdrm_device *sdrm)
+{
+	struct sdrm_dma_stage *stage;
+	struct dma_chan *chan;
+	struct sdrm_dma *dma;
+	dma_cap_mask_t mask;
+	unsigned int i;
+
+	if (!sdrm_dma_enable)
+		return 0;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_chan_by_mask(&mask);
+	if (IS_ERR(chan)) {
+		DRM_INFO("No DMA memcpy channel, uploading with the CPU\n");
+		return 0;
+	}
+
+	dma = kzalloc(sizeof(*dma), GFP_KERNEL);
+	if (!dma) {
+		dma_release_channel(chan);
+		return -ENOMEM;
+	}
+
+	dma->chan = chan;
+	dma->dev = chan->device->dev;
+	dma->stage_size = PAGE_ALIGN((size_t)SDRM_FLUSH_CHUNK_ROWS *
+				     sdrm->fb_stride);
+
+	dma->bar = dma_map_resource(dma->dev, sdrm->fb_base, sdrm->fb_size,
+				    DMA_FROM_DEVICE, 0);
+	if (dma_mapping_error(dma->dev, dma->bar))
+		goto err_free;
+	dma->bar_size = sdrm->fb_size;
+
+	for (i = 0; i < ARRAY_SIZE(dma->stage); i++) {
+		stage = &dma->stage[i];
+		init_completion(&stage->done);
+
+		stage->vaddr = alloc_pages_exact(dma->stage_size, GFP_KERNEL);
+		if (!stage->vaddr)
+			goto err_free;
+
+		stage->addr = dma_map_single(dma->dev, stage->vaddr,
+					     dma->stage_size, DMA_TO_DEVICE);
+		if (dma_mapping_error(dma->dev, stage->addr))
+			goto err_free;
+	}
+
+	sdrm->dma = dma;
+	DRM_INFO("Uploading with DMA channel %s\n", dma_chan_name(chan));
+
+	return 0;
+
+err_free:
+	sdrm_dma_free(dma);
+	DRM_INFO("Cannot set up DMA uploads, uploading with the CPU\n");
+	return 0;
+}
+
+void sdrm_dma_fini(struct sdrm_device *sdrm)
+{
+	if (!sdrm->dma)
+		return;
+
+	sdrm_dma_sync(sdrm);
+	sdrm_dma_free(sdrm->dma);
+	sdrm->dma = NULL;
+}
@@ -22,7 +22,9 @@
 #include <linux/regulator/consumer.h>
 #include <linux/string.h>
 
+#include "netv_drm.h"
 #include "simpledrm.h"
+#include "simpledrm_blit.h"
 
 void sdrm_hw_fini(struct drm_device *dev);
 int sdrm_hw_init(struct drm_device *dev, uint32_t flags);
@@ -43,6 +45,26 @@ static int sdrm_simplefb_load(struct drm_device *ddev, unsigned long flags)
 	if (ret)
 		goto err_free;
 
+	ret = sdrm_damage_init(sdrm);
+	if (ret)
+		goto err_destroy;
+
+	ret = sdrm_dma_init(sdrm);
+	if (ret)
+		goto err_destroy;
+
+	ret = sdrm_pool_init(sdrm);
+	if (ret)
+		goto err_destroy;
+
+	ret = sdrm_vram_init(sdrm);
+	if (ret)
+		goto err_destroy;
+
+	ret = sdrm_vblank_init(sdrm);
+	if (ret)
+		goto err_destroy;
+
 	ret = sdrm_drm_modeset_init(sdrm);
 	if (ret)
 		goto err_destroy;
@@ -55,6 +77,11 @@ static int sdrm_simplefb_load(struct drm_device *ddev, unsigned long flags)
 	return 0;
 
 err_destroy:
+	sdrm_vblank_fini(sdrm);
+	sdrm_vram_fini(sdrm);
+	sdrm_pool_fini(sdrm);
+	sdrm_damage_fini(sdrm);
+	sdrm_dma_fini(sdrm);
 	sdrm_hw_fini(ddev);
 err_free:
 	drm_dev_unref(ddev);
@@ -69,12 +96,17 @@ static int sdrm_simplefb_unload(struct drm_device *ddev)
 
 	sdrm_fbdev_cleanup(sdrm);
 	drm_dev_unregister(ddev);
+	sdrm_vblank_fini(sdrm);
+	sdrm_damage_fini(sdrm);
+	sdrm_dma_fini(sdrm);
 	drm_mode_config_cleanup(ddev);
+	sdrm_pool_fini(sdrm);
+	sdrm_vram_fini(sdrm);
 
 	/* protect fb_map removal against sdrm_blit() */
-	drm_modeset_lock_all(ddev);
+	mutex_lock(&sdrm->blit_lock);
 	sdrm_hw_fini(ddev);
-	drm_modeset_unlock_all(ddev);
+	mutex_unlock(&sdrm->blit_lock);
 
 	drm_dev_unref(ddev);
 	kfree(sdrm);
@@ -96,11 +128,26 @@ static const struct file_operations sdrm_drm_fops = {
 	.llseek = noop_llseek,
 };
 
+static const struct drm_ioctl_desc sdrm_ioctls[] = {
+	DRM_IOCTL_DEF_DRV(NETV_FLUSH, sdrm_flush_ioctl,
+			  DRM_AUTH | DRM_UNLOCKED),
+};
+
 static struct drm_driver sdrm_drm_driver = {
 	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_PRIME |
 			   DRIVER_ATOMIC,
 	.fops = &sdrm_drm_fops,
 	.lastclose = sdrm_lastclose,
+	.ioctls = sdrm_ioctls,
+	.num_ioctls = ARRAY_SIZE(sdrm_ioctls),
+	.get_vblank_counter = drm_vblank_no_hw_counter,
+	.enable_vblank = sdrm_enable_vblank,
+	.disable_vblank = sdrm_disable_vblank,
+	.get_vblank_timestamp = sdrm_get_vblank_timestamp,
+#ifdef CONFIG_DEBUG_FS
+	.debugfs_init = sdrm_debugfs_init,
+	.debugfs_cleanup = sdrm_debugfs_cleanup,
+#endif
 
 	.gem_free_object = sdrm_gem_free_object,
 	.prime_fd_to_handle = drm_gem_prime_fd_to_handle,
@@ -236,6 +283,7 @@ static struct pci_driver netv_pci_driver = {
 
 static int __init sdrm_init(void)
 {
+	sdrm_blit_init();
 	sdrm_fbdev_kickout_init();
 	return drm_pci_init(&sdrm_drm_driver, &netv_pci_driver);
 }
@@ -13,14 +13,24 @@
 #include <drm/drm_fb_helper.h>
 #include <linux/console.h>
 #include <linux/fb.h>
+#include <linux/uaccess.h>
 #include <linux/platform_device.h>
 #include <linux/platform_data/simplefb.h>
 
 #include "simpledrm.h"
 
+/*
+ * fbdev draws into a cached shadow in system memory rather than into the
+ * write-combined fb_map, where console scrolling would read back across
+ * the bus. The shadow is an ordinary system memory framebuffer: drawing
+ * and write() report damage through the fb helper's dirty worker,
+ * mmap() clients through deferred I/O. Both end up in sdrm_dirty() and
+ * are uploaded by the damage flush worker like any other scanout.
+ */
 struct sdrm_fbdev {
 	struct drm_fb_helper fb_helper;
-	struct drm_framebuffer fb;
+	struct sdrm_framebuffer *fb;
+	struct fb_deferred_io defio;
 };
 
 static inline struct sdrm_fbdev *to_sdrm_fbdev(struct drm_fb_helper *helper)
@@ -38,72 +48,128 @@ static void sdrm_fbdev_fb_destroy(struct fb_info *info)
 	drm_fb_helper_release_fbi(info->par);
 }
 
+static int sdrm_fbdev_ioctl(struct fb_info *fbi, unsigned int cmd,
+			    unsigned long arg)
+{
+	struct drm_fb_helper *helper = fbi->par;
+	struct sdrm_device *sdrm = helper->dev->dev_private;
+	u32 crtc;
+
+	switch (cmd) {
+	case FBIO_WAITFORVSYNC:
+		if (get_user(crtc, (u32 __user *)arg))
+			return -EFAULT;
+		if (crtc)
+			return -EINVAL;
+
+		/* vblanks are off while the display is */
+		if (drm_crtc_vblank_get(&sdrm->crtc))
+			return -EBUSY;
+		drm_crtc_wait_one_vblank(&sdrm->crtc);
+		drm_crtc_vblank_put(&sdrm->crtc);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
 static struct fb_ops sdrm_fbdev_ops = {
 	.owner		= THIS_MODULE,
-	.fb_fillrect	= drm_fb_helper_cfb_fillrect,
-	.fb_copyarea	= drm_fb_helper_cfb_copyarea,
-	.fb_imageblit	= drm_fb_helper_cfb_imageblit,
+	.fb_read	= drm_fb_helper_sys_read,
+	.fb_write	= drm_fb_helper_sys_write,
+	.fb_fillrect	= drm_fb_helper_sys_fillrect,
+	.fb_copyarea	= drm_fb_helper_sys_copyarea,
+	.fb_imageblit	= drm_fb_helper_sys_imageblit,
 	.fb_check_var	= drm_fb_helper_check_var,
 	.fb_set_par	= drm_fb_helper_set_par,
 	.fb_setcmap	= drm_fb_helper_setcmap,
+	.fb_pan_display	= drm_fb_helper_pan_display,
+	.fb_ioctl	= sdrm_fbdev_ioctl,
 	.fb_destroy	= sdrm_fbdev_fb_destroy,
 };
 
-static struct drm_framebuffer_funcs sdrm_fb_funcs = {
-	.destroy = drm_framebuffer_cleanup,
-};
-
 static int sdrm_fbdev_create(struct drm_fb_helper *helper,
 			     struct drm_fb_helper_surface_size *sizes)
 {
 	struct sdrm_fbdev *fbdev = to_sdrm_fbdev(helper);
 	struct drm_device *ddev = helper->dev;
 	struct sdrm_device *sdrm = ddev->dev_private;
-	struct drm_framebuffer *fb = &fbdev->fb;
 	struct drm_mode_fb_cmd2 mode_cmd = {
 		.width = sdrm->fb_width,
-		.height = sdrm->fb_height,
+		.height = sdrm->fb_vheight,
 		.pitches[0] = sdrm->fb_stride,
 		.pixel_format = sdrm->fb_format,
 	};
+	struct sdrm_gem_object *obj;
+	struct drm_framebuffer *fb;
 	struct fb_info *fbi;
+	size_t size;
 	int ret;
 
-	fbi = drm_fb_helper_alloc_fbi(helper);
-	if (IS_ERR(fbi))
-		return PTR_ERR(fbi);
+	/* covers the panning area too, which is uploaded like frame 0 */
+	size = PAGE_ALIGN((size_t)sdrm->fb_stride * sdrm->fb_vheight);
+	obj = sdrm_gem_alloc_object(ddev, size);
+	if (!obj)
+		return -ENOMEM;
 
-	drm_helper_mode_fill_fb_struct(fb, &mode_cmd);
+	ret = sdrm_gem_get_pages(obj);
+	if (ret)
+		goto err_unref;
 
-	ret = drm_framebuffer_init(ddev, fb, &sdrm_fb_funcs);
-	if (ret) {
+	fbdev->fb = sdrm_fb_new(ddev, &mode_cmd, obj, NULL);
+	if (IS_ERR(fbdev->fb)) {
+		ret = PTR_ERR(fbdev->fb);
+		fbdev->fb = NULL;
 		dev_err(ddev->dev, "Failed to initialize framebuffer: %d\n", ret);
-		goto err_fb_info_destroy;
+		goto err_unref;
+	}
+	fb = &fbdev->fb->base;
+
+	fbi = drm_fb_helper_alloc_fbi(helper);
+	if (IS_ERR(fbi)) {
+		ret = PTR_ERR(fbi);
+		goto err_fb_unref;
 	}
 
 	helper->fb = fb;
 	fbi->par = helper;
 
 	fbi->flags = FBINFO_DEFAULT | FBINFO_MISC_FIRMWARE |
-		      FBINFO_CAN_FORCE_OUTPUT;
+		      FBINFO_CAN_FORCE_OUTPUT | FBINFO_READS_FAST;
+	/* lets fbcon scroll by panning, see sdrm_vram_init() */
+	if (sdrm->fb_vheight > sdrm->fb_height)
+		fbi->flags |= FBINFO_HWACCEL_YPAN;
 	fbi->fbops = &sdrm_fbdev_ops;
 
+	/* yres_virtual is the framebuffer height, yres the mode's */
 	drm_fb_helper_fill_fix(fbi, fb->pitches[0], fb->depth);
-	drm_fb_helper_fill_var(fbi, helper, fb->width, fb->height);
+	drm_fb_helper_fill_var(fbi, helper, sdrm->fb_width, sdrm->fb_height);
 
 	strncpy(fbi->fix.id, "simpledrmfb", 15);
-	fbi->fix.smem_start = (unsigned long)sdrm->fb_base;
-	fbi->fix.smem_len = sdrm->fb_size;
-	fbi->screen_base = sdrm->fb_map;
+	fbi->fix.smem_len = size;
+	fbi->screen_base = obj->vmapping;
+	fbi->screen_size = size;
 
+	/* still claims the BAR, so that hw drivers can kick us out */
 	fbi->apertures->ranges[0].base = sdrm->fb_base;
 	fbi->apertures->ranges[0].size = sdrm->fb_size;
 
+	/* flushes are paced by sdrm_dirty(), this only batches page faults */
+	fbdev->defio.delay = HZ / 60;
+	fbdev->defio.deferred_io = drm_fb_helper_deferred_io;
+	fbi->fbdefio = &fbdev->defio;
+	fb_deferred_io_init(fbi);
+
 	return 0;
 
-err_fb_info_destroy:
-	drm_fb_helper_release_fbi(helper);
+err_fb_unref:
+	drm_framebuffer_unregister_private(fb);
+	drm_framebuffer_unreference(fb);
+	fbdev->fb = NULL;
+	return ret;
 
+err_unref:
+	drm_gem_object_unreference_unlocked(&obj->base);
 	return ret;
 }
 
@@ -168,14 +234,19 @@ void sdrm_fbdev_cleanup(struct sdrm_device *sdrm)
 	sdrm->fbdev = NULL;
 	fb_helper = &fbdev->fb_helper;
 
+	/* gives the shadow pages back before they are freed below */
+	fb_deferred_io_cleanup(fb_helper->fbdev);
+
 	/* it might have been kicked out */
 	if (registered_fb[fbdev->fb_helper.fbdev->node])
 		drm_fb_helper_unregister_fbi(fb_helper);
 
 	/* freeing fb_info is done in fb_ops.fb_destroy() */
 
-	drm_framebuffer_unregister_private(&fbdev->fb);
-	drm_framebuffer_cleanup(&fbdev->fb);
+	/* nothing draws any more, so nothing queues it again */
+	cancel_work_sync(&fb_helper->dirty_work);
+	drm_framebuffer_unregister_private(&fbdev->fb->base);
+	drm_framebuffer_unreference(&fbdev->fb->base);
 
 	drm_fb_helper_fini(fb_helper);
 	kfree(fbdev);
@@ -223,8 +294,8 @@ void netv_fbdev_suspend(struct drm_device *drm_dev)
 }
 
 /*
- * Since fbdev is using the native framebuffer, fbcon has to be disabled
- * when the drm stack is used.
+ * fbcon keeps drawing into its shadow, which is pointless while another
+ * framebuffer is scanned out, so it is suspended when the drm stack is used.
  */
 void sdrm_fbdev_display_pipe_update(struct sdrm_device *sdrm,
 				    struct drm_framebuffer *fb)
@@ -9,19 +9,135 @@
  */
 
 #include <drm/drmP.h>
+#include <linux/bitops.h>
 #include <linux/dma-buf.h>
 #include <linux/errno.h>
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 
 #include "simpledrm.h"
+#include "simpledrm_trace.h"
+
+static unsigned int sdrm_fault_around = 16;
+module_param_named(fault_around, sdrm_fault_around, uint, 0644);
+MODULE_PARM_DESC(fault_around,
+		 "Pages mapped ahead of sequential mmap faults (default: 16)");
+
+static bool sdrm_mmap_prefault;
+module_param_named(prefault, sdrm_mmap_prefault, bool, 0644);
+MODULE_PARM_DESC(prefault,
+		 "Map all pages of dumb buffers at mmap() time (default: false)");
+
+static bool sdrm_wp_damage;
+module_param_named(wp_damage, sdrm_wp_damage, bool, 0644);
+MODULE_PARM_DESC(wp_damage,
+		 "Track writes to mmap'd dumb buffers as damage, no DIRTYFB needed (default: false)");
+
+/* largest block tried for backing store, 2 MiB with 4 KiB pages */
+#define SDRM_GEM_MAX_ORDER min(9, MAX_ORDER - 1)
+
+/**
+ * sdrm_gem_free_store - free backing store from sdrm_gem_get_pages()
+ * @pages: pages of the store
+ * @vmapping: their kernel mapping
+ */
+void sdrm_gem_free_store(struct sg_table *pages, void *vmapping)
+{
+	struct sg_page_iter iter;
 
+	vunmap(vmapping);
 
-int sdrm_gem_get_pages(struct sdrm_gem_object *obj)
+	for_each_sg_page(pages->sgl, &iter, pages->nents, 0)
+		__free_page(sg_page_iter_page(&iter));
+
+	sg_free_table(pages);
+	kfree(pages);
+}
+
+/*
+ * Fill @pages with @num zeroed pages, taking them from the largest blocks
+ * the allocator hands out without reclaim and falling back to smaller
+ * orders down to single pages. Blocks are split, so every page is freed
+ * on its own later, but a 1080p buffer now costs a handful of allocator
+ * calls instead of two thousand.
+ */
+static int sdrm_gem_alloc_pages(struct page **pages, size_t num)
+{
+	unsigned int order = SDRM_GEM_MAX_ORDER;
+	struct page *page;
+	size_t i = 0, j;
+	gfp_t gfp;
+
+	while (i < num) {
+		while (order && (1UL << order) > num - i)
+			order--;
+
+		gfp = GFP_KERNEL | __GFP_ZERO;
+		if (order)
+			gfp |= __GFP_NOWARN | __GFP_NORETRY;
+
+		page = alloc_pages(gfp, order);
+		if (!page) {
+			if (!order)
+				goto error;
+			/* no point retrying this order for the rest */
+			order--;
+			continue;
+		}
+
+		split_page(page, order);
+		for (j = 0; j < (1UL << order); j++)
+			pages[i++] = page + j;
+	}
+
+	return 0;
+
+error:
+	while (i > 0)
+		__free_page(pages[--i]);
+	return -ENOMEM;
+}
+
+/*
+ * Write-protect tracking, modelled on fb_deferred_io: page_mkclean() finds
+ * the user mappings of a page through page->mapping and page->index, which
+ * are set to the DRM address space and the fake mmap offset of the page.
+ */
+static void sdrm_gem_wp_attach(struct sdrm_gem_object *obj)
+{
+	struct address_space *mapping = obj->base.dev->anon_inode->i_mapping;
+	pgoff_t index = drm_vma_node_start(&obj->base.vma_node);
+	struct sg_page_iter iter;
+	struct page *page;
+
+	for_each_sg_page(obj->pages->sgl, &iter, obj->pages->nents, 0) {
+		page = sg_page_iter_page(&iter);
+		page->mapping = mapping;
+		page->index = index++;
+	}
+}
+
+/* the page allocator and the pool expect pages without a mapping */
+static void sdrm_gem_wp_detach(struct sdrm_gem_object *obj)
+{
+	struct sg_page_iter iter;
+
+	for_each_sg_page(obj->pages->sgl, &iter, obj->pages->nents, 0)
+		sg_page_iter_page(&iter)->mapping = NULL;
+}
+
+static int sdrm_gem_get_pages_locked(struct sdrm_gem_object *obj)
 {
+	struct page **pages;
+	struct sg_table *sgt;
 	size_t num, i;
+	int r;
 
 	if (obj->vmapping)
 		return 0;
@@ -31,54 +147,187 @@ int sdrm_gem_get_pages(struct sdrm_gem_object *obj)
 		return !obj->vmapping ? -ENOMEM : 0;
 	}
 
+	if (sdrm_pool_get(obj->base.dev->dev_private, obj))
+		goto out;
+
+	/* the page array only lives until the pages are vmapped */
 	num = obj->base.size >> PAGE_SHIFT;
-	obj->pages = drm_malloc_ab(num, sizeof(*obj->pages));
-	if (!obj->pages)
+	pages = drm_malloc_ab(num, sizeof(*pages));
+	if (!pages)
 		return -ENOMEM;
 
-	for (i = 0; i < num; ++i) {
-		obj->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (!obj->pages[i])
-			goto error;
+	r = sdrm_gem_alloc_pages(pages, num);
+	if (r)
+		goto err_free_array;
+
+	r = -ENOMEM;
+	sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+	if (!sgt)
+		goto err_free_pages;
+
+	/* coalesces the split blocks back into one entry each */
+	r = sg_alloc_table_from_pages(sgt, pages, num, 0, obj->base.size,
+				      GFP_KERNEL);
+	if (r)
+		goto err_free_sgt;
+
+	obj->vmapping = vmap(pages, num, 0, PAGE_KERNEL);
+	if (!obj->vmapping) {
+		r = -ENOMEM;
+		sg_free_table(sgt);
+		goto err_free_sgt;
 	}
 
-	obj->vmapping = vmap(obj->pages, num, 0, PAGE_KERNEL);
-	if (!obj->vmapping)
-		goto error;
+	obj->pages = sgt;
+	drm_free_large(pages);
+
+out:
+	if (obj->wp_dirty)
+		sdrm_gem_wp_attach(obj);
 
 	return 0;
 
-error:
-	while (i > 0)
-		__free_pages(obj->pages[--i], 0);
+err_free_sgt:
+	kfree(sgt);
+err_free_pages:
+	for (i = 0; i < num; ++i)
+		__free_page(pages[i]);
+err_free_array:
+	drm_free_large(pages);
+	return r;
+}
 
-	drm_free_large(obj->pages);
-	obj->pages = NULL;
-	return -ENOMEM;
+/* serialized, as mmap faults may race with the flush worker and each other */
+int sdrm_gem_get_pages(struct sdrm_gem_object *obj)
+{
+	ktime_t start = ktime_get();
+	bool mapped;
+	int r;
+
+	mutex_lock(&obj->pages_lock);
+	mapped = obj->vmapping;
+	r = sdrm_gem_get_pages_locked(obj);
+	mutex_unlock(&obj->pages_lock);
+
+	/* only calls that had to map the pages, most find them mapped */
+	if (!mapped)
+		trace_sdrm_gem_get_pages(obj, r, start);
+
+	return r;
 }
 
-static void sdrm_gem_put_pages(struct sdrm_gem_object *obj)
+/* returns whether the store was released */
+static bool sdrm_gem_put_pages_locked(struct sdrm_gem_object *obj)
 {
-	size_t num, i;
+	/* device memory stays mapped for the lifetime of the object */
+	if (!obj->vmapping || sdrm_gem_is_vram(obj))
+		return false;
 
-	if (!obj->vmapping)
-		return;
+	/* framebuffers on the object may still be uploaded from */
+	if (obj->pins)
+		return false;
 
 	if (obj->base.import_attach) {
 		dma_buf_vunmap(obj->base.import_attach->dmabuf, obj->vmapping);
 		obj->vmapping = NULL;
-		return;
+		return true;
 	}
 
-	vunmap(obj->vmapping);
-	obj->vmapping = NULL;
+	if (obj->wp_dirty)
+		sdrm_gem_wp_detach(obj);
 
-	num = obj->base.size >> PAGE_SHIFT;
-	for (i = 0; i < num; ++i)
-		__free_pages(obj->pages[i], 0);
+	if (!sdrm_pool_put(obj->base.dev->dev_private, obj))
+		sdrm_gem_free_store(obj->pages, obj->vmapping);
 
-	drm_free_large(obj->pages);
+	obj->vmapping = NULL;
 	obj->pages = NULL;
+	return true;
+}
+
+static void sdrm_gem_put_pages(struct sdrm_gem_object *obj)
+{
+	ktime_t start = ktime_get();
+	bool unmapped;
+
+	mutex_lock(&obj->pages_lock);
+	unmapped = sdrm_gem_put_pages_locked(obj);
+	mutex_unlock(&obj->pages_lock);
+
+	if (unmapped)
+		trace_sdrm_gem_put_pages(obj, 0, start);
+}
+
+/**
+ * sdrm_gem_pin - keep the backing store of @obj while it is uploaded from
+ * @obj: object a framebuffer is created on
+ *
+ * The flush worker reads the store through the kernel mapping long after
+ * the commit or DIRTYFB that queued the upload, so closing the last
+ * user-space mapping must not release it meanwhile.
+ */
+void sdrm_gem_pin(struct sdrm_gem_object *obj)
+{
+	mutex_lock(&obj->pages_lock);
+	obj->pins++;
+	mutex_unlock(&obj->pages_lock);
+}
+
+/* the store goes back once neither pins nor mappings are left */
+void sdrm_gem_unpin(struct sdrm_gem_object *obj)
+{
+	ktime_t start = ktime_get();
+	bool unmapped = false;
+
+	mutex_lock(&obj->pages_lock);
+	if (!--obj->pins && !obj->mappings)
+		unmapped = sdrm_gem_put_pages_locked(obj);
+	mutex_unlock(&obj->pages_lock);
+
+	if (unmapped)
+		trace_sdrm_gem_put_pages(obj, 0, start);
+}
+
+/**
+ * sdrm_gem_wp_clean - write-protect pages whose writes were picked up
+ * @obj: object with write-protect tracking
+ * @first: first page
+ * @last: page after the last one
+ *
+ * Clears the dirty bits of the pages and write-protects their user
+ * mappings, so the next write to any of them faults and marks it again.
+ * Writes that happened before are visible to a blit started afterwards.
+ */
+void sdrm_gem_wp_clean(struct sdrm_gem_object *obj, pgoff_t first,
+		       pgoff_t last)
+{
+	struct sg_page_iter iter;
+	struct page *page;
+	pgoff_t idx = first;
+
+	mutex_lock(&obj->pages_lock);
+
+	/* store released along with the last mapping, nothing to protect */
+	if (!obj->pages) {
+		bitmap_clear(obj->wp_dirty, first, last - first);
+		goto unlock;
+	}
+
+	for_each_sg_page(obj->pages->sgl, &iter, obj->pages->nents, first) {
+		if (idx == last)
+			break;
+
+		/* serializes against sdrm_gem_page_mkwrite() */
+		page = sg_page_iter_page(&iter);
+		lock_page(page);
+		clear_bit(idx, obj->wp_dirty);
+		page_mkclean(page);
+		unlock_page(page);
+
+		idx++;
+	}
+
+unlock:
+	mutex_unlock(&obj->pages_lock);
 }
 
 struct sdrm_gem_object *sdrm_gem_alloc_object(struct drm_device *ddev,
@@ -93,6 +342,7 @@ struct sdrm_gem_object *sdrm_gem_alloc_object(struct drm_device *ddev,
 		return NULL;
 
 	drm_gem_private_object_init(ddev, &obj->base, size);
+	mutex_init(&obj->pages_lock);
 	return obj;
 }
 
@@ -101,16 +351,21 @@ void sdrm_gem_free_object(struct drm_gem_object *gobj)
 	struct sdrm_gem_object *obj = to_sdrm_bo(gobj);
 	struct drm_device *ddev = gobj->dev;
 
-	if (obj->pages) {
+	if (obj->pages || sdrm_gem_is_vram(obj)) {
 		/* kill all user-space mappings */
 		drm_vma_node_unmap(&gobj->vma_node,
 				   ddev->anon_inode->i_mapping);
 	}
 	sdrm_gem_put_pages(obj);
 
+	if (sdrm_gem_is_vram(obj))
+		sdrm_vram_free(ddev->dev_private, obj);
+
 	if (gobj->import_attach)
 		drm_prime_gem_destroy(gobj, obj->sg);
 
+	kfree(obj->wp_dirty);
+
 	drm_gem_free_mmap_offset(gobj);
 	drm_gem_object_release(gobj);
 	kfree(obj);
@@ -133,6 +388,9 @@ int sdrm_dumb_create(struct drm_file *dfile, struct drm_device *ddev,
 	if (!obj)
 		return -ENOMEM;
 
+	/* system pages are allocated on first use if this fails */
+	sdrm_vram_alloc(ddev->dev_private, obj, args->pitch);
+
 	r = drm_gem_handle_create(dfile, &obj->base, &args->handle);
 	if (r) {
 		drm_gem_object_unreference_unlocked(&obj->base);
@@ -177,20 +435,218 @@ out_unlock:
 	return r;
 }
 
+/* copies of a mapping made by fork() or a split share its store */
+static void sdrm_gem_vm_open(struct vm_area_struct *vma)
+{
+	struct sdrm_gem_object *obj = vma->vm_private_data;
+
+	mutex_lock(&obj->pages_lock);
+	obj->mappings++;
+	mutex_unlock(&obj->pages_lock);
+}
+
+/* the store goes back with the last user-space mapping, unless pinned */
 static void sdma_vm_close(struct vm_area_struct *vma)
 {
-	struct sdrm_gem_object *obj;
+	struct sdrm_gem_object *obj = vma->vm_private_data;
+	ktime_t start = ktime_get();
+	bool unmapped = false;
 
-	obj = vma->vm_private_data;
-	sdrm_gem_put_pages(obj);
+	mutex_lock(&obj->pages_lock);
+	if (!--obj->mappings)
+		unmapped = sdrm_gem_put_pages_locked(obj);
+	mutex_unlock(&obj->pages_lock);
+
+	if (unmapped)
+		trace_sdrm_gem_put_pages(obj, 0, start);
 
 	vma->vm_private_data = NULL;
 }
 
+/*
+ * Map @count pages starting at page @idx of @obj into @vma, allocating the
+ * store if needed. Only the first one is required; the others are
+ * fault-around and stop at the first page that cannot be inserted. The
+ * pages lock is held across the walk, so a racing release of the store
+ * waits until the pages are in the page table.
+ */
+static int sdrm_gem_insert_pages(struct vm_area_struct *vma,
+				 struct sdrm_gem_object *obj,
+				 pgoff_t idx, unsigned int count)
+{
+	unsigned long addr = vma->vm_start + (idx << PAGE_SHIFT);
+	unsigned long first = addr;
+	struct sg_page_iter iter;
+	ktime_t start = ktime_get();
+	bool mapped;
+	int r;
+
+	mutex_lock(&obj->pages_lock);
+	mapped = obj->vmapping;
+	r = sdrm_gem_get_pages_locked(obj);
+	if (!mapped)
+		trace_sdrm_gem_get_pages(obj, r, start);
+	if (r)
+		goto out_unlock;
+
+	for_each_sg_page(obj->pages->sgl, &iter, obj->pages->nents, idx) {
+		if (!count-- || addr >= vma->vm_end)
+			break;
+
+		r = vm_insert_page(vma, addr, sg_page_iter_page(&iter));
+		/* -EBUSY: already mapped by a racing fault */
+		if (r && r != -EBUSY) {
+			if (addr != first)
+				r = 0;
+			goto out_unlock;
+		}
+
+		addr += PAGE_SIZE;
+	}
+	r = 0;
+
+out_unlock:
+	mutex_unlock(&obj->pages_lock);
+	return r;
+}
+
+/*
+ * The backing store is allocated on the first fault rather than at mmap()
+ * time, and pages are mapped as they are touched. Faults that continue
+ * where the previous one left off also map the next fault_around pages.
+ */
+static int sdrm_gem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct sdrm_gem_object *obj = vma->vm_private_data;
+	unsigned long addr = (unsigned long)vmf->virtual_address;
+	unsigned int count = 1;
+	pgoff_t idx;
+	int r;
+
+	idx = (addr - vma->vm_start) >> PAGE_SHIFT;
+
+	if (idx == READ_ONCE(obj->last_fault) + 1)
+		count += READ_ONCE(sdrm_fault_around);
+	WRITE_ONCE(obj->last_fault, idx);
+
+	r = sdrm_gem_insert_pages(vma, obj, idx, count);
+
+	switch (r) {
+	case 0:
+	case -EAGAIN:
+	case -ERESTARTSYS:
+	case -EINTR:
+	case -EBUSY:
+		return VM_FAULT_NOPAGE;
+	case -ENOMEM:
+		return VM_FAULT_OOM;
+	default:
+		return VM_FAULT_SIGBUS;
+	}
+}
+
+/*
+ * Pages of tracked mappings are mapped read-only, so the first write to
+ * each of them after a flush ends up here.
+ */
+static int sdrm_gem_page_mkwrite(struct vm_area_struct *vma,
+				 struct vm_fault *vmf)
+{
+	struct sdrm_gem_object *obj = vma->vm_private_data;
+	unsigned long addr = (unsigned long)vmf->virtual_address;
+	pgoff_t idx = (addr - vma->vm_start) >> PAGE_SHIFT;
+
+	lock_page(vmf->page);
+	if (!test_and_set_bit(idx, obj->wp_dirty))
+		sdrm_flush_schedule(obj->base.dev->dev_private);
+
+	/* unlocked by the core once the PTE is writable */
+	return VM_FAULT_LOCKED;
+}
+
 static const struct vm_operations_struct sdrm_gem_vm_ops = {
+	.fault = sdrm_gem_fault,
+	.open = sdrm_gem_vm_open,
+	.close = sdma_vm_close,
+};
+
+static const struct vm_operations_struct sdrm_gem_wp_vm_ops = {
+	.fault = sdrm_gem_fault,
+	.page_mkwrite = sdrm_gem_page_mkwrite,
+	.open = sdrm_gem_vm_open,
 	.close = sdma_vm_close,
 };
 
+/* caller holds the pages lock */
+static int sdrm_gem_wp_init(struct sdrm_gem_object *obj)
+{
+	if (obj->wp_dirty)
+		return 0;
+
+	obj->wp_dirty = kcalloc(BITS_TO_LONGS(obj->base.size >> PAGE_SHIFT),
+				sizeof(unsigned long), GFP_KERNEL);
+	if (!obj->wp_dirty)
+		return -ENOMEM;
+
+	if (obj->pages)
+		sdrm_gem_wp_attach(obj);
+
+	return 0;
+}
+
+/* map @obj into @vma, once sdrm_drm_mmap() found it and checked access */
+static int sdrm_gem_mmap_obj(struct sdrm_gem_object *obj,
+			     struct vm_area_struct *vma)
+{
+	int r;
+
+	if (sdrm_gem_is_vram(obj)) {
+		vma->vm_ops = &sdrm_gem_vm_ops;
+		vma->vm_private_data = obj;
+		r = sdrm_vram_mmap(obj->base.dev->dev_private, obj, vma);
+		goto out;
+	}
+
+	/* prevent dmabuf-imported mmap to user-space */
+	if (obj->base.import_attach)
+		return -EACCES;
+
+	/* pages are inserted from the fault handler */
+	vma->vm_flags |= VM_MIXEDMAP | VM_DONTEXPAND;
+	vma->vm_page_prot = pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
+
+	vma->vm_ops = &sdrm_gem_vm_ops;
+	vma->vm_private_data = obj;
+
+	if (sdrm_wp_damage && (vma->vm_flags & VM_SHARED)) {
+		mutex_lock(&obj->pages_lock);
+		r = sdrm_gem_wp_init(obj);
+		mutex_unlock(&obj->pages_lock);
+		if (r)
+			return r;
+
+		/* writes fault until page_mkwrite made the PTE writable */
+		vma->vm_page_prot = pgprot_writecombine(
+			vm_get_page_prot(vma->vm_flags & ~VM_SHARED));
+		vma->vm_ops = &sdrm_gem_wp_vm_ops;
+	}
+
+	/* MAP_POPULATE does the same for single mappings */
+	r = 0;
+	if (sdrm_mmap_prefault)
+		r = sdrm_gem_insert_pages(vma, obj, 0, vma_pages(vma));
+
+out:
+	/* dropped in sdma_vm_close(), which failed mmaps never see */
+	if (!r) {
+		mutex_lock(&obj->pages_lock);
+		obj->mappings++;
+		mutex_unlock(&obj->pages_lock);
+	}
+
+	return r;
+}
+
 int sdrm_drm_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct drm_file *priv = filp->private_data;
@@ -198,7 +654,8 @@ int sdrm_drm_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct drm_vma_offset_node *node;
 	struct drm_gem_object *gobj;
 	struct sdrm_gem_object *obj;
-	size_t size, i, num;
+	ktime_t start = ktime_get();
+	size_t size;
 	int r;
 
 	if (drm_device_is_unplugged(dev))
@@ -217,38 +674,16 @@ int sdrm_drm_mmap(struct file *filp, struct vm_area_struct *vma)
 	obj = to_sdrm_bo(gobj);
 	size = drm_vma_node_size(node) << PAGE_SHIFT;
 	if (size < vma->vm_end - vma->vm_start)
-		return r;
-
-	r = sdrm_gem_get_pages(obj);
-	if (r < 0)
-		return r;
-
-	/* prevent dmabuf-imported mmap to user-space */
-	if (!obj->pages)
-		return -EACCES;
-
-	vma->vm_flags |= VM_DONTEXPAND;
-	vma->vm_page_prot = pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
-
-	vma->vm_ops = &sdrm_gem_vm_ops;
-	vma->vm_private_data = obj;
+		return -EINVAL;
 
-	num = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
-	for (i = 0; i < num; ++i) {
-		r = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE,
-				   obj->pages[i]);
-		if (r < 0) {
-			if (i > 0)
-				zap_vma_ptes(vma, vma->vm_start, i * PAGE_SIZE);
-			return r;
-		}
-	}
+	r = sdrm_gem_mmap_obj(obj, vma);
+	trace_sdrm_mmap(obj, r, start);
 
-	return 0;
+	return r;
 }
 
-struct drm_gem_object *sdrm_gem_prime_import(struct drm_device *ddev,
-					     struct dma_buf *dma_buf)
+static struct drm_gem_object *sdrm_gem_import(struct drm_device *ddev,
+					      struct dma_buf *dma_buf)
 {
 	struct dma_buf_attachment *attach;
 	struct sdrm_gem_object *obj;
@@ -290,3 +725,15 @@ fail_detach:
 	dma_buf_put(dma_buf);
 	return ERR_PTR(ret);
 }
+
+struct drm_gem_object *sdrm_gem_prime_import(struct drm_device *ddev,
+					     struct dma_buf *dma_buf)
+{
+	struct drm_gem_object *gobj;
+	ktime_t start = ktime_get();
+
+	gobj = sdrm_gem_import(ddev, dma_buf);
+	trace_sdrm_prime_import(dma_buf, gobj, start);
+
+	return gobj;
+}
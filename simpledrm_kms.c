@@ -17,6 +17,8 @@
 #include <linux/slab.h>
 
 #include "simpledrm.h"
+#include "simpledrm_blit.h"
+#include "simpledrm_trace.h"
 
 static const uint32_t sdrm_formats[] = {
 	DRM_FORMAT_RGB888,
@@ -24,6 +26,12 @@ static const uint32_t sdrm_formats[] = {
 	DRM_FORMAT_ARGB8888,
 	DRM_FORMAT_ABGR8888,
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_XRGB1555,
+	DRM_FORMAT_XRGB2101010,
+	DRM_FORMAT_YUYV,
+	DRM_FORMAT_UYVY,
+	DRM_FORMAT_NV12,
 };
 
 void sdrm_lastclose(struct drm_device *ddev)
@@ -84,43 +92,234 @@ static const struct drm_connector_funcs sdrm_conn_ops = {
 	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
 };
 
-static void sdrm_crtc_send_vblank_event(struct drm_crtc *crtc)
+/*
+ * Flip events complete at the next emulated vblank. Async flips, and
+ * enable/disable where vblanks are not running, complete right away.
+ * Returns whether the event was armed for the next vblank.
+ */
+static bool sdrm_crtc_send_vblank_event(struct drm_crtc *crtc, bool now)
+{
+	struct drm_pending_vblank_event *event;
+	bool armed;
+
+	if (!crtc->state || !crtc->state->event)
+		return false;
+
+	event = crtc->state->event;
+	crtc->state->event = NULL;
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	armed = !now && drm_crtc_vblank_get(crtc) == 0;
+	if (armed)
+		drm_crtc_arm_vblank_event(crtc, event);
+	else
+		drm_crtc_send_vblank_event(crtc, event);
+	spin_unlock_irq(&crtc->dev->event_lock);
+
+	return armed;
+}
+
+/* whether the primary plane's source and CRTC rects differ in size */
+static bool netv_plane_scaled(const struct drm_plane_state *state)
+{
+	return state->src_w >> 16 != state->crtc_w ||
+	       state->src_h >> 16 != state->crtc_h;
+}
+
+/* whether the primary plane is turned or mirrored onto the CRTC */
+static bool netv_plane_rotated(const struct drm_plane_state *state)
+{
+	return state->rotation != DRM_ROTATE_0;
+}
+
+/* show the primary plane's framebuffer, by moving the base or uploading */
+static void netv_display_pipe_scanout(struct sdrm_device *netv, bool async)
 {
-	if (crtc->state && crtc->state->event) {
-		spin_lock_irq(&crtc->dev->event_lock);
-		drm_crtc_send_vblank_event(crtc, crtc->state->event);
-		spin_unlock_irq(&crtc->dev->event_lock);
-		crtc->state->event = NULL;
+	struct drm_framebuffer *fb = netv->plane.state->fb;
+	struct sdrm_plane_state *state = to_sdrm_plane_state(netv->plane.state);
+	struct drm_plane_state *pstate = netv->plane.state;
+	struct sdrm_blit_scale scale;
+	struct sdrm_blit_rotate rotate;
+	struct sdrm_framebuffer *sfb;
+	bool recolor, rescale, rerotate;
+	u32 pan;
+
+	if (!fb) {
+		sdrm_vblank_setbase(netv, 0, async);
+		sdrm_damage_set_scanout(netv, NULL, NULL, NULL);
+		return;
+	}
+
+	/*
+	 * buffers in device memory are shown in place, no upload needed;
+	 * the cursor is only ever blended into uploads, though
+	 */
+	if (!netv->cursor_fb && !netv_plane_scaled(pstate) &&
+	    !netv_plane_rotated(pstate) && netv_hw_can_flip(netv, fb)) {
+		sdrm_damage_set_scanout(netv, NULL, NULL, NULL);
+		sdrm_vblank_setbase(netv, to_sdrm_fb(fb)->obj->vram.start,
+				    async);
+		return;
 	}
+
+	sfb = to_sdrm_fb(fb);
+	recolor = netv->color_encoding != state->color_encoding ||
+		  netv->color_range != state->color_range;
+	WRITE_ONCE(netv->color_encoding, state->color_encoding);
+	WRITE_ONCE(netv->color_range, state->color_range);
+
+	/* scaled planes are resampled into frame 0 */
+	if (netv_plane_scaled(pstate)) {
+		scale.src_x = pstate->src_x >> 16;
+		scale.src_y = pstate->src_y >> 16;
+		scale.src_w = pstate->src_w >> 16;
+		scale.src_h = pstate->src_h >> 16;
+		scale.dst_w = pstate->crtc_w;
+		scale.dst_h = pstate->crtc_h;
+
+		rescale = !netv->scaled ||
+			  netv->scale.src_x != scale.src_x ||
+			  netv->scale.src_y != scale.src_y ||
+			  netv->scale.src_w != scale.src_w ||
+			  netv->scale.src_h != scale.src_h ||
+			  netv->scale.dst_w != scale.dst_w ||
+			  netv->scale.dst_h != scale.dst_h;
+
+		sdrm_vblank_setbase(netv, 0, async);
+		if (READ_ONCE(netv->scanout) != sfb || recolor || rescale)
+			sdrm_damage_set_scanout(netv, sfb, &scale, NULL);
+		return;
+	}
+
+	/* as are turned ones */
+	if (netv_plane_rotated(pstate)) {
+		rotate.src_x = pstate->src_x >> 16;
+		rotate.src_y = pstate->src_y >> 16;
+		rotate.src_w = pstate->src_w >> 16;
+		rotate.src_h = pstate->src_h >> 16;
+		rotate.rotation = pstate->rotation;
+
+		rerotate = !netv->rotated ||
+			   netv->rotate.src_x != rotate.src_x ||
+			   netv->rotate.src_y != rotate.src_y ||
+			   netv->rotate.src_w != rotate.src_w ||
+			   netv->rotate.src_h != rotate.src_h ||
+			   netv->rotate.rotation != rotate.rotation;
+
+		sdrm_vblank_setbase(netv, 0, async);
+		if (READ_ONCE(netv->scanout) != sfb || recolor || rerotate)
+			sdrm_damage_set_scanout(netv, sfb, NULL, &rotate);
+		return;
+	}
+
+	/* only fbdev pans, its rows sit at the same offsets in BAR0 */
+	pan = (pstate->src_y >> 16) * netv->fb_stride;
+	sdrm_vblank_setbase(netv, pan, async);
+
+	/* panning within the scanout needs no upload */
+	if (READ_ONCE(netv->scanout) != sfb || recolor || netv->scaled ||
+	    netv->rotated)
+		sdrm_damage_set_scanout(netv, sfb, NULL, NULL);
+}
+
+/* hand the cursor plane's state to the flush worker */
+static void netv_display_pipe_set_cursor(struct sdrm_device *netv)
+{
+	struct drm_plane_state *state = netv->cursor.state;
+	struct drm_framebuffer *fb = state->crtc ? state->fb : NULL;
+	struct sdrm_blit_cursor cursor = { NULL };
+	struct sdrm_framebuffer *sfb = NULL;
+
+	if (fb && !sdrm_gem_get_pages(to_sdrm_fb(fb)->obj)) {
+		sfb = to_sdrm_fb(fb);
+		cursor.stride = fb->pitches[0];
+		cursor.map = (u8 *)sfb->obj->vmapping + fb->offsets[0] +
+			     (state->src_y >> 16) * cursor.stride +
+			     (state->src_x >> 16) * 4;
+		cursor.x = state->crtc_x;
+		/*
+		 * in rows of the scanout buffer, which fbdev pans over;
+		 * scaled and turned planes take it in mode coordinates
+		 */
+		cursor.y = state->crtc_y;
+		if (!netv_plane_scaled(netv->plane.state) &&
+		    !netv_plane_rotated(netv->plane.state))
+			cursor.y += netv->plane.state->src_y >> 16;
+		cursor.width = state->crtc_w;
+		cursor.height = state->crtc_h;
+	}
+
+	sdrm_damage_set_cursor(netv, sfb, &cursor);
 }
 
 void netv_display_pipe_update(struct sdrm_device *netv,
 			      struct drm_plane_state *plane_state)
 {
 	struct drm_framebuffer *fb = netv->plane.state->fb;
+	bool async = xchg(&netv->flip_async, false);
+	ktime_t start = ktime_get();
+	bool armed;
 
-	sdrm_crtc_send_vblank_event(&netv->crtc);
 	sdrm_fbdev_display_pipe_update(netv, fb);
 
-	if (fb && fb->funcs->dirty) {
+	if (fb)
 		netv->plane.fb = fb;
-		sdrm_dirty_all_locked(netv);
-	}
+
+	netv_display_pipe_scanout(netv, async);
+
+	/* the cursor follows panning, scaling and turning of the plane below */
+	if (netv->cursor_fb)
+		netv_display_pipe_set_cursor(netv);
+
+	/* the vblank that signals the event must latch the base staged above */
+	armed = sdrm_crtc_send_vblank_event(&netv->crtc, async);
+
+	trace_sdrm_commit(netv, &netv->plane, async, armed, start);
+}
+
+static void netv_display_pipe_cursor_update(struct sdrm_device *netv,
+					    struct drm_plane_state *plane_state)
+{
+	bool shown = netv->cursor_fb;
+	ktime_t start = ktime_get();
+	bool armed;
+
+	netv_display_pipe_set_cursor(netv);
+
+	/* showing or hiding the cursor switches between flips and uploads */
+	if (shown != !!netv->cursor_fb)
+		netv_display_pipe_scanout(netv, false);
+
+	/* commits that only touch the cursor complete here */
+	armed = sdrm_crtc_send_vblank_event(&netv->crtc, false);
+
+	trace_sdrm_commit(netv, &netv->cursor, false, armed, start);
 }
 
 static void netv_display_pipe_enable(struct sdrm_device *netv,
 				     struct drm_crtc_state *crtc_state)
 {
-	sdrm_crtc_send_vblank_event(&netv->crtc);
+	/* paces the damage flush worker */
+	netv->vrefresh = drm_mode_vrefresh(&crtc_state->adjusted_mode);
+	netv_hw_setmode(netv, &crtc_state->adjusted_mode);
+
+	sdrm_vblank_set_mode(netv, &crtc_state->adjusted_mode);
+	drm_crtc_vblank_on(&netv->crtc);
+
+	sdrm_crtc_send_vblank_event(&netv->crtc, true);
 }
 
 static void netv_display_pipe_disable(struct sdrm_device *netv)
 {
-	sdrm_crtc_send_vblank_event(&netv->crtc);
+	sdrm_damage_set_scanout(netv, NULL, NULL, NULL);
+
+	drm_crtc_vblank_off(&netv->crtc);
+	sdrm_crtc_send_vblank_event(&netv->crtc, true);
 }
 
 static const struct netv_display_pipe_funcs sdrm_pipe_funcs = {
 	.update = netv_display_pipe_update,
+	.cursor_update = netv_display_pipe_cursor_update,
 	.enable = netv_display_pipe_enable,
 	.disable = netv_display_pipe_disable,
 };
@@ -139,7 +338,12 @@ static void sdrm_fb_destroy(struct drm_framebuffer *fb)
 	struct sdrm_framebuffer *sfb = to_sdrm_fb(fb);
 
 	drm_framebuffer_cleanup(fb);
+	sdrm_gem_unpin(sfb->obj);
 	drm_gem_object_unreference_unlocked(&sfb->obj->base);
+	if (sfb->uv) {
+		sdrm_gem_unpin(sfb->uv);
+		drm_gem_object_unreference_unlocked(&sfb->uv->base);
+	}
 	kfree(sfb);
 }
 
@@ -149,80 +353,152 @@ static const struct drm_framebuffer_funcs sdrm_fb_ops = {
 	.destroy = sdrm_fb_destroy,
 };
 
-static struct drm_framebuffer *sdrm_fb_create(struct drm_device *ddev,
-					      struct drm_file *dfile,
-					      const struct drm_mode_fb_cmd2 *cmd)
+static bool sdrm_fb_plane_fits(const struct drm_mode_fb_cmd2 *cmd,
+			       unsigned int plane, struct sdrm_gem_object *obj)
 {
+	u32 cpp = drm_format_plane_cpp(cmd->pixel_format, plane);
+	u32 width = cmd->width, height = cmd->height, size;
+
+	if (plane) {
+		width /= drm_format_horz_chroma_subsampling(cmd->pixel_format);
+		height /= drm_format_vert_chroma_subsampling(cmd->pixel_format);
+	}
+
+	/*
+	 * width/height are already clamped into min/max_width/height range,
+	 * so overflows are not possible
+	 */
+
+	size = cmd->pitches[plane] * height;
+
+	return cpp &&
+	       cpp <= 4 &&
+	       cmd->pitches[plane] >= cpp * width &&
+	       cmd->pitches[plane] <= 0xffffU &&
+	       size + cmd->offsets[plane] >= size &&
+	       size + cmd->offsets[plane] <= obj->base.size;
+}
+
+/**
+ * sdrm_fb_new - create a framebuffer on top of @obj
+ * @ddev: device
+ * @cmd: layout of the framebuffer
+ * @obj: buffer object
+ * @uv: buffer object of the chroma plane of semi-planar formats, else NULL
+ *
+ * On success the framebuffer takes over the caller's references to @obj
+ * and @uv.
+ */
+struct sdrm_framebuffer *sdrm_fb_new(struct drm_device *ddev,
+				     const struct drm_mode_fb_cmd2 *cmd,
+				     struct sdrm_gem_object *obj,
+				     struct sdrm_gem_object *uv)
+{
+	struct sdrm_device *sdrm = ddev->dev_private;
+	u32 format = cmd->pixel_format;
+	int planes = drm_format_num_planes(format);
 	struct sdrm_framebuffer *fb;
-	struct drm_gem_object *gobj;
-	u32 bpp, size;
-	int ret;
+	int i, ret;
 	void *err;
 
-	if (cmd->flags)
-		return ERR_PTR(-EINVAL);
-
-	gobj = drm_gem_object_lookup(dfile, cmd->handles[0]);
-	if (!gobj)
+	/* chroma is shared by whole pixel pairs and row pairs */
+	if (planes > 2 || (planes == 2) != !!uv ||
+	    cmd->width % drm_format_horz_chroma_subsampling(format) ||
+	    cmd->height % drm_format_vert_chroma_subsampling(format) ||
+	    !sdrm_blit_supported(format, sdrm->fb_format) ||
+	    !sdrm_fb_plane_fits(cmd, 0, obj) ||
+	    (uv && !sdrm_fb_plane_fits(cmd, 1, uv)))
 		return ERR_PTR(-EINVAL);
 
 	fb = kzalloc(sizeof(*fb), GFP_KERNEL);
-	if (!fb) {
-		err = ERR_PTR(-ENOMEM);
-		goto err_unref;
+	if (!fb)
+		return ERR_PTR(-ENOMEM);
+	fb->obj = obj;
+	fb->uv = uv;
+
+	for (i = 0; i < planes; i++) {
+		fb->base.pitches[i] = cmd->pitches[i];
+		fb->base.offsets[i] = cmd->offsets[i];
 	}
-	fb->obj = to_sdrm_bo(gobj);
-
-	fb->base.pitches[0] = cmd->pitches[0];
-	fb->base.offsets[0] = cmd->offsets[0];
 	fb->base.width = cmd->width;
 	fb->base.height = cmd->height;
-	fb->base.pixel_format = cmd->pixel_format;
-	drm_fb_get_bpp_depth(cmd->pixel_format, &fb->base.depth,
+	fb->base.pixel_format = format;
+	drm_fb_get_bpp_depth(format, &fb->base.depth,
 			     &fb->base.bits_per_pixel);
 
-	/*
-	 * width/height are already clamped into min/max_width/height range,
-	 * so overflows are not possible
-	 */
-
-	bpp = (fb->base.bits_per_pixel + 7) / 8;
-	size = cmd->pitches[0] * cmd->height;
-	if (!bpp ||
-	    bpp > 4 ||
-	    cmd->pitches[0] < bpp * fb->base.width ||
-	    cmd->pitches[0] > 0xffffU ||
-	    size + fb->base.offsets[0] < size ||
-	    size + fb->base.offsets[0] > fb->obj->base.size) {
-		err = ERR_PTR(-EINVAL);
-		goto err_free;
-	}
-
 	ret = drm_framebuffer_init(ddev, &fb->base, &sdrm_fb_ops);
 	if (ret < 0) {
 		err = ERR_PTR(ret);
 		goto err_free;
 	}
 
+	/* the flush worker uploads from the stores until the fb is gone */
+	sdrm_gem_pin(obj);
+	if (uv)
+		sdrm_gem_pin(uv);
+
 	DRM_DEBUG_KMS("[FB:%d] pixel_format: %s\n", fb->base.base.id,
 		      drm_get_format_name(fb->base.pixel_format));
 
-	return &fb->base;
+	return fb;
 
 err_free:
 	kfree(fb);
-err_unref:
-	drm_gem_object_unreference_unlocked(gobj);
 
 	return err;
 }
 
+static struct drm_framebuffer *sdrm_fb_create(struct drm_device *ddev,
+					      struct drm_file *dfile,
+					      const struct drm_mode_fb_cmd2 *cmd)
+{
+	struct sdrm_framebuffer *fb;
+	struct drm_gem_object *gobj, *uv = NULL;
+
+	if (cmd->flags)
+		return ERR_PTR(-EINVAL);
+
+	gobj = drm_gem_object_lookup(dfile, cmd->handles[0]);
+	if (!gobj)
+		return ERR_PTR(-EINVAL);
+
+	if (drm_format_num_planes(cmd->pixel_format) > 1) {
+		uv = drm_gem_object_lookup(dfile, cmd->handles[1]);
+		if (!uv) {
+			drm_gem_object_unreference_unlocked(gobj);
+			return ERR_PTR(-EINVAL);
+		}
+	}
+
+	fb = sdrm_fb_new(ddev, cmd, to_sdrm_bo(gobj),
+			 uv ? to_sdrm_bo(uv) : NULL);
+	if (IS_ERR(fb)) {
+		if (uv)
+			drm_gem_object_unreference_unlocked(uv);
+		drm_gem_object_unreference_unlocked(gobj);
+		return ERR_CAST(fb);
+	}
+
+	return &fb->base;
+}
+
 static const struct drm_mode_config_funcs sdrm_mode_config_ops = {
 	.fb_create = sdrm_fb_create,
 	.atomic_check = drm_atomic_helper_check,
 	.atomic_commit = drm_atomic_helper_commit,
 };
 
+/* the names of the properties the core grew later, for YUV planes */
+static const struct drm_prop_enum_list sdrm_color_encodings[] = {
+	{ SDRM_COLOR_YCBCR_BT601, "ITU-R BT.601 YCbCr" },
+	{ SDRM_COLOR_YCBCR_BT709, "ITU-R BT.709 YCbCr" },
+};
+
+static const struct drm_prop_enum_list sdrm_color_ranges[] = {
+	{ SDRM_COLOR_YCBCR_LIMITED_RANGE, "YCbCr limited range" },
+	{ SDRM_COLOR_YCBCR_FULL_RANGE, "YCbCr full range" },
+};
+
 int sdrm_drm_modeset_init(struct sdrm_device *sdrm)
 {
 	struct drm_connector *conn = &sdrm->connector;
@@ -230,12 +506,27 @@ int sdrm_drm_modeset_init(struct sdrm_device *sdrm)
 	int ret;
 
 	drm_mode_config_init(ddev);
-	ddev->mode_config.min_width = sdrm->fb_width;
+	/*
+	 * smaller framebuffers are for the cursor plane; the primary plane
+	 * has to cover the whole crtc, see netv_kms_plane_atomic_check().
+	 * Turning the plane by 90 degrees takes a buffer as wide as the
+	 * mode is tall.
+	 */
+	ddev->mode_config.min_width = 1;
 	ddev->mode_config.max_width = sdrm->fb_width;
-	ddev->mode_config.min_height = sdrm->fb_height;
+	ddev->mode_config.min_height = 1;
 	ddev->mode_config.max_height = sdrm->fb_height;
+	if (sdrm->rotate.scratch) {
+		ddev->mode_config.max_width = max(sdrm->fb_width,
+						  sdrm->fb_height);
+		ddev->mode_config.max_height = ddev->mode_config.max_width;
+	}
 	ddev->mode_config.preferred_depth = sdrm->fb_bpp;
+	ddev->mode_config.cursor_width = SDRM_CURSOR_SIZE;
+	ddev->mode_config.cursor_height = SDRM_CURSOR_SIZE;
 	ddev->mode_config.funcs = &sdrm_mode_config_ops;
+	/* see netv_kms_crtc_page_flip() */
+	ddev->mode_config.async_page_flip = !!sdrm->hw;
 
 	drm_connector_helper_add(conn, &sdrm_conn_hfuncs);
 	ret = drm_connector_init(ddev, conn, &sdrm_conn_ops,
@@ -257,6 +548,35 @@ int sdrm_drm_modeset_init(struct sdrm_device *sdrm)
 	if (ret)
 		goto err_cleanup;
 
+	sdrm->color_encoding_property =
+		drm_property_create_enum(ddev, 0, "COLOR_ENCODING",
+					 sdrm_color_encodings,
+					 ARRAY_SIZE(sdrm_color_encodings));
+	sdrm->color_range_property =
+		drm_property_create_enum(ddev, 0, "COLOR_RANGE",
+					 sdrm_color_ranges,
+					 ARRAY_SIZE(sdrm_color_ranges));
+	if (!sdrm->color_encoding_property || !sdrm->color_range_property) {
+		ret = -ENOMEM;
+		goto err_cleanup;
+	}
+
+	drm_object_attach_property(&sdrm->plane.base,
+				   sdrm->color_encoding_property,
+				   SDRM_COLOR_YCBCR_BT601);
+	drm_object_attach_property(&sdrm->plane.base,
+				   sdrm->color_range_property,
+				   SDRM_COLOR_YCBCR_LIMITED_RANGE);
+
+	/* uploads turn the plane, given scratch space for it */
+	if (sdrm->rotate.scratch) {
+		ret = drm_plane_create_rotation_property(&sdrm->plane,
+							 DRM_ROTATE_0,
+							 SDRM_PLANE_ROTATIONS);
+		if (ret)
+			goto err_cleanup;
+	}
+
 	drm_mode_config_reset(ddev);
 
 	return 0;
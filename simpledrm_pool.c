@@ -0,0 +1,307 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Recycling pool for dumb buffer backing store. Clients that create and
+ * destroy buffers every few frames would otherwise pay for page
+ * allocation, vmap, vunmap and freeing on every cycle. Released stores
+ * keep their pages and kernel mapping. A worker zeroes them off the hot
+ * path and files them by size class, and the next buffer of the same size
+ * takes one over. The pool is bounded by the "pool_mb" parameter and
+ * drained by a shrinker under memory pressure.
+ */
+
+#include <drm/drmP.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/sched.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "simpledrm.h"
+
+static unsigned int sdrm_pool_mb = 32;
+module_param_named(pool_mb, sdrm_pool_mb, uint, 0644);
+MODULE_PARM_DESC(pool_mb,
+		 "Released dumb buffer memory kept for reuse, 0 = off (default: 32)");
+
+/* zeroed between two chances to reschedule */
+#define SDRM_POOL_ZERO_CHUNK SZ_1M
+
+/*
+ * @head sits on the dirty list or on the clean list of its size class,
+ * and is empty while the zero worker holds the entry. @lru keeps all
+ * entries in release order, across classes.
+ */
+struct sdrm_pool_entry {
+	struct list_head head;
+	struct list_head lru;
+	struct sg_table *pages;
+	void *vmapping;
+	size_t size;
+};
+
+static unsigned int sdrm_pool_class(size_t size)
+{
+	return min_t(unsigned int, ilog2(size >> PAGE_SHIFT),
+		     SDRM_POOL_CLASSES - 1);
+}
+
+static void sdrm_pool_free_entry(struct sdrm_pool_entry *entry)
+{
+	sdrm_gem_free_store(entry->pages, entry->vmapping);
+	kfree(entry);
+}
+
+static void sdrm_pool_free_list(struct list_head *list)
+{
+	struct sdrm_pool_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, list, head)
+		sdrm_pool_free_entry(entry);
+}
+
+/* pages still referenced elsewhere, e.g. by another mapping, are not reused */
+static bool sdrm_pool_exclusive(struct sg_table *pages)
+{
+	struct sg_page_iter iter;
+
+	for_each_sg_page(pages->sgl, &iter, pages->nents, 0)
+		if (page_count(sg_page_iter_page(&iter)) != 1)
+			return false;
+
+	return true;
+}
+
+static void sdrm_pool_zero_work(struct work_struct *work)
+{
+	struct sdrm_device *sdrm = container_of(work, struct sdrm_device,
+						pool_zero_work);
+	struct sdrm_pool_entry *entry;
+	size_t off, len;
+
+	for (;;) {
+		spin_lock(&sdrm->pool_lock);
+		entry = list_first_entry_or_null(&sdrm->pool_dirty,
+						 struct sdrm_pool_entry, head);
+		if (entry)
+			list_del_init(&entry->head);
+		spin_unlock(&sdrm->pool_lock);
+
+		if (!entry)
+			return;
+
+		if (!sdrm_pool_exclusive(entry->pages)) {
+			spin_lock(&sdrm->pool_lock);
+			list_del(&entry->lru);
+			sdrm->pool_bytes -= entry->size;
+			spin_unlock(&sdrm->pool_lock);
+			sdrm_pool_free_entry(entry);
+			continue;
+		}
+
+		for (off = 0; off < entry->size; off += len) {
+			len = min_t(size_t, entry->size - off,
+				    SDRM_POOL_ZERO_CHUNK);
+			memset(entry->vmapping + off, 0, len);
+			cond_resched();
+		}
+
+		spin_lock(&sdrm->pool_lock);
+		list_add(&entry->head,
+			 &sdrm->pool_clean[sdrm_pool_class(entry->size)]);
+		spin_unlock(&sdrm->pool_lock);
+	}
+}
+
+/**
+ * sdrm_pool_get - take over a zeroed backing store from the pool
+ * @sdrm: device
+ * @obj: object without backing store
+ *
+ * Returns true if @obj got its pages and kernel mapping from the pool.
+ */
+bool sdrm_pool_get(struct sdrm_device *sdrm, struct sdrm_gem_object *obj)
+{
+	struct sdrm_pool_entry *entry, *found = NULL;
+	size_t size = obj->base.size;
+
+	if (!sdrm->pool_active)
+		return false;
+
+	spin_lock(&sdrm->pool_lock);
+	list_for_each_entry(entry, &sdrm->pool_clean[sdrm_pool_class(size)],
+			    head) {
+		if (entry->size == size) {
+			found = entry;
+			list_del(&found->head);
+			list_del(&found->lru);
+			sdrm->pool_bytes -= size;
+			break;
+		}
+	}
+	if (found)
+		sdrm->pool_hits++;
+	else
+		sdrm->pool_misses++;
+	spin_unlock(&sdrm->pool_lock);
+
+	if (!found)
+		return false;
+
+	obj->pages = found->pages;
+	obj->vmapping = found->vmapping;
+	kfree(found);
+
+	return true;
+}
+
+/**
+ * sdrm_pool_put - hand a released backing store to the pool
+ * @sdrm: device
+ * @obj: object whose store is being released
+ *
+ * Returns true if the pool took over the pages and kernel mapping of @obj;
+ * otherwise the caller frees them.
+ */
+bool sdrm_pool_put(struct sdrm_device *sdrm, struct sdrm_gem_object *obj)
+{
+	struct sdrm_pool_entry *entry;
+	size_t size = obj->base.size;
+	size_t limit = (size_t)READ_ONCE(sdrm_pool_mb) << 20;
+
+	if (!sdrm->pool_active || size > limit)
+		return false;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return false;
+
+	entry->pages = obj->pages;
+	entry->vmapping = obj->vmapping;
+	entry->size = size;
+
+	spin_lock(&sdrm->pool_lock);
+	if (sdrm->pool_bytes + size > limit) {
+		spin_unlock(&sdrm->pool_lock);
+		kfree(entry);
+		return false;
+	}
+	sdrm->pool_bytes += size;
+	list_add_tail(&entry->head, &sdrm->pool_dirty);
+	list_add_tail(&entry->lru, &sdrm->pool_lru);
+	spin_unlock(&sdrm->pool_lock);
+
+	schedule_work(&sdrm->pool_zero_work);
+
+	return true;
+}
+
+static unsigned long sdrm_pool_count(struct shrinker *shrinker,
+				     struct shrink_control *sc)
+{
+	struct sdrm_device *sdrm = container_of(shrinker, struct sdrm_device,
+						pool_shrinker);
+
+	return READ_ONCE(sdrm->pool_bytes) >> PAGE_SHIFT;
+}
+
+/* least recently released, skipping the one being zeroed */
+static struct sdrm_pool_entry *sdrm_pool_oldest(struct sdrm_device *sdrm)
+{
+	struct sdrm_pool_entry *entry;
+
+	list_for_each_entry(entry, &sdrm->pool_lru, lru)
+		if (!list_empty(&entry->head))
+			return entry;
+
+	return NULL;
+}
+
+static unsigned long sdrm_pool_scan(struct shrinker *shrinker,
+				    struct shrink_control *sc)
+{
+	struct sdrm_device *sdrm = container_of(shrinker, struct sdrm_device,
+						pool_shrinker);
+	struct sdrm_pool_entry *entry;
+	unsigned long freed = 0;
+	LIST_HEAD(list);
+
+	spin_lock(&sdrm->pool_lock);
+	while (freed < sc->nr_to_scan) {
+		entry = sdrm_pool_oldest(sdrm);
+		if (!entry)
+			break;
+
+		list_move(&entry->head, &list);
+		list_del(&entry->lru);
+		sdrm->pool_bytes -= entry->size;
+		freed += entry->size >> PAGE_SHIFT;
+	}
+	sdrm->pool_shrunk += freed;
+	spin_unlock(&sdrm->pool_lock);
+
+	sdrm_pool_free_list(&list);
+
+	return freed ?: SHRINK_STOP;
+}
+
+int sdrm_pool_init(struct sdrm_device *sdrm)
+{
+	unsigned int i;
+	int r;
+
+	spin_lock_init(&sdrm->pool_lock);
+	INIT_LIST_HEAD(&sdrm->pool_dirty);
+	for (i = 0; i < SDRM_POOL_CLASSES; i++)
+		INIT_LIST_HEAD(&sdrm->pool_clean[i]);
+	INIT_LIST_HEAD(&sdrm->pool_lru);
+	INIT_WORK(&sdrm->pool_zero_work, sdrm_pool_zero_work);
+
+	sdrm->pool_shrinker.count_objects = sdrm_pool_count;
+	sdrm->pool_shrinker.scan_objects = sdrm_pool_scan;
+	sdrm->pool_shrinker.seeks = DEFAULT_SEEKS;
+
+	r = register_shrinker(&sdrm->pool_shrinker);
+	if (r)
+		return r;
+
+	sdrm->pool_active = true;
+
+	return 0;
+}
+
+void sdrm_pool_fini(struct sdrm_device *sdrm)
+{
+	unsigned int i;
+	LIST_HEAD(list);
+
+	if (!sdrm->pool_active)
+		return;
+
+	/* late releases are freed right away from now on */
+	sdrm->pool_active = false;
+	unregister_shrinker(&sdrm->pool_shrinker);
+	cancel_work_sync(&sdrm->pool_zero_work);
+
+	spin_lock(&sdrm->pool_lock);
+	list_splice_init(&sdrm->pool_dirty, &list);
+	for (i = 0; i < SDRM_POOL_CLASSES; i++)
+		list_splice_init(&sdrm->pool_clean[i], &list);
+	INIT_LIST_HEAD(&sdrm->pool_lru);
+	sdrm->pool_bytes = 0;
+	spin_unlock(&sdrm->pool_lock);
+
+	sdrm_pool_free_list(&list);
+}
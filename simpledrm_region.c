@@ -0,0 +1,285 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Damage region algebra. Clip lists from userspace may overlap, touch or
+ * repeat, and blitting them as given pushes the same pixels across PCIe
+ * several times. sdrm_region_set() normalizes a clip list into y-x banded
+ * form (as in pixman/X11 regions), and sdrm_region_simplify() decides with
+ * a small cost model whether uploading the bounding box or the whole frame
+ * is cheaper than the exact region. Like the blit core, this unit has no
+ * kernel dependencies and also builds in tools/.
+ */
+
+#include "simpledrm_region.h"
+
+/*
+ * Upload cost, in units of one converted pixel. Every rect pays for its
+ * setup (converter selection, FPU section, lock chunking) and every row
+ * for a partial write-combine line at both ends. Measured roughly with
+ * tools/sdrm_blitbench on 1080p XRGB8888 -> ABGR8888.
+ */
+#define SDRM_COST_RECT 512
+#define SDRM_COST_ROW 16
+
+u64 sdrm_region_area(const struct drm_clip_rect *rects, unsigned int num)
+{
+	unsigned int i;
+	u64 area = 0;
+
+	for (i = 0; i < num; i++)
+		area += (u64)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+void sdrm_region_bbox(const struct drm_clip_rect *rects, unsigned int num,
+		      struct drm_clip_rect *bbox)
+{
+	unsigned int i;
+
+	if (!num) {
+		*bbox = (struct drm_clip_rect){ 0, 0, 0, 0 };
+		return;
+	}
+
+	*bbox = rects[0];
+	for (i = 1; i < num; i++) {
+		bbox->x1 = min(bbox->x1, rects[i].x1);
+		bbox->y1 = min(bbox->y1, rects[i].y1);
+		bbox->x2 = max(bbox->x2, rects[i].x2);
+		bbox->y2 = max(bbox->y2, rects[i].y2);
+	}
+}
+
+static u64 sdrm_region_cost(const struct drm_clip_rect *rects,
+			    unsigned int num)
+{
+	unsigned int i;
+	u64 cost = 0;
+
+	for (i = 0; i < num; i++)
+		cost += SDRM_COST_RECT +
+			(u64)(rects[i].y2 - rects[i].y1) *
+			(rects[i].x2 - rects[i].x1 + SDRM_COST_ROW);
+
+	return cost;
+}
+
+/* @num is at most 2 * SDRM_REGION_MAX_INPUT; returns the unique count */
+static unsigned int sdrm_region_sort_ys(u16 *ys, unsigned int num)
+{
+	unsigned int i, j, n;
+	u16 v;
+
+	for (i = 1; i < num; i++) {
+		v = ys[i];
+		for (j = i; j > 0 && ys[j - 1] > v; j--)
+			ys[j] = ys[j - 1];
+		ys[j] = v;
+	}
+
+	for (i = 0, n = 0; i < num; i++)
+		if (!n || ys[n - 1] != ys[i])
+			ys[n++] = ys[i];
+
+	return n;
+}
+
+/* collect the x-spans of all clips covering [y1, y2), sorted and merged */
+static unsigned int sdrm_region_band(struct sdrm_region *rgn,
+				     const struct drm_clip_rect *clips,
+				     unsigned int num_clips, u16 y1, u16 y2)
+{
+	struct drm_clip_rect *spans = rgn->spans;
+	unsigned int i, j, n = 0, m;
+
+	for (i = 0; i < num_clips; i++) {
+		if (clips[i].y1 > y1 || clips[i].y2 < y2)
+			continue;
+
+		for (j = n; j > 0 && spans[j - 1].x1 > clips[i].x1; j--)
+			spans[j] = spans[j - 1];
+		spans[j].x1 = clips[i].x1;
+		spans[j].x2 = clips[i].x2;
+		n++;
+	}
+
+	if (!n)
+		return 0;
+
+	/* merge overlapping and touching spans */
+	for (i = 1, m = 0; i < n; i++) {
+		if (spans[i].x1 <= spans[m].x2)
+			spans[m].x2 = max(spans[m].x2, spans[i].x2);
+		else
+			spans[++m] = spans[i];
+	}
+
+	return m + 1;
+}
+
+/**
+ * sdrm_region_set - normalize a clip list into a banded region
+ * @rgn: region to fill
+ * @clips: clip list, empty clips allowed
+ * @num_clips: entries in @clips, at most SDRM_REGION_MAX_INPUT
+ *
+ * Returns false if the result does not fit into SDRM_REGION_MAX_RECTS; the
+ * contents of @rgn are undefined then.
+ */
+bool sdrm_region_set(struct sdrm_region *rgn,
+		     const struct drm_clip_rect *clips, unsigned int num_clips)
+{
+	unsigned int i, j, k, num_ys = 0, num_spans;
+	unsigned int band = 0, band_len = 0;
+	struct drm_clip_rect *r;
+
+	rgn->num_rects = 0;
+	if (num_clips > SDRM_REGION_MAX_INPUT)
+		return false;
+
+	for (i = 0; i < num_clips; i++) {
+		if (clips[i].x2 <= clips[i].x1 || clips[i].y2 <= clips[i].y1)
+			continue;
+		rgn->ys[num_ys++] = clips[i].y1;
+		rgn->ys[num_ys++] = clips[i].y2;
+	}
+
+	num_ys = sdrm_region_sort_ys(rgn->ys, num_ys);
+
+	for (k = 0; k + 1 < num_ys; k++) {
+		num_spans = sdrm_region_band(rgn, clips, num_clips,
+					     rgn->ys[k], rgn->ys[k + 1]);
+		if (!num_spans) {
+			band_len = 0;
+			continue;
+		}
+
+		/* extend the previous band if it has the very same spans */
+		if (band_len == num_spans &&
+		    rgn->rects[band].y2 == rgn->ys[k]) {
+			for (j = 0; j < num_spans; j++)
+				if (rgn->rects[band + j].x1 != rgn->spans[j].x1 ||
+				    rgn->rects[band + j].x2 != rgn->spans[j].x2)
+					break;
+
+			if (j == num_spans) {
+				for (j = 0; j < num_spans; j++)
+					rgn->rects[band + j].y2 = rgn->ys[k + 1];
+				continue;
+			}
+		}
+
+		if (rgn->num_rects + num_spans > SDRM_REGION_MAX_RECTS)
+			return false;
+
+		band = rgn->num_rects;
+		band_len = num_spans;
+		for (j = 0; j < num_spans; j++) {
+			r = &rgn->rects[rgn->num_rects++];
+			r->x1 = rgn->spans[j].x1;
+			r->x2 = rgn->spans[j].x2;
+			r->y1 = rgn->ys[k];
+			r->y2 = rgn->ys[k + 1];
+		}
+	}
+
+	return true;
+}
+
+/**
+ * sdrm_region_simplify - apply the upload cost model to a region
+ * @rgn: normalized region, replaced by the cheapest equivalent cover
+ * @width,@height: frame size
+ *
+ * Returns which plan was picked.
+ */
+enum sdrm_region_plan sdrm_region_simplify(struct sdrm_region *rgn,
+					   u32 width, u32 height)
+{
+	struct drm_clip_rect bbox, full = { 0, 0, width, height };
+	u64 cost, cost_bbox, cost_full;
+
+	if (rgn->num_rects <= 1)
+		return SDRM_REGION_RECTS;
+
+	sdrm_region_bbox(rgn->rects, rgn->num_rects, &bbox);
+
+	cost = sdrm_region_cost(rgn->rects, rgn->num_rects);
+	cost_bbox = sdrm_region_cost(&bbox, 1);
+	cost_full = sdrm_region_cost(&full, 1);
+
+	if (cost_full <= cost && cost_full <= cost_bbox) {
+		rgn->rects[0] = full;
+		rgn->num_rects = 1;
+		return SDRM_REGION_FULL;
+	}
+
+	if (cost_bbox <= cost) {
+		rgn->rects[0] = bbox;
+		rgn->num_rects = 1;
+		return SDRM_REGION_BBOX;
+	}
+
+	return SDRM_REGION_RECTS;
+}
+
+/**
+ * sdrm_region_build - turn accumulated damage into the rects to upload
+ * @rgn: region to fill
+ * @clips: accumulated damage, at most SDRM_REGION_MAX_INPUT entries
+ * @num_clips: entries in @clips
+ * @width,@height: frame size; damage is clipped against it
+ * @stats: counters to update, may be NULL
+ */
+void sdrm_region_build(struct sdrm_region *rgn,
+		       const struct drm_clip_rect *clips, unsigned int num_clips,
+		       u32 width, u32 height, struct sdrm_region_stats *stats)
+{
+	struct drm_clip_rect *c;
+	enum sdrm_region_plan plan;
+	unsigned int i, n = 0;
+	u64 merged;
+
+	/* clip against the frame */
+	for (i = 0; i < num_clips && i < SDRM_REGION_MAX_INPUT; i++) {
+		c = &rgn->in[n];
+		c->x1 = min_t(u32, clips[i].x1, width);
+		c->y1 = min_t(u32, clips[i].y1, height);
+		c->x2 = min_t(u32, clips[i].x2, width);
+		c->y2 = min_t(u32, clips[i].y2, height);
+		if (c->x2 > c->x1 && c->y2 > c->y1)
+			n++;
+	}
+
+	if (stats) {
+		stats->flushes++;
+		stats->clips += n;
+		stats->damaged += sdrm_region_area(rgn->in, n);
+	}
+
+	if (!sdrm_region_set(rgn, rgn->in, n)) {
+		/* too fragmented to represent, fall back to the bounding box */
+		sdrm_region_bbox(rgn->in, n, &rgn->rects[0]);
+		rgn->num_rects = 1;
+	}
+
+	merged = sdrm_region_area(rgn->rects, rgn->num_rects);
+	plan = sdrm_region_simplify(rgn, width, height);
+
+	if (stats) {
+		stats->merged += merged;
+		stats->uploaded += sdrm_region_area(rgn->rects, rgn->num_rects);
+		stats->rects += rgn->num_rects;
+		stats->bbox += plan == SDRM_REGION_BBOX;
+		stats->full += plan == SDRM_REGION_FULL;
+	}
+}
@@ -0,0 +1,82 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SDRM_REGION_H
+#define SDRM_REGION_H
+
+#ifdef __KERNEL__
+#include <drm/drm.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#else
+#include "tools/sdrm_user.h"
+#endif
+
+/* clips accepted by sdrm_region_set() */
+#define SDRM_REGION_MAX_INPUT 64
+/* rects a normalized region may consist of before it is collapsed */
+#define SDRM_REGION_MAX_RECTS 128
+
+enum sdrm_region_plan {
+	SDRM_REGION_RECTS,
+	SDRM_REGION_BBOX,
+	SDRM_REGION_FULL,
+};
+
+/*
+ * Damage region in y-x banded form: rects are sorted by y1, then x1; rects
+ * of one band share y1/y2, never overlap or touch horizontally, and no two
+ * vertically adjacent bands have identical spans.
+ * @num_rects: valid entries in @rects
+ * @rects: the region
+ * @in: clipped input of sdrm_region_build()
+ * @ys,@spans: scratch space for sdrm_region_set()
+ */
+struct sdrm_region {
+	unsigned int num_rects;
+	struct drm_clip_rect rects[SDRM_REGION_MAX_RECTS];
+
+	struct drm_clip_rect in[SDRM_REGION_MAX_INPUT];
+	u16 ys[2 * SDRM_REGION_MAX_INPUT];
+	struct drm_clip_rect spans[SDRM_REGION_MAX_INPUT];
+};
+
+/*
+ * Damage counters, all in pixels unless noted
+ * @flushes: regions built
+ * @clips: clips handed to sdrm_region_set()
+ * @rects: rects actually uploaded
+ * @damaged: sum of clip areas, overlaps counted repeatedly
+ * @merged: area after normalization
+ * @uploaded: area after the cost model picked a plan
+ * @bbox,@full: times the cost model collapsed to bounding box/full frame
+ */
+struct sdrm_region_stats {
+	u64 flushes;
+	u64 clips;
+	u64 rects;
+	u64 damaged;
+	u64 merged;
+	u64 uploaded;
+	u64 bbox;
+	u64 full;
+};
+
+u64 sdrm_region_area(const struct drm_clip_rect *rects, unsigned int num);
+void sdrm_region_bbox(const struct drm_clip_rect *rects, unsigned int num,
+		      struct drm_clip_rect *bbox);
+bool sdrm_region_set(struct sdrm_region *rgn,
+		     const struct drm_clip_rect *clips, unsigned int num_clips);
+enum sdrm_region_plan sdrm_region_simplify(struct sdrm_region *rgn,
+					   u32 width, u32 height);
+void sdrm_region_build(struct sdrm_region *rgn,
+		       const struct drm_clip_rect *clips, unsigned int num_clips,
+		       u32 width, u32 height, struct sdrm_region_stats *stats);
+
+#endif /* SDRM_REGION_H */
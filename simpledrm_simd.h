@@ -0,0 +1,119 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SDRM_SIMD_H
+#define SDRM_SIMD_H
+
+/*
+ * Vectorized row converters. Each one converts as many leading pixels of a
+ * row as it can handle in full vector steps and returns that count; the
+ * caller finishes the tail with the scalar converter. Callers must hold the
+ * FPU/NEON unit (kernel_fpu_begin()/kernel_neon_begin()) around the call.
+ *
+ * Only plain C types are used here, since the NEON unit is built
+ * freestanding without access to kernel headers.
+ */
+
+typedef unsigned int (*sdrm_simd_row_fn)(unsigned char *dst,
+					 const unsigned char *src,
+					 unsigned int width);
+
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_ssse3(unsigned char *dst,
+						  const unsigned char *src,
+						  unsigned int width);
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_avx2(unsigned char *dst,
+						 const unsigned char *src,
+						 unsigned int width);
+unsigned int sdrm_simd_rgb565_to_abgr8888_sse2(unsigned char *dst,
+					       const unsigned char *src,
+					       unsigned int width);
+unsigned int sdrm_simd_rgb565_to_abgr8888_avx2(unsigned char *dst,
+					       const unsigned char *src,
+					       unsigned int width);
+
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_neon(unsigned char *dst,
+						 const unsigned char *src,
+						 unsigned int width);
+unsigned int sdrm_simd_rgb565_to_abgr8888_neon(unsigned char *dst,
+					       const unsigned char *src,
+					       unsigned int width);
+
+/*
+ * YCbCr to RGB in 16-bit lanes, as computed by sdrm_yuv_to_rgb() in
+ * simpledrm_blit.c. Every coefficient is replicated across a full vector
+ * so that it can be used as an aligned memory operand.
+ */
+struct sdrm_yuv_coeffs {
+	unsigned short y_mul[8];
+	short y_sub[8];
+	short v_r[8];
+	short u_g[8];
+	short v_g[8];
+	short u_b[8];
+} __attribute__((aligned(16)));
+
+/*
+ * YUV row converters; @uv is the chroma row of semi-planar formats and
+ * unused for packed ones. They are called for whole rows starting on an
+ * even pixel and return an even count.
+ */
+typedef unsigned int (*sdrm_simd_yuv_fn)(unsigned char *dst,
+					 const unsigned char *src,
+					 const unsigned char *uv,
+					 unsigned int width,
+					 const struct sdrm_yuv_coeffs *k);
+
+unsigned int sdrm_simd_yuyv_to_abgr8888_sse2(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+unsigned int sdrm_simd_uyvy_to_abgr8888_sse2(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+unsigned int sdrm_simd_nv12_to_abgr8888_sse2(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+
+unsigned int sdrm_simd_yuyv_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+unsigned int sdrm_simd_uyvy_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+unsigned int sdrm_simd_nv12_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k);
+
+/*
+ * Non-temporal copy of @lines whole 64-byte lines from @src to the 64-byte
+ * aligned @dst, for write-combined destinations. These only use general
+ * purpose registers and need no FPU/NEON section; the caller issues the
+ * store fence once it is done with the destination.
+ */
+typedef void (*sdrm_simd_stream_fn)(unsigned char *dst,
+				    const unsigned char *src,
+				    unsigned long lines);
+
+void sdrm_simd_stream_movnti(unsigned char *dst, const unsigned char *src,
+			     unsigned long lines);
+void sdrm_simd_stream_stnp(unsigned char *dst, const unsigned char *src,
+			   unsigned long lines);
+
+#endif /* SDRM_SIMD_H */
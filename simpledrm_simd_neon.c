@@ -0,0 +1,227 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * NEON row converters. This unit is built freestanding with NEON enabled
+ * (see Makefile), so it must not include any kernel header. Callers hold
+ * kernel_neon_begin()/kernel_neon_end() around every converter call; the
+ * stream copy at the end needs no NEON section.
+ */
+
+#include <arm_neon.h>
+
+#include "simpledrm_simd.h"
+
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_neon(unsigned char *dst,
+						 const unsigned char *src,
+						 unsigned int width)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16x4_t px;
+	uint8x16_t t;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		px = vld4q_u8(src + i * 4);
+		t = px.val[0];
+		px.val[0] = px.val[2];
+		px.val[2] = t;
+		px.val[3] = zero;
+		vst4q_u8(dst + i * 4, px);
+	}
+
+	return i;
+}
+
+unsigned int sdrm_simd_rgb565_to_abgr8888_neon(unsigned char *dst,
+					       const unsigned char *src,
+					       unsigned int width)
+{
+	const uint16x8_t mask_r = vdupq_n_u16(0xf800);
+	const uint8x8_t mask_g = vdup_n_u8(0xfc);
+	uint8x8x4_t px;
+	uint16x8_t v;
+	unsigned int i;
+
+	px.val[3] = vdup_n_u8(0);
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		/* byte loads: the source row may be only byte-aligned */
+		v = vreinterpretq_u16_u8(vld1q_u8(src + i * 2));
+		px.val[0] = vshrn_n_u16(vandq_u16(v, mask_r), 8);
+		px.val[1] = vand_u8(vshrn_n_u16(v, 3), mask_g);
+		px.val[2] = vmovn_u16(vshlq_n_u16(v, 3));
+		vst4_u8(dst + i * 4, px);
+	}
+
+	return i;
+}
+
+/*
+ * YUV -> ABGR8888, 16 pixels per step: the even and the odd pixels of 8
+ * chroma pairs are converted separately and zipped together again. The
+ * arithmetic is that of sdrm_yuv_to_rgb(), lane by lane.
+ */
+struct sdrm_yuv_neon {
+	uint16x8_t y_mul;
+	int16x8_t y_sub, v_r, u_g, v_g, u_b, bias;
+};
+
+static inline void sdrm_yuv_neon_init(struct sdrm_yuv_neon *c,
+				      const struct sdrm_yuv_coeffs *k)
+{
+	c->y_mul = vld1q_u16(k->y_mul);
+	c->y_sub = vld1q_s16(k->y_sub);
+	c->v_r = vld1q_s16(k->v_r);
+	c->u_g = vld1q_s16(k->u_g);
+	c->v_g = vld1q_s16(k->v_g);
+	c->u_b = vld1q_s16(k->u_b);
+	c->bias = vdupq_n_s16(128);
+}
+
+static inline void sdrm_yuv_neon_rgb(const struct sdrm_yuv_neon *c,
+				     uint8x8_t y8, int16x8_t u, int16x8_t v,
+				     uint8x8_t *r, uint8x8_t *g, uint8x8_t *b)
+{
+	uint16x8_t w = vmovl_u8(y8);
+	uint32x4_t lo, hi;
+	int16x8_t y;
+
+	/* high half of Y * 257 * y_mul */
+	w = vorrq_u16(w, vshlq_n_u16(w, 8));
+	lo = vmull_u16(vget_low_u16(w), vget_low_u16(c->y_mul));
+	hi = vmull_u16(vget_high_u16(w), vget_high_u16(c->y_mul));
+	y = vreinterpretq_s16_u16(vcombine_u16(vshrn_n_u32(lo, 16),
+					       vshrn_n_u32(hi, 16)));
+	y = vsubq_s16(y, c->y_sub);
+
+	*r = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_s16(v, c->v_r)), 6));
+	*g = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y,
+				vqaddq_s16(vmulq_s16(u, c->u_g),
+					   vmulq_s16(v, c->v_g))), 6));
+	*b = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_s16(u, c->u_b)), 6));
+}
+
+static inline void sdrm_yuv_neon_store(const struct sdrm_yuv_neon *c,
+				       unsigned char *dst,
+				       uint8x8_t y_even, uint8x8_t y_odd,
+				       uint8x8_t u8, uint8x8_t v8)
+{
+	int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), c->bias);
+	int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), c->bias);
+	uint8x8_t re, ge, be, ro, go, bo;
+	uint8x8x2_t z;
+	uint8x16x4_t px;
+
+	sdrm_yuv_neon_rgb(c, y_even, u, v, &re, &ge, &be);
+	sdrm_yuv_neon_rgb(c, y_odd, u, v, &ro, &go, &bo);
+
+	z = vzip_u8(re, ro);
+	px.val[0] = vcombine_u8(z.val[0], z.val[1]);
+	z = vzip_u8(ge, go);
+	px.val[1] = vcombine_u8(z.val[0], z.val[1]);
+	z = vzip_u8(be, bo);
+	px.val[2] = vcombine_u8(z.val[0], z.val[1]);
+	px.val[3] = vdupq_n_u8(0);
+	vst4q_u8(dst, px);
+}
+
+unsigned int sdrm_simd_yuyv_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	struct sdrm_yuv_neon c;
+	uint8x8x4_t px;
+	unsigned int i;
+
+	sdrm_yuv_neon_init(&c, k);
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		px = vld4_u8(src + i * 2);
+		sdrm_yuv_neon_store(&c, dst + i * 4, px.val[0], px.val[2],
+				    px.val[1], px.val[3]);
+	}
+
+	return i;
+}
+
+unsigned int sdrm_simd_uyvy_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	struct sdrm_yuv_neon c;
+	uint8x8x4_t px;
+	unsigned int i;
+
+	sdrm_yuv_neon_init(&c, k);
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		px = vld4_u8(src + i * 2);
+		sdrm_yuv_neon_store(&c, dst + i * 4, px.val[1], px.val[3],
+				    px.val[0], px.val[2]);
+	}
+
+	return i;
+}
+
+unsigned int sdrm_simd_nv12_to_abgr8888_neon(unsigned char *dst,
+					     const unsigned char *src,
+					     const unsigned char *uv,
+					     unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	struct sdrm_yuv_neon c;
+	uint8x8x2_t y, cbcr;
+	unsigned int i;
+
+	sdrm_yuv_neon_init(&c, k);
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		y = vld2_u8(src + i);
+		cbcr = vld2_u8(uv + i);
+		sdrm_yuv_neon_store(&c, dst + i * 4, y.val[0], y.val[1],
+				    cbcr.val[0], cbcr.val[1]);
+	}
+
+	return i;
+}
+
+#ifdef __aarch64__
+void sdrm_simd_stream_stnp(unsigned char *dst, const unsigned char *src,
+			   unsigned long lines)
+{
+	unsigned long a, b, c, d;
+
+	if (!lines)
+		return;
+
+	asm volatile("1:\n\t"
+		     "ldp %[a], %[b], [%[src]]\n\t"
+		     "ldp %[c], %[d], [%[src], #16]\n\t"
+		     "stnp %[a], %[b], [%[dst]]\n\t"
+		     "stnp %[c], %[d], [%[dst], #16]\n\t"
+		     "ldp %[a], %[b], [%[src], #32]\n\t"
+		     "ldp %[c], %[d], [%[src], #48]\n\t"
+		     "stnp %[a], %[b], [%[dst], #32]\n\t"
+		     "stnp %[c], %[d], [%[dst], #48]\n\t"
+		     "add %[src], %[src], #64\n\t"
+		     "add %[dst], %[dst], #64\n\t"
+		     "subs %[n], %[n], #1\n\t"
+		     "b.ne 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (lines),
+		       [a] "=&r" (a), [b] "=&r" (b), [c] "=&r" (c),
+		       [d] "=&r" (d)
+		     :
+		     : "memory", "cc");
+}
+#endif
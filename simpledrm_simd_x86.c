@@ -0,0 +1,389 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifdef __KERNEL__
+#include <linux/compiler.h>
+#endif
+
+#include "simpledrm_blit.h"
+#include "simpledrm_simd.h"
+
+/*
+ * SSE/AVX row converters. The kernel is built with -mno-sse, so these are
+ * written as self-contained asm loops (like lib/raid6) and must only be
+ * called between kernel_fpu_begin() and kernel_fpu_end(). Every loop
+ * produces exactly what the scalar converters in simpledrm_blit.c
+ * produce, including the zeroed X/A byte.
+ *
+ * Vector registers can only be named as clobbers when the compiler itself
+ * may use them, i.e. in the userspace benchmark build.
+ *
+ * The movnti stream copy at the end is the exception: it only uses general
+ * purpose registers and runs outside FPU sections.
+ */
+#ifdef __SSE2__
+#define SDRM_SIMD_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3", \
+			     "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+#define SDRM_SIMD_CLOBBERS
+#endif
+
+/* XRGB8888 (B,G,R,X in memory) -> ABGR8888 (R,G,B,A in memory) */
+static const u8 sdrm_shuf_xrgb_abgr[16] __aligned(16) = {
+	 2,  1,  0, 0x80,  6,  5,  4, 0x80,
+	10,  9,  8, 0x80, 14, 13, 12, 0x80,
+};
+
+/* RGB565 -> ABGR8888 channel masks, applied after shifting into place */
+static const u32 sdrm_mask_565_r[4] __aligned(16) = {
+	0x000000f8, 0x000000f8, 0x000000f8, 0x000000f8,
+};
+static const u32 sdrm_mask_565_g[4] __aligned(16) = {
+	0x0000fc00, 0x0000fc00, 0x0000fc00, 0x0000fc00,
+};
+static const u32 sdrm_mask_565_b[4] __aligned(16) = {
+	0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000,
+};
+
+#ifdef CONFIG_AS_SSSE3
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_ssse3(u8 *dst, const u8 *src,
+						  unsigned int width)
+{
+	unsigned long blocks = width / 16;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("movdqa %[shuf], %%xmm7\n"
+		     "1:\n\t"
+		     "movdqu   (%[src]), %%xmm0\n\t"
+		     "movdqu 16(%[src]), %%xmm1\n\t"
+		     "movdqu 32(%[src]), %%xmm2\n\t"
+		     "movdqu 48(%[src]), %%xmm3\n\t"
+		     "pshufb %%xmm7, %%xmm0\n\t"
+		     "pshufb %%xmm7, %%xmm1\n\t"
+		     "pshufb %%xmm7, %%xmm2\n\t"
+		     "pshufb %%xmm7, %%xmm3\n\t"
+		     "movdqu %%xmm0,   (%[dst])\n\t"
+		     "movdqu %%xmm1, 16(%[dst])\n\t"
+		     "movdqu %%xmm2, 32(%[dst])\n\t"
+		     "movdqu %%xmm3, 48(%[dst])\n\t"
+		     "add $64, %[src]\n\t"
+		     "add $64, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [shuf] "m" (sdrm_shuf_xrgb_abgr)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~15U;
+}
+#endif
+
+#ifdef CONFIG_AS_AVX2
+unsigned int sdrm_simd_xrgb8888_to_abgr8888_avx2(u8 *dst, const u8 *src,
+						 unsigned int width)
+{
+	unsigned long blocks = width / 16;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("vbroadcasti128 %[shuf], %%ymm7\n"
+		     "1:\n\t"
+		     "vmovdqu   (%[src]), %%ymm0\n\t"
+		     "vmovdqu 32(%[src]), %%ymm1\n\t"
+		     "vpshufb %%ymm7, %%ymm0, %%ymm0\n\t"
+		     "vpshufb %%ymm7, %%ymm1, %%ymm1\n\t"
+		     "vmovdqu %%ymm0,   (%[dst])\n\t"
+		     "vmovdqu %%ymm1, 32(%[dst])\n\t"
+		     "add $64, %[src]\n\t"
+		     "add $64, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n\t"
+		     "vzeroupper\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [shuf] "m" (sdrm_shuf_xrgb_abgr)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~15U;
+}
+#endif
+
+/*
+ * out = ((v >> 8) & 0xf8) | ((v << 5) & 0xfc00) | ((v << 19) & 0xf80000)
+ * on zero-extended RGB565 pixels held in @x. Uses xmm2 and xmm6 as scratch.
+ */
+#define SDRM_565_SSE2(x)					\
+	"movdqa %%" x ", %%xmm2\n\t"				\
+	"psrld $8, %%xmm2\n\t"					\
+	"pand %%xmm3, %%xmm2\n\t"				\
+	"movdqa %%" x ", %%xmm6\n\t"				\
+	"pslld $5, %%xmm6\n\t"					\
+	"pand %%xmm4, %%xmm6\n\t"				\
+	"por %%xmm6, %%xmm2\n\t"				\
+	"pslld $19, %%" x "\n\t"				\
+	"pand %%xmm5, %%" x "\n\t"				\
+	"por %%xmm2, %%" x "\n\t"
+
+unsigned int sdrm_simd_rgb565_to_abgr8888_sse2(u8 *dst, const u8 *src,
+					       unsigned int width)
+{
+	unsigned long blocks = width / 8;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("movdqa %[mr], %%xmm3\n\t"
+		     "movdqa %[mg], %%xmm4\n\t"
+		     "movdqa %[mb], %%xmm5\n\t"
+		     "pxor %%xmm7, %%xmm7\n"
+		     "1:\n\t"
+		     "movdqu (%[src]), %%xmm0\n\t"
+		     "movdqa %%xmm0, %%xmm1\n\t"
+		     "punpcklwd %%xmm7, %%xmm0\n\t"
+		     "punpckhwd %%xmm7, %%xmm1\n\t"
+		     SDRM_565_SSE2("xmm0")
+		     SDRM_565_SSE2("xmm1")
+		     "movdqu %%xmm0,   (%[dst])\n\t"
+		     "movdqu %%xmm1, 16(%[dst])\n\t"
+		     "add $16, %[src]\n\t"
+		     "add $32, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [mr] "m" (sdrm_mask_565_r), [mg] "m" (sdrm_mask_565_g),
+		       [mb] "m" (sdrm_mask_565_b)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~7U;
+}
+
+#ifdef CONFIG_AS_AVX2
+#define SDRM_565_AVX2(x)					\
+	"vpsrld $8, %%" x ", %%ymm2\n\t"			\
+	"vpand %%ymm3, %%ymm2, %%ymm2\n\t"			\
+	"vpslld $5, %%" x ", %%ymm6\n\t"			\
+	"vpand %%ymm4, %%ymm6, %%ymm6\n\t"			\
+	"vpor %%ymm6, %%ymm2, %%ymm2\n\t"			\
+	"vpslld $19, %%" x ", %%" x "\n\t"			\
+	"vpand %%ymm5, %%" x ", %%" x "\n\t"			\
+	"vpor %%ymm2, %%" x ", %%" x "\n\t"
+
+unsigned int sdrm_simd_rgb565_to_abgr8888_avx2(u8 *dst, const u8 *src,
+					       unsigned int width)
+{
+	unsigned long blocks = width / 16;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("vpbroadcastd %[mr], %%ymm3\n\t"
+		     "vpbroadcastd %[mg], %%ymm4\n\t"
+		     "vpbroadcastd %[mb], %%ymm5\n"
+		     "1:\n\t"
+		     "vpmovzxwd   (%[src]), %%ymm0\n\t"
+		     "vpmovzxwd 16(%[src]), %%ymm1\n\t"
+		     SDRM_565_AVX2("ymm0")
+		     SDRM_565_AVX2("ymm1")
+		     "vmovdqu %%ymm0,   (%[dst])\n\t"
+		     "vmovdqu %%ymm1, 32(%[dst])\n\t"
+		     "add $32, %[src]\n\t"
+		     "add $64, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n\t"
+		     "vzeroupper\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [mr] "m" (sdrm_mask_565_r[0]),
+		       [mg] "m" (sdrm_mask_565_g[0]),
+		       [mb] "m" (sdrm_mask_565_b[0])
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~15U;
+}
+#endif
+
+/*
+ * YUV -> ABGR8888, 8 pixels per step; see sdrm_yuv_to_rgb() for the
+ * arithmetic, which these follow lane by lane. Each loop leaves the luma
+ * of 8 pixels, widened to Y * 257, in xmm0 and their (U, V) pairs in
+ * xmm1, one per word, and hands over to SDRM_YUV_CHROMA_SSE2 and
+ * SDRM_YUV_STORE_SSE2. xmm7 is kept zero.
+ */
+static const u16 sdrm_yuv_bias[8] __aligned(16) = {
+	128, 128, 128, 128, 128, 128, 128, 128,
+};
+static const u16 sdrm_yuv_lo_bytes[8] __aligned(16) = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* U0 V0 U1 V1 ... in xmm1 -> U0 U0 U1 U1 ... in xmm1, V0 V0 ... in xmm2 */
+#define SDRM_YUV_CHROMA_SSE2					\
+	"pshuflw $0xf5, %%xmm1, %%xmm2\n\t"			\
+	"pshufhw $0xf5, %%xmm2, %%xmm2\n\t"			\
+	"pshuflw $0xa0, %%xmm1, %%xmm1\n\t"			\
+	"pshufhw $0xa0, %%xmm1, %%xmm1\n\t"
+
+/* luma of 8 pixels as Y * 257 in xmm0, chroma as left by the above */
+#define SDRM_YUV_STORE_SSE2					\
+	"pmulhuw  (%[k]), %%xmm0\n\t"				\
+	"psubw  16(%[k]), %%xmm0\n\t"				\
+	"psubw %[bias], %%xmm1\n\t"				\
+	"psubw %[bias], %%xmm2\n\t"				\
+	"movdqa %%xmm2, %%xmm3\n\t"				\
+	"pmullw 32(%[k]), %%xmm3\n\t"				\
+	"paddsw %%xmm0, %%xmm3\n\t"				\
+	"movdqa %%xmm1, %%xmm4\n\t"				\
+	"pmullw 48(%[k]), %%xmm4\n\t"				\
+	"pmullw 64(%[k]), %%xmm2\n\t"				\
+	"paddsw %%xmm2, %%xmm4\n\t"				\
+	"paddsw %%xmm0, %%xmm4\n\t"				\
+	"pmullw 80(%[k]), %%xmm1\n\t"				\
+	"paddsw %%xmm0, %%xmm1\n\t"				\
+	"psraw $6, %%xmm3\n\t"					\
+	"psraw $6, %%xmm4\n\t"					\
+	"psraw $6, %%xmm1\n\t"					\
+	"packuswb %%xmm7, %%xmm3\n\t"				\
+	"packuswb %%xmm7, %%xmm4\n\t"				\
+	"packuswb %%xmm7, %%xmm1\n\t"				\
+	"punpcklbw %%xmm4, %%xmm3\n\t"				\
+	"punpcklbw %%xmm7, %%xmm1\n\t"				\
+	"movdqa %%xmm3, %%xmm0\n\t"				\
+	"punpcklwd %%xmm1, %%xmm3\n\t"				\
+	"punpckhwd %%xmm1, %%xmm0\n\t"				\
+	"movdqu %%xmm3,   (%[dst])\n\t"				\
+	"movdqu %%xmm0, 16(%[dst])\n\t"
+
+unsigned int sdrm_simd_yuyv_to_abgr8888_sse2(u8 *dst, const u8 *src,
+					     const u8 *uv, unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	unsigned long blocks = width / 8;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("pxor %%xmm7, %%xmm7\n"
+		     "1:\n\t"
+		     "movdqu (%[src]), %%xmm0\n\t"
+		     "movdqa %%xmm0, %%xmm1\n\t"
+		     "pand %[lo], %%xmm0\n\t"
+		     "psrlw $8, %%xmm1\n\t"
+		     "movdqa %%xmm0, %%xmm2\n\t"
+		     "psllw $8, %%xmm2\n\t"
+		     "por %%xmm2, %%xmm0\n\t"
+		     SDRM_YUV_CHROMA_SSE2
+		     SDRM_YUV_STORE_SSE2
+		     "add $16, %[src]\n\t"
+		     "add $32, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [k] "r" (k), [bias] "m" (sdrm_yuv_bias),
+		       [lo] "m" (sdrm_yuv_lo_bytes)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~7U;
+}
+
+unsigned int sdrm_simd_uyvy_to_abgr8888_sse2(u8 *dst, const u8 *src,
+					     const u8 *uv, unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	unsigned long blocks = width / 8;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("pxor %%xmm7, %%xmm7\n"
+		     "1:\n\t"
+		     "movdqu (%[src]), %%xmm0\n\t"
+		     "movdqa %%xmm0, %%xmm1\n\t"
+		     "psrlw $8, %%xmm0\n\t"
+		     "pand %[lo], %%xmm1\n\t"
+		     "movdqa %%xmm0, %%xmm2\n\t"
+		     "psllw $8, %%xmm2\n\t"
+		     "por %%xmm2, %%xmm0\n\t"
+		     SDRM_YUV_CHROMA_SSE2
+		     SDRM_YUV_STORE_SSE2
+		     "add $16, %[src]\n\t"
+		     "add $32, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (blocks)
+		     : [k] "r" (k), [bias] "m" (sdrm_yuv_bias),
+		       [lo] "m" (sdrm_yuv_lo_bytes)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~7U;
+}
+
+unsigned int sdrm_simd_nv12_to_abgr8888_sse2(u8 *dst, const u8 *src,
+					     const u8 *uv, unsigned int width,
+					     const struct sdrm_yuv_coeffs *k)
+{
+	unsigned long blocks = width / 8;
+
+	if (!blocks)
+		return 0;
+
+	asm volatile("pxor %%xmm7, %%xmm7\n"
+		     "1:\n\t"
+		     "movq (%[src]), %%xmm0\n\t"
+		     "movq (%[uv]), %%xmm1\n\t"
+		     "punpcklbw %%xmm0, %%xmm0\n\t"
+		     "punpcklbw %%xmm7, %%xmm1\n\t"
+		     SDRM_YUV_CHROMA_SSE2
+		     SDRM_YUV_STORE_SSE2
+		     "add $8, %[src]\n\t"
+		     "add $8, %[uv]\n\t"
+		     "add $32, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [uv] "+r" (uv),
+		       [n] "+r" (blocks)
+		     : [k] "r" (k), [bias] "m" (sdrm_yuv_bias)
+		     : "memory", "cc" SDRM_SIMD_CLOBBERS);
+
+	return width & ~7U;
+}
+
+#ifdef CONFIG_X86_64
+/* one 32-byte half of a line through four scratch registers */
+#define SDRM_MOVNTI_32(off)					\
+	"mov " #off "(%[src]), %[t0]\n\t"			\
+	"mov " #off "+8(%[src]), %[t1]\n\t"			\
+	"mov " #off "+16(%[src]), %[t2]\n\t"			\
+	"mov " #off "+24(%[src]), %[t3]\n\t"			\
+	"movnti %[t0], " #off "(%[dst])\n\t"			\
+	"movnti %[t1], " #off "+8(%[dst])\n\t"		\
+	"movnti %[t2], " #off "+16(%[dst])\n\t"		\
+	"movnti %[t3], " #off "+24(%[dst])\n\t"
+
+void sdrm_simd_stream_movnti(u8 *dst, const u8 *src, unsigned long lines)
+{
+	unsigned long t0, t1, t2, t3;
+
+	if (!lines)
+		return;
+
+	asm volatile("1:\n\t"
+		     SDRM_MOVNTI_32(0)
+		     SDRM_MOVNTI_32(32)
+		     "add $64, %[src]\n\t"
+		     "add $64, %[dst]\n\t"
+		     "dec %[n]\n\t"
+		     "jnz 1b\n"
+		     : [dst] "+r" (dst), [src] "+r" (src), [n] "+r" (lines),
+		       [t0] "=&r" (t0), [t1] "=&r" (t1), [t2] "=&r" (t2),
+		       [t3] "=&r" (t3)
+		     :
+		     : "memory", "cc");
+}
+#endif
@@ -0,0 +1,267 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Tracepoints along the way from damage to pixels in BAR0. Durations are
+ * in nanoseconds and measured by the driver, so latency histograms need
+ * nothing but the events themselves, e.g.
+ *
+ *   echo 'hist:keys=latency_ns.log2' > events/simpledrm/sdrm_flush/trigger
+ *
+ * DIRTYFB to upload is the latency plus the duration of the flush that
+ * picks the damage up.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM simpledrm
+
+#if !defined(SDRM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SDRM_TRACE_H
+
+#include <drm/drmP.h>
+#include <linux/dma-buf.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+#include "simpledrm.h"
+
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_CPU);
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_PARALLEL);
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_DMA);
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_PAN);
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_SCALED);
+TRACE_DEFINE_ENUM(SDRM_BLIT_PATH_ROTATED);
+
+#define sdrm_show_blit_path(path)					\
+	__print_symbolic(path,						\
+			 { SDRM_BLIT_PATH_CPU, "cpu" },			\
+			 { SDRM_BLIT_PATH_PARALLEL, "parallel" },	\
+			 { SDRM_BLIT_PATH_DMA, "dma" },			\
+			 { SDRM_BLIT_PATH_PAN, "pan" },			\
+			 { SDRM_BLIT_PATH_SCALED, "scaled" },		\
+			 { SDRM_BLIT_PATH_ROTATED, "rotated" })
+
+TRACE_EVENT(sdrm_dirty,
+	TP_PROTO(struct drm_framebuffer *fb, unsigned int num_clips,
+		 const struct drm_clip_rect *bbox, u64 delay_ns),
+	TP_ARGS(fb, num_clips, bbox, delay_ns),
+
+	TP_STRUCT__entry(
+		__field(u32, fb_id)
+		__field(unsigned int, num_clips)
+		__field(u16, x1)
+		__field(u16, y1)
+		__field(u16, x2)
+		__field(u16, y2)
+		__field(u64, delay_ns)
+	),
+
+	TP_fast_assign(
+		__entry->fb_id = fb->base.id;
+		__entry->num_clips = num_clips;
+		__entry->x1 = bbox->x1;
+		__entry->y1 = bbox->y1;
+		__entry->x2 = bbox->x2;
+		__entry->y2 = bbox->y2;
+		__entry->delay_ns = delay_ns;
+	),
+
+	TP_printk("fb=%u clips=%u bbox=%ux%u+%u+%u delay_ns=%llu",
+		  __entry->fb_id, __entry->num_clips,
+		  __entry->x2 - __entry->x1, __entry->y2 - __entry->y1,
+		  __entry->x1, __entry->y1, __entry->delay_ns)
+);
+
+TRACE_EVENT(sdrm_flush,
+	TP_PROTO(struct drm_framebuffer *fb, unsigned int num_rects,
+		 u64 pixels, ktime_t since, ktime_t start, bool aborted),
+	TP_ARGS(fb, num_rects, pixels, since, start, aborted),
+
+	TP_STRUCT__entry(
+		__field(u32, fb_id)
+		__field(unsigned int, num_rects)
+		__field(u64, pixels)
+		__field(u64, latency_ns)
+		__field(u64, duration_ns)
+		__field(bool, aborted)
+	),
+
+	TP_fast_assign(
+		__entry->fb_id = fb->base.id;
+		__entry->num_rects = num_rects;
+		__entry->pixels = pixels;
+		__entry->latency_ns = ktime_to_ns(ktime_sub(start, since));
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+		__entry->aborted = aborted;
+	),
+
+	TP_printk("fb=%u rects=%u pixels=%llu latency_ns=%llu duration_ns=%llu%s",
+		  __entry->fb_id, __entry->num_rects, __entry->pixels,
+		  __entry->latency_ns, __entry->duration_ns,
+		  __entry->aborted ? " aborted" : "")
+);
+
+TRACE_EVENT(sdrm_blit,
+	TP_PROTO(const struct sdrm_blit_buf *src,
+		 const struct sdrm_blit_buf *dst,
+		 u32 x, u32 y, u32 width, u32 height,
+		 enum sdrm_blit_path path, u64 bytes, u64 duration_ns),
+	TP_ARGS(src, dst, x, y, width, height, path, bytes, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(u32, src_format)
+		__field(u32, dst_format)
+		__field(u32, x)
+		__field(u32, y)
+		__field(u32, width)
+		__field(u32, height)
+		__field(u64, bytes)
+		__field(enum sdrm_blit_path, path)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->src_format = src->four_cc;
+		__entry->dst_format = dst->four_cc;
+		__entry->x = x;
+		__entry->y = y;
+		__entry->width = width;
+		__entry->height = height;
+		__entry->bytes = bytes;
+		__entry->path = path;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("%ux%u+%u+%u %c%c%c%c->%c%c%c%c bytes=%llu path=%s duration_ns=%llu",
+		  __entry->width, __entry->height, __entry->x, __entry->y,
+		  sdrm_fourcc_chars(__entry->src_format),
+		  sdrm_fourcc_chars(__entry->dst_format),
+		  __entry->bytes, sdrm_show_blit_path(__entry->path),
+		  __entry->duration_ns)
+);
+
+TRACE_EVENT(sdrm_commit,
+	TP_PROTO(struct sdrm_device *sdrm, struct drm_plane *plane,
+		 bool async, bool armed, ktime_t start),
+	TP_ARGS(sdrm, plane, async, armed, start),
+
+	TP_STRUCT__entry(
+		__field(u32, plane_id)
+		__field(u32, fb_id)
+		__field(bool, async)
+		__field(bool, armed)
+		__field(bool, upload)
+		__field(bool, scaled)
+		__field(bool, rotated)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->plane_id = plane->base.id;
+		__entry->fb_id = plane->state->fb ?
+				 plane->state->fb->base.id : 0;
+		__entry->async = async;
+		__entry->armed = armed;
+		__entry->upload = READ_ONCE(sdrm->scanout);
+		__entry->scaled = sdrm->scaled;
+		__entry->rotated = sdrm->rotated;
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+	),
+
+	TP_printk("plane=%u fb=%u%s%s%s%s%s duration_ns=%llu",
+		  __entry->plane_id, __entry->fb_id,
+		  __entry->async ? " async" : "",
+		  __entry->armed ? " on-vblank" : " completed",
+		  __entry->upload ? " upload" : "",
+		  __entry->scaled ? " scaled" : "",
+		  __entry->rotated ? " rotated" : "",
+		  __entry->duration_ns)
+);
+
+DECLARE_EVENT_CLASS(sdrm_gem_object,
+	TP_PROTO(struct sdrm_gem_object *obj, int ret, ktime_t start),
+	TP_ARGS(obj, ret, start),
+
+	TP_STRUCT__entry(
+		__field(struct sdrm_gem_object *, obj)
+		__field(size_t, size)
+		__field(bool, import)
+		__field(bool, vram)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->obj = obj;
+		__entry->size = obj->base.size;
+		__entry->import = obj->base.import_attach;
+		__entry->vram = sdrm_gem_is_vram(obj);
+		__entry->ret = ret;
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+	),
+
+	TP_printk("obj=%p size=%zu%s%s ret=%d duration_ns=%llu",
+		  __entry->obj, __entry->size,
+		  __entry->import ? " import" : "",
+		  __entry->vram ? " vram" : "",
+		  __entry->ret, __entry->duration_ns)
+);
+
+DEFINE_EVENT(sdrm_gem_object, sdrm_gem_get_pages,
+	TP_PROTO(struct sdrm_gem_object *obj, int ret, ktime_t start),
+	TP_ARGS(obj, ret, start)
+);
+
+DEFINE_EVENT(sdrm_gem_object, sdrm_gem_put_pages,
+	TP_PROTO(struct sdrm_gem_object *obj, int ret, ktime_t start),
+	TP_ARGS(obj, ret, start)
+);
+
+DEFINE_EVENT(sdrm_gem_object, sdrm_mmap,
+	TP_PROTO(struct sdrm_gem_object *obj, int ret, ktime_t start),
+	TP_ARGS(obj, ret, start)
+);
+
+TRACE_EVENT(sdrm_prime_import,
+	TP_PROTO(struct dma_buf *dma_buf, struct drm_gem_object *gobj,
+		 ktime_t start),
+	TP_ARGS(dma_buf, gobj, start),
+
+	TP_STRUCT__entry(
+		__field(struct dma_buf *, dma_buf)
+		__field(size_t, size)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->dma_buf = dma_buf;
+		__entry->size = dma_buf->size;
+		__entry->ret = PTR_ERR_OR_ZERO(gobj);
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+	),
+
+	TP_printk("dma_buf=%p size=%zu ret=%d duration_ns=%llu",
+		  __entry->dma_buf, __entry->size, __entry->ret,
+		  __entry->duration_ns)
+);
+
+#endif /* SDRM_TRACE_H */
+
+/* this part must be outside the protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE simpledrm_trace
+#include <trace/define_trace.h>
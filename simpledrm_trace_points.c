@@ -0,0 +1,13 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include "simpledrm.h"
+
+#define CREATE_TRACE_POINTS
+#include "simpledrm_trace.h"
@@ -0,0 +1,183 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Vblank emulation. The NeTV raises no interrupts, so an hrtimer running
+ * at the frame rate of the programmed mode stands in for the vblank IRQ.
+ * Timestamps are the timer's expiry times rather than the time the
+ * callback happened to run, and sequence numbers are derived from them by
+ * the DRM core. Sync base flips are applied from the timer as well, so
+ * they take effect at the same instant their flip event reports.
+ */
+
+#include <drm/drmP.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+#include "simpledrm.h"
+
+static enum hrtimer_restart sdrm_vblank_timer(struct hrtimer *timer)
+{
+	struct sdrm_device *sdrm = container_of(timer, struct sdrm_device,
+						vblank_timer);
+	bool put = false;
+
+	if (!READ_ONCE(sdrm->vblank_enabled))
+		return HRTIMER_NORESTART;
+
+	sdrm->vblank_time = hrtimer_get_expires(timer);
+
+	spin_lock(&sdrm->vblank_lock);
+	if (sdrm->base_pending) {
+		netv_hw_setbase(sdrm, sdrm->pending_base);
+		sdrm->base_pending = false;
+		put = true;
+	}
+	spin_unlock(&sdrm->vblank_lock);
+
+	drm_crtc_handle_vblank(&sdrm->crtc);
+
+	/* reference taken by sdrm_vblank_setbase() */
+	if (put)
+		drm_crtc_vblank_put(&sdrm->crtc);
+
+	hrtimer_forward_now(timer, ns_to_ktime(sdrm->vblank_period_ns));
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Called with the core's vblank locks held, possibly from the timer itself,
+ * so the timer is never waited for here; it stops on its own once it sees
+ * vblank_enabled cleared.
+ */
+int sdrm_enable_vblank(struct drm_device *ddev, unsigned int pipe)
+{
+	struct sdrm_device *sdrm = ddev->dev_private;
+
+	WRITE_ONCE(sdrm->vblank_enabled, true);
+	hrtimer_start(&sdrm->vblank_timer,
+		      ktime_add_ns(ktime_get(), sdrm->vblank_period_ns),
+		      HRTIMER_MODE_ABS);
+
+	return 0;
+}
+
+void sdrm_disable_vblank(struct drm_device *ddev, unsigned int pipe)
+{
+	struct sdrm_device *sdrm = ddev->dev_private;
+
+	WRITE_ONCE(sdrm->vblank_enabled, false);
+	hrtimer_try_to_cancel(&sdrm->vblank_timer);
+}
+
+int sdrm_get_vblank_timestamp(struct drm_device *ddev, unsigned int pipe,
+			      int *max_error, struct timeval *vblank_time,
+			      unsigned int flags)
+{
+	struct sdrm_device *sdrm = ddev->dev_private;
+
+	/* let the core fall back to the current time while stopped */
+	if (!READ_ONCE(sdrm->vblank_enabled))
+		return 0;
+
+	*max_error = 0;
+	*vblank_time = ktime_to_timeval(sdrm->vblank_time);
+
+	return 1;
+}
+
+/**
+ * sdrm_vblank_set_mode - pace the vblank timer to @mode
+ * @sdrm: device
+ * @mode: mode being enabled
+ */
+void sdrm_vblank_set_mode(struct sdrm_device *sdrm,
+			  const struct drm_display_mode *mode)
+{
+	u64 period;
+
+	if (mode->clock && mode->htotal && mode->vtotal)
+		period = div_u64((u64)mode->htotal * mode->vtotal * 1000000,
+				 mode->clock);
+	else
+		period = NSEC_PER_SEC / (drm_mode_vrefresh(mode) ?: 60);
+
+	sdrm->vblank_period_ns = period;
+}
+
+/**
+ * sdrm_vblank_setbase - move the scanout base at the next vblank
+ * @sdrm: device
+ * @offset: new base, see netv_hw_setbase()
+ * @async: move it right away instead
+ *
+ * Falls back to moving it right away if vblanks are off.
+ */
+void sdrm_vblank_setbase(struct sdrm_device *sdrm, u32 offset, bool async)
+{
+	unsigned long flags;
+	bool put = false;
+
+	if (async || drm_crtc_vblank_get(&sdrm->crtc)) {
+		spin_lock_irqsave(&sdrm->vblank_lock, flags);
+		put = sdrm->base_pending;
+		sdrm->base_pending = false;
+		netv_hw_setbase(sdrm, offset);
+		spin_unlock_irqrestore(&sdrm->vblank_lock, flags);
+
+		if (put)
+			drm_crtc_vblank_put(&sdrm->crtc);
+		return;
+	}
+
+	spin_lock_irqsave(&sdrm->vblank_lock, flags);
+	/* an unapplied flip is superseded, and so is its reference */
+	put = sdrm->base_pending;
+	sdrm->pending_base = offset;
+	sdrm->base_pending = true;
+	spin_unlock_irqrestore(&sdrm->vblank_lock, flags);
+
+	if (put)
+		drm_crtc_vblank_put(&sdrm->crtc);
+}
+
+int sdrm_vblank_init(struct sdrm_device *sdrm)
+{
+	struct drm_device *ddev = sdrm->ddev;
+	int r;
+
+	spin_lock_init(&sdrm->vblank_lock);
+	hrtimer_init(&sdrm->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sdrm->vblank_timer.function = sdrm_vblank_timer;
+	sdrm->vblank_period_ns = NSEC_PER_SEC / 60;
+
+	r = drm_vblank_init(ddev, 1);
+	if (r)
+		return r;
+
+	/* DRM_IOCTL_WAIT_VBLANK refuses to work without an "IRQ" */
+	ddev->irq_enabled = true;
+
+	return 0;
+}
+
+void sdrm_vblank_fini(struct sdrm_device *sdrm)
+{
+	/* not initialized yet */
+	if (!sdrm->vblank_timer.function)
+		return;
+
+	WRITE_ONCE(sdrm->vblank_enabled, false);
+	hrtimer_cancel(&sdrm->vblank_timer);
+
+	sdrm->ddev->irq_enabled = false;
+	drm_vblank_cleanup(sdrm->ddev);
+}
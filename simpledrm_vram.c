@@ -0,0 +1,179 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Dumb buffers in device memory. BAR0 is much larger than the one frame
+ * the scanout occupies; the rest is handed out to dumb buffers whose pitch
+ * and size match the scanout, so that clients render straight into the
+ * device and flips only move the scanout base (see netv_hw_can_flip()).
+ * Placement is best-effort: if the spare memory is exhausted or
+ * fragmented, sdrm_dumb_create() falls back to system pages.
+ *
+ * For testing without a board, the "vram_fake_mb" parameter backs the
+ * allocator with system RAM instead of the BAR.
+ */
+
+#include <drm/drmP.h>
+#include <drm/drm_mm.h>
+#include <linux/io.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+
+#include "simpledrm.h"
+
+static bool sdrm_vram_enable;
+module_param_named(vram, sdrm_vram_enable, bool, 0644);
+MODULE_PARM_DESC(vram,
+		 "Place scanout-sized dumb buffers in device memory even if they cannot be flipped to (default: false)");
+
+static unsigned int sdrm_vram_fake_mb;
+module_param_named(vram_fake_mb, sdrm_vram_fake_mb, uint, 0444);
+MODULE_PARM_DESC(vram_fake_mb,
+		 "Back the device memory allocator by this much system RAM, for testing (default: 0)");
+
+static unsigned int sdrm_ypan_frames = 2;
+module_param_named(ypan_frames, sdrm_ypan_frames, uint, 0444);
+MODULE_PARM_DESC(ypan_frames,
+		 "Frames of device memory fbdev can pan over, 0 = all of it (default: 2)");
+
+/*
+ * fbdev gets the first rows of BAR0, as many as ypan_frames frames, so it
+ * can pan by moving the scanout base. Only the remainder is spare.
+ */
+static void sdrm_vram_reserve_ypan(struct sdrm_device *sdrm)
+{
+	u64 rows = sdrm->fb_size / sdrm->fb_stride;
+
+	sdrm->fb_vheight = sdrm->fb_height;
+	if (!sdrm->hw || rows <= sdrm->fb_height)
+		return;
+
+	if (sdrm_ypan_frames)
+		rows = min_t(u64, rows, (u64)sdrm_ypan_frames * sdrm->fb_height);
+
+	sdrm->fb_vheight = rows;
+	DRM_INFO("fbdev can pan over %u lines\n", sdrm->fb_vheight);
+}
+
+int sdrm_vram_init(struct sdrm_device *sdrm)
+{
+	unsigned long start, size;
+
+	mutex_init(&sdrm->vram_lock);
+	sdrm_vram_reserve_ypan(sdrm);
+
+	if (sdrm_vram_fake_mb) {
+		size = (unsigned long)sdrm_vram_fake_mb << 20;
+		sdrm->vram_map = vmalloc_user(size);
+		if (!sdrm->vram_map)
+			return -ENOMEM;
+
+		sdrm->vram_fake = true;
+		drm_mm_init(&sdrm->vram_mm, 0, size);
+		DRM_INFO("%lu kB of fake device memory for dumb buffers\n",
+			 size / 1024);
+		return 0;
+	}
+
+	/* everything behind the fbdev panning area is spare */
+	start = PAGE_ALIGN((unsigned long)sdrm->fb_stride * sdrm->fb_vheight);
+	if (start >= sdrm->fb_size)
+		return 0;
+
+	size = (sdrm->fb_size - start) & PAGE_MASK;
+	sdrm->vram_map = sdrm->fb_map;
+	drm_mm_init(&sdrm->vram_mm, start, size);
+	DRM_INFO("%lu kB of device memory for dumb buffers\n", size / 1024);
+
+	return 0;
+}
+
+void sdrm_vram_fini(struct sdrm_device *sdrm)
+{
+	if (!drm_mm_initialized(&sdrm->vram_mm))
+		return;
+
+	drm_mm_takedown(&sdrm->vram_mm);
+	memset(&sdrm->vram_mm, 0, sizeof(sdrm->vram_mm));
+
+	if (sdrm->vram_fake)
+		vfree(sdrm->vram_map);
+	sdrm->vram_map = NULL;
+}
+
+/**
+ * sdrm_vram_alloc - try to place a dumb buffer in device memory
+ * @sdrm: device
+ * @obj: fresh object without backing store
+ * @pitch: pitch the buffer will be used with
+ *
+ * Only buffers that could be scanned out as they are qualify. On success
+ * the object's vmapping points into the BAR (or the fake RAM) and is
+ * cleared. Returns 0 or a negative error code if the caller has to fall
+ * back to system memory.
+ */
+int sdrm_vram_alloc(struct sdrm_device *sdrm, struct sdrm_gem_object *obj,
+		    u32 pitch)
+{
+	size_t size = obj->base.size;
+	int r;
+
+	/* without base flips they would be blitted from WC memory */
+	if ((!sdrm_vram_enable && !sdrm->hw) ||
+	    !drm_mm_initialized(&sdrm->vram_mm))
+		return -ENODEV;
+	if (pitch != sdrm->fb_stride ||
+	    size < (size_t)sdrm->fb_stride * sdrm->fb_height)
+		return -EINVAL;
+
+	mutex_lock(&sdrm->vram_lock);
+	r = drm_mm_insert_node(&sdrm->vram_mm, &obj->vram, size, PAGE_SIZE,
+			       DRM_MM_SEARCH_DEFAULT);
+	if (r)
+		sdrm->vram_fallbacks++;
+	mutex_unlock(&sdrm->vram_lock);
+	if (r)
+		return r;
+
+	obj->vmapping = sdrm->vram_map + obj->vram.start;
+	if (sdrm->vram_fake)
+		memset(obj->vmapping, 0, size);
+	else
+		memset_io((void __iomem *)obj->vmapping, 0, size);
+
+	return 0;
+}
+
+void sdrm_vram_free(struct sdrm_device *sdrm, struct sdrm_gem_object *obj)
+{
+	mutex_lock(&sdrm->vram_lock);
+	drm_mm_remove_node(&obj->vram);
+	mutex_unlock(&sdrm->vram_lock);
+
+	obj->vmapping = NULL;
+}
+
+int sdrm_vram_mmap(struct sdrm_device *sdrm, struct sdrm_gem_object *obj,
+		   struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (sdrm->vram_fake)
+		return remap_vmalloc_range_partial(vma, vma->vm_start,
+						   obj->vmapping, size);
+
+	vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_page_prot = pgprot_writecombine(vm_get_page_prot(vma->vm_flags));
+
+	return io_remap_pfn_range(vma, vma->vm_start,
+				  (sdrm->fb_base + obj->vram.start) >> PAGE_SHIFT,
+				  size, vma->vm_page_prot);
+}
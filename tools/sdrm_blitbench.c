@@ -0,0 +1,1653 @@
+/*
+ * SimpleDRM blit benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Runs the driver's blit core (simpledrm_blit.c) against plain RAM and
+ * reports throughput for every (source, scanout) format pair, so that
+ * regressions show up without a NeTV board. The destination is ordinary
+ * cached memory; absolute numbers are an upper bound for the real BAR.
+ * With -f, the destination is an fbdev mapping instead, which on the board
+ * is the write-combined BAR, and -j shows how much of a multi-threaded
+ * speedup survives contention on it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/fb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simpledrm_blit.h"
+#include "simpledrm_region.h"
+
+/*
+ * @chan: shift and width of red, green and blue within the little-endian
+ * pixel value, for the reference converter in bench_reference()
+ * @yuv: YUV source, checked by bench_yuv_reference() instead
+ * @uv: semi-planar, with an interleaved chroma plane at half resolution
+ */
+struct bench_format {
+	const char *name;
+	u32 four_cc;
+	u32 cpp;
+	u8 chan[3][2];
+	bool yuv;
+	bool uv;
+};
+
+static const struct bench_format bench_src_formats[] = {
+	{ "XRGB8888", DRM_FORMAT_XRGB8888, 4, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "ARGB8888", DRM_FORMAT_ARGB8888, 4, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "ABGR8888", DRM_FORMAT_ABGR8888, 4, { { 0, 8 }, { 8, 8 }, { 16, 8 } } },
+	{ "RGB888", DRM_FORMAT_RGB888, 3, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "BGR888", DRM_FORMAT_BGR888, 3, { { 0, 8 }, { 8, 8 }, { 16, 8 } } },
+	{ "RGB565", DRM_FORMAT_RGB565, 2, { { 11, 5 }, { 5, 6 }, { 0, 5 } } },
+	{ "XRGB1555", DRM_FORMAT_XRGB1555, 2, { { 10, 5 }, { 5, 5 }, { 0, 5 } } },
+	{ "XRGB2101010", DRM_FORMAT_XRGB2101010, 4,
+	  { { 20, 10 }, { 10, 10 }, { 0, 10 } } },
+	{ .name = "YUYV", .four_cc = DRM_FORMAT_YUYV, .cpp = 2, .yuv = true },
+	{ .name = "UYVY", .four_cc = DRM_FORMAT_UYVY, .cpp = 2, .yuv = true },
+	{ .name = "NV12", .four_cc = DRM_FORMAT_NV12, .cpp = 1, .yuv = true,
+	  .uv = true },
+};
+
+static const struct bench_format bench_dst_formats[] = {
+	{ "ABGR8888", DRM_FORMAT_ABGR8888, 4, { { 0, 8 }, { 8, 8 }, { 16, 8 } } },
+	{ "XRGB8888", DRM_FORMAT_XRGB8888, 4, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "ARGB8888", DRM_FORMAT_ARGB8888, 4, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "RGB888", DRM_FORMAT_RGB888, 3, { { 16, 8 }, { 8, 8 }, { 0, 8 } } },
+	{ "RGB565", DRM_FORMAT_RGB565, 2, { { 11, 5 }, { 5, 6 }, { 0, 5 } } },
+	{ "XRGB1555", DRM_FORMAT_XRGB1555, 2, { { 10, 5 }, { 5, 5 }, { 0, 5 } } },
+	{ "XRGB2101010", DRM_FORMAT_XRGB2101010, 4,
+	  { { 20, 10 }, { 10, 10 }, { 0, 10 } } },
+};
+
+struct bench_mode {
+	const char *name;
+	u32 width;
+	u32 height;
+};
+
+static const struct bench_mode bench_modes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+
+struct bench_rect {
+	u32 x, y, w, h;
+};
+
+#define BENCH_SMALL_RECTS 256
+#define BENCH_SMALL_SIZE 32
+
+enum bench_damage {
+	BENCH_FULL,
+	BENCH_RECTS,
+	BENCH_LINE,
+	BENCH_DAMAGE_COUNT,
+};
+
+static const char * const bench_damage_names[] = {
+	[BENCH_FULL] = "full",
+	[BENCH_RECTS] = "rects",
+	[BENCH_LINE] = "line",
+};
+
+static double bench_min_time = 0.25;
+static bool bench_mirror;
+static bool bench_wc;
+
+/* -z: a 720p source scaled to the mode, as by sdrm_blit_scaled() */
+static const struct bench_mode bench_scale_src = { "720p", 1280, 720 };
+static struct sdrm_blit_scale bench_scale_buf;
+static struct sdrm_blit_scale *bench_scale;
+
+/* -r: a source turned onto the mode, as by sdrm_blit_rotated() */
+static struct bench_mode bench_rotate_src = { "src" };
+static struct sdrm_blit_rotate bench_rotate_buf;
+static struct sdrm_blit_rotate *bench_rotate;
+
+/* -f: scanout of an fbdev device as the destination */
+static struct bench_mode bench_fb_mode = { "fb" };
+static u8 *bench_fb_map;
+static u32 bench_fb_stride, bench_fb_cpp;
+
+/* -j: row bands per rect, one thread each, as in sdrm_blit_parallel() */
+#define BENCH_MAX_THREADS 64
+
+struct bench_worker {
+	pthread_t thread;
+	unsigned int index;
+	struct sdrm_blit_mirror mirror;
+	u8 *line;
+};
+
+static unsigned int bench_threads = 1;
+static struct bench_worker bench_workers[BENCH_MAX_THREADS];
+
+static struct {
+	const struct sdrm_blit_buf *dst;
+	const struct sdrm_blit_buf *src;
+	const struct bench_rect *rects;
+	unsigned int num_rects;
+	unsigned int count;
+	bool quit;
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+} bench_job;
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *bench_alloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, 64, size)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	return p;
+}
+
+static void bench_fill(u8 *p, size_t size)
+{
+	u32 seed = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+}
+
+/* random source contents, rows padded by @pad bytes */
+static void bench_src_alloc(struct sdrm_blit_buf *src,
+			    const struct bench_format *sf,
+			    u32 width, u32 height, u32 pad)
+{
+	size_t size;
+
+	src->four_cc = sf->four_cc;
+	src->cpp = sf->cpp;
+	src->width = width;
+	src->height = height;
+	src->stride = width * sf->cpp + pad;
+	src->map = bench_alloc((size_t)src->stride * height);
+	bench_fill(src->map, (size_t)src->stride * height);
+
+	src->uv = NULL;
+	src->uv_stride = 0;
+	if (sf->uv) {
+		src->uv_stride = ((width + 1) & ~1U) + pad;
+		size = (size_t)src->uv_stride * ((height + 1) / 2);
+		src->uv = bench_alloc(size);
+		bench_fill(src->uv, size);
+	}
+
+	src->color_encoding = SDRM_COLOR_YCBCR_BT601;
+	src->color_range = SDRM_COLOR_YCBCR_LIMITED_RANGE;
+	memset(&src->cursor, 0, sizeof(src->cursor));
+	src->mirror = NULL;
+	src->wc = false;
+}
+
+static void bench_src_free(struct sdrm_blit_buf *src)
+{
+	free((void *)src->cursor.map);
+	free(src->uv);
+	free(src->map);
+}
+
+#define BENCH_CURSOR_SIZE 64
+
+/*
+ * Random premultiplied cursor. Every 4th pixel is transparent and every
+ * 4th one opaque, so that all three blend cases are covered.
+ */
+static void bench_cursor_alloc(struct sdrm_blit_buf *src)
+{
+	struct sdrm_blit_cursor *cursor = &src->cursor;
+	u32 i, n = BENCH_CURSOR_SIZE * BENCH_CURSOR_SIZE;
+	u8 *map, *p;
+
+	map = bench_alloc(n * 4);
+	bench_fill(map, n * 4);
+	for (i = 0, p = map; i < n; ++i, p += 4) {
+		if (i % 4 == 1)
+			p[3] = 0;
+		else if (i % 4 == 2)
+			p[3] = 0xff;
+		p[0] = p[0] * p[3] / 255;
+		p[1] = p[1] * p[3] / 255;
+		p[2] = p[2] * p[3] / 255;
+	}
+
+	cursor->map = map;
+	cursor->stride = BENCH_CURSOR_SIZE * 4;
+	cursor->width = BENCH_CURSOR_SIZE;
+	cursor->height = BENCH_CURSOR_SIZE;
+}
+
+static struct sdrm_blit_mirror *bench_mirror_alloc(const struct sdrm_blit_buf *dst)
+{
+	struct sdrm_blit_mirror *mirror;
+
+	mirror = calloc(1, sizeof(*mirror));
+	if (!mirror) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	mirror->map = bench_alloc((size_t)dst->stride * dst->height);
+	mirror->line = bench_alloc(dst->stride);
+	mirror->rows = bench_alloc(dst->height);
+	sdrm_blit_mirror_invalidate(mirror, dst->height);
+
+	return mirror;
+}
+
+static void bench_mirror_free(struct sdrm_blit_mirror *mirror)
+{
+	if (!mirror)
+		return;
+
+	free(mirror->rows);
+	free(mirror->line);
+	free(mirror->map);
+	free(mirror);
+}
+
+static void bench_band(struct bench_worker *w)
+{
+	struct sdrm_blit_buf dst = *bench_job.dst;
+	const struct bench_rect *r;
+	unsigned int i;
+	u32 y, rows;
+
+	if (dst.mirror) {
+		sdrm_blit_mirror_fork(&w->mirror, dst.mirror, w->line);
+		dst.mirror = &w->mirror;
+	}
+
+	for (i = 0; i < bench_job.num_rects; ++i) {
+		r = &bench_job.rects[i];
+		if (bench_scale) {
+			sdrm_blit_scaled(&dst, bench_job.src, bench_scale,
+					 r->x, r->y, r->w, r->h);
+			continue;
+		}
+		if (bench_rotate) {
+			sdrm_blit_rotated(&dst, bench_job.src, bench_rotate,
+					  r->x, r->y, r->w, r->h);
+			continue;
+		}
+
+		y = r->y;
+		rows = sdrm_blit_band(&y, r->h, w->index, bench_job.count);
+		if (rows)
+			sdrm_blit_rect(&dst, bench_job.src, r->x, y, r->w,
+				       rows);
+	}
+}
+
+static void *bench_worker_main(void *data)
+{
+	struct bench_worker *w = data;
+
+	for (;;) {
+		pthread_barrier_wait(&bench_job.start);
+		if (bench_job.quit)
+			return NULL;
+		bench_band(w);
+		pthread_barrier_wait(&bench_job.done);
+	}
+}
+
+static void bench_workers_start(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < bench_threads; ++i)
+		bench_workers[i].index = i;
+	if (bench_threads < 2)
+		return;
+
+	pthread_barrier_init(&bench_job.start, NULL, bench_threads);
+	pthread_barrier_init(&bench_job.done, NULL, bench_threads);
+	for (i = 1; i < bench_threads; ++i) {
+		if (pthread_create(&bench_workers[i].thread, NULL,
+				   bench_worker_main, &bench_workers[i])) {
+			fprintf(stderr, "cannot start thread\n");
+			exit(1);
+		}
+	}
+}
+
+static void bench_workers_stop(void)
+{
+	unsigned int i;
+
+	if (bench_threads < 2)
+		return;
+
+	bench_job.quit = true;
+	pthread_barrier_wait(&bench_job.start);
+	for (i = 1; i < bench_threads; ++i)
+		pthread_join(bench_workers[i].thread, NULL);
+}
+
+/* blit all rects once, split @count ways */
+static void bench_blit(const struct sdrm_blit_buf *dst,
+		       const struct sdrm_blit_buf *src,
+		       const struct bench_rect *rects, unsigned int num_rects,
+		       unsigned int count)
+{
+	unsigned int i;
+
+	bench_job.dst = dst;
+	bench_job.src = src;
+	bench_job.rects = rects;
+	bench_job.num_rects = num_rects;
+	bench_job.count = count;
+
+	if (count < 2) {
+		bench_band(&bench_workers[0]);
+	} else {
+		pthread_barrier_wait(&bench_job.start);
+		bench_band(&bench_workers[0]);
+		pthread_barrier_wait(&bench_job.done);
+	}
+
+	if (dst->mirror)
+		for (i = 0; i < count; ++i)
+			sdrm_blit_mirror_join(dst->mirror,
+					      &bench_workers[i].mirror);
+}
+
+/* returns seconds per pixel */
+static double bench_measure(const struct sdrm_blit_buf *dst,
+			    const struct sdrm_blit_buf *src,
+			    const struct bench_rect *rects,
+			    unsigned int num_rects, unsigned int count,
+			    unsigned int *iters)
+{
+	double start, elapsed;
+	u64 pixels = 0, per_iter = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_rects; ++i)
+		per_iter += (u64)rects[i].w * rects[i].h;
+
+	/* scaled rates are per output pixel */
+	if (bench_scale)
+		per_iter = per_iter * bench_scale->dst_w * bench_scale->dst_h /
+			   (bench_scale->src_w * bench_scale->src_h);
+
+	/* every measurement starts from a cold mirror */
+	if (dst->mirror) {
+		sdrm_blit_mirror_invalidate(dst->mirror, dst->height);
+		dst->mirror->checked = 0;
+		dst->mirror->written = 0;
+	}
+
+	*iters = 0;
+	start = bench_now();
+	do {
+		bench_blit(dst, src, rects, num_rects, count);
+		pixels += per_iter;
+		++*iters;
+		elapsed = bench_now() - start;
+	} while (elapsed < bench_min_time);
+
+	return elapsed / pixels;
+}
+
+static unsigned int bench_damage(enum bench_damage damage,
+				 const struct bench_mode *mode,
+				 struct bench_rect *rects)
+{
+	u32 seed = 42;
+	unsigned int i;
+
+	switch (damage) {
+	case BENCH_FULL:
+		rects[0] = (struct bench_rect){ 0, 0, mode->width, mode->height };
+		return 1;
+	case BENCH_LINE:
+		rects[0] = (struct bench_rect){ 0, mode->height / 2,
+						mode->width, 1 };
+		return 1;
+	case BENCH_RECTS:
+		for (i = 0; i < BENCH_SMALL_RECTS; ++i) {
+			seed = seed * 1103515245 + 12345;
+			rects[i].x = (seed >> 8) % (mode->width -
+						    BENCH_SMALL_SIZE);
+			seed = seed * 1103515245 + 12345;
+			rects[i].y = (seed >> 8) % (mode->height -
+						    BENCH_SMALL_SIZE);
+			rects[i].w = BENCH_SMALL_SIZE;
+			rects[i].h = BENCH_SMALL_SIZE;
+		}
+		return BENCH_SMALL_RECTS;
+	default:
+		return 0;
+	}
+}
+
+static void bench_pair(const struct bench_mode *mode,
+		       const struct bench_format *sf,
+		       const struct bench_format *df,
+		       enum bench_damage damage)
+{
+	struct bench_rect rects[BENCH_SMALL_RECTS];
+	const struct bench_mode *src_mode = mode;
+	struct sdrm_blit_buf src, dst;
+	unsigned int i, n, iters;
+	double t, t1 = 0;
+
+	if (bench_rotate) {
+		/* turned by 90 or 270 degrees, a portrait source fills it */
+		bench_rotate_src.width = mode->width;
+		bench_rotate_src.height = mode->height;
+		if (bench_rotate->rotation & (DRM_ROTATE_90 | DRM_ROTATE_270)) {
+			bench_rotate_src.width = mode->height;
+			bench_rotate_src.height = mode->width;
+		}
+		src_mode = &bench_rotate_src;
+		bench_rotate->src_w = src_mode->width;
+		bench_rotate->src_h = src_mode->height;
+		bench_rotate->scratch = bench_alloc(
+			SDRM_BLIT_ROTATE_SCRATCH(mode->width));
+		bench_src_alloc(&src, sf, src_mode->width, src_mode->height, 0);
+	} else if (bench_scale) {
+		bench_scale->src_w = bench_scale_src.width;
+		bench_scale->src_h = bench_scale_src.height;
+		bench_scale->dst_w = mode->width;
+		bench_scale->dst_h = mode->height;
+		bench_scale->scratch = bench_alloc(SDRM_BLIT_SCALE_SCRATCH(
+			bench_scale->src_w, bench_scale->dst_w));
+		bench_src_alloc(&src, sf, bench_scale_src.width,
+				bench_scale_src.height, 0);
+	} else {
+		bench_src_alloc(&src, sf, mode->width, mode->height, 0);
+	}
+
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.width = mode->width;
+	dst.height = mode->height;
+	if (bench_fb_map) {
+		dst.stride = bench_fb_stride;
+		dst.map = bench_fb_map;
+	} else {
+		dst.stride = mode->width * df->cpp;
+		dst.map = bench_alloc((size_t)dst.stride * dst.height);
+		memset(dst.map, 0, (size_t)dst.stride * dst.height);
+	}
+	dst.mirror = bench_mirror ? bench_mirror_alloc(&dst) : NULL;
+	dst.wc = bench_wc;
+
+	/* each band converts into a scratch line of its own */
+	for (i = 0; dst.mirror && i < bench_threads; ++i)
+		bench_workers[i].line = bench_alloc(dst.stride);
+
+	if (bench_scale)
+		src_mode = &bench_scale_src;
+	n = bench_damage(damage, src_mode, rects);
+
+	if (bench_threads > 1)
+		t1 = bench_measure(&dst, &src, rects, n, 1, &iters);
+	t = bench_measure(&dst, &src, rects, n, bench_threads, &iters);
+
+	printf("%-6s %-6s %-11s %-11s %10.1f %8.3f %8u",
+	       mode->name, bench_damage_names[damage], sf->name, df->name,
+	       df->cpp / t / 1e6, t * 1e9, iters);
+	if (bench_threads > 1)
+		printf(" %7.2fx", t1 / t);
+	/* the source never changes, so only the first pass stores anything */
+	if (dst.mirror)
+		printf(" %8.1f%%", dst.mirror->checked ?
+		       100.0 * dst.mirror->written / dst.mirror->checked : 0);
+	printf("\n");
+
+	for (i = 0; dst.mirror && i < bench_threads; ++i)
+		free(bench_workers[i].line);
+	bench_mirror_free(dst.mirror);
+	if (!bench_fb_map)
+		free(dst.map);
+	if (bench_scale)
+		free(bench_scale->scratch);
+	if (bench_rotate)
+		free(bench_rotate->scratch);
+	bench_src_free(&src);
+}
+
+/* sdrm_blit_parallel()'s split, one band after the other */
+static void bench_blit_banded(const struct sdrm_blit_buf *dst,
+			      const struct sdrm_blit_buf *src,
+			      u32 x, u32 y, u32 width, u32 height,
+			      unsigned int count)
+{
+	struct sdrm_blit_buf band = *dst;
+	struct sdrm_blit_mirror mirror;
+	unsigned int i;
+	u32 band_y, rows;
+
+	for (i = 0; i < count; ++i) {
+		band_y = y;
+		rows = sdrm_blit_band(&band_y, height, i, count);
+		if (!rows)
+			continue;
+
+		sdrm_blit_mirror_fork(&mirror, dst->mirror, dst->mirror->line);
+		band.mirror = &mirror;
+		sdrm_blit_rect(&band, src, x, band_y, width, rows);
+		sdrm_blit_mirror_join(dst->mirror, &mirror);
+	}
+}
+
+/*
+ * SIMD and scalar paths must produce bit-identical scanout contents, and so
+ * must uploads through a mirror, even after the source changed underneath,
+ * uploads split into row bands and uploads streamed to a write-combined
+ * destination.
+ */
+static int bench_verify(const struct bench_mode *mode,
+			const struct bench_format *sf,
+			const struct bench_format *df)
+{
+	struct sdrm_blit_buf src, dst, ref, mir, par, str;
+	size_t dst_size;
+	bool simd = sdrm_blit_simd;
+	unsigned int pass;
+	u32 x;
+	int r;
+
+	bench_src_alloc(&src, sf, mode->width, mode->height, 64);
+	bench_cursor_alloc(&src);
+
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.width = mode->width;
+	dst.height = mode->height;
+	dst.stride = mode->width * df->cpp;
+	dst.mirror = NULL;
+	dst.wc = false;
+	dst_size = (size_t)dst.stride * dst.height;
+	ref = dst;
+	mir = dst;
+	par = dst;
+	str = dst;
+	dst.map = bench_alloc(dst_size);
+	ref.map = bench_alloc(dst_size);
+	mir.map = bench_alloc(dst_size);
+	par.map = bench_alloc(dst_size);
+	str.map = bench_alloc(dst_size);
+	mir.mirror = bench_mirror_alloc(&mir);
+	mir.wc = true;
+	par.mirror = bench_mirror_alloc(&par);
+	str.wc = true;
+	memset(dst.map, 0xa5, dst_size);
+	memset(ref.map, 0xa5, dst_size);
+	memset(mir.map, 0xa5, dst_size);
+	memset(par.map, 0xa5, dst_size);
+	memset(str.map, 0xa5, dst_size);
+
+	for (pass = 0; pass < 3; ++pass) {
+		/* no cursor, then one cut off at the left and at the right */
+		src.cursor.x = pass == 1 ? -20 : (s32)mode->width - 40;
+		src.cursor.y = pass == 1 ? -7 : 10;
+		if (!pass)
+			src.cursor.y = -BENCH_CURSOR_SIZE;
+
+		/* odd offsets and widths exercise the scalar row tails */
+		for (x = 0; x < 37; x += 3) {
+			sdrm_blit_simd = false;
+			sdrm_blit_rect(&ref, &src, x, x, mode->width - 2 * x,
+				       17 + x);
+			sdrm_blit_simd = true;
+			sdrm_blit_rect(&dst, &src, x, x, mode->width - 2 * x,
+				       17 + x);
+			sdrm_blit_rect(&mir, &src, x, x, mode->width - 2 * x,
+				       17 + x);
+			bench_blit_banded(&par, &src, x, x, mode->width - 2 * x,
+					  17 + x, 3);
+			sdrm_blit_rect(&str, &src, x, x, mode->width - 2 * x,
+				       17 + x);
+		}
+
+		/*
+		 * Rows 0-16 are blitted at full width and thus compared
+		 * against the mirror from the second pass on; change a few
+		 * scattered bytes there and every byte of row 5.
+		 */
+		for (x = 0; x < 64; ++x)
+			src.map[(x * 7919 + pass) % (17 * src.stride)] ^= 0x5a;
+		memset(src.map + 5 * src.stride, pass + 1, src.stride);
+	}
+	sdrm_blit_simd = simd;
+
+	r = memcmp(dst.map, ref.map, dst_size) ? -EINVAL : 0;
+	if (r)
+		fprintf(stderr, "MISMATCH: %s %s -> %s\n",
+			mode->name, sf->name, df->name);
+
+	if (memcmp(mir.map, ref.map, dst_size)) {
+		fprintf(stderr, "MIRROR MISMATCH: %s %s -> %s\n",
+			mode->name, sf->name, df->name);
+		r = -EINVAL;
+	}
+
+	if (memcmp(par.map, ref.map, dst_size)) {
+		fprintf(stderr, "BANDED MISMATCH: %s %s -> %s\n",
+			mode->name, sf->name, df->name);
+		r = -EINVAL;
+	}
+
+	if (memcmp(str.map, ref.map, dst_size)) {
+		fprintf(stderr, "STREAMED MISMATCH: %s %s -> %s\n",
+			mode->name, sf->name, df->name);
+		r = -EINVAL;
+	}
+
+	bench_mirror_free(par.mirror);
+	bench_mirror_free(mir.mirror);
+	free(str.map);
+	free(par.map);
+	free(mir.map);
+	free(ref.map);
+	free(dst.map);
+	bench_src_free(&src);
+	return r;
+}
+
+/* @under with the cursor pixel @c blended over it, channel by channel */
+static u32 bench_ref_blend(u32 under, const u8 *c,
+			   const struct bench_format *df)
+{
+	u32 out = 0, bits, d, v, i;
+
+	if (!c[3])
+		return under;
+
+	for (i = 0; i < 3; ++i) {
+		bits = df->chan[i][1];
+		d = (under >> df->chan[i][0]) & ((1U << bits) - 1);
+		d <<= 16 - bits;
+		v = c[2 - i] * 257 + (d * (255 - c[3]) + 127) / 255;
+		if (v > 0xffff)
+			v = 0xffff;
+		out |= (v >> (16 - bits)) << df->chan[i][0];
+	}
+
+	return out;
+}
+
+/* one pixel, converted from its channel layout alone */
+static u32 bench_ref_pixel(const u8 *p, const struct bench_format *sf,
+			   const struct bench_format *df)
+{
+	u32 v = 0, out = 0, c, i;
+
+	for (i = 0; i < sf->cpp; ++i)
+		v |= (u32)p[i] << (8 * i);
+
+	/* widen to 16 bits with the low bits clear, then truncate */
+	for (i = 0; i < 3; ++i) {
+		c = (v >> sf->chan[i][0]) & ((1U << sf->chan[i][1]) - 1);
+		c <<= 16 - sf->chan[i][1];
+		out |= (c >> (16 - df->chan[i][1])) << df->chan[i][0];
+	}
+
+	return out;
+}
+
+static void bench_yuv_sample(const struct sdrm_blit_buf *src, u32 x, u32 y,
+			     int *luma, int *cb, int *cr)
+{
+	const u8 *p = src->map + y * src->stride + (x & ~1U) * src->cpp;
+
+	*luma = *cb = *cr = 0;
+
+	switch (src->four_cc) {
+	case DRM_FORMAT_YUYV:
+		*luma = p[(x & 1) * 2];
+		*cb = p[1];
+		*cr = p[3];
+		break;
+	case DRM_FORMAT_UYVY:
+		*luma = p[(x & 1) * 2 + 1];
+		*cb = p[0];
+		*cr = p[2];
+		break;
+	case DRM_FORMAT_NV12:
+		*luma = p[x & 1];
+		p = src->uv + y / 2 * src->uv_stride + (x & ~1U);
+		*cb = p[0];
+		*cr = p[1];
+		break;
+	}
+}
+
+static int bench_yuv_channel(double v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : (int)(v + 0.5);
+}
+
+/*
+ * Pixel (@x, @y) against the exact BT.601/BT.709 equations. The blit core
+ * works in fixed point, so it may be off by one level at 8 bits, or by one
+ * step at lower depths.
+ */
+static bool bench_yuv_pixel_ok(const struct sdrm_blit_buf *src,
+			       const struct sdrm_blit_buf *dst,
+			       const struct bench_format *df, u32 x, u32 y)
+{
+	static const double kr[] = { 0.299, 0.2126 }, kb[] = { 0.114, 0.0722 };
+	unsigned int e = src->color_encoding;
+	int luma, cb, cr, want[3], got, tol;
+	double fy, fu, fv, kg;
+	const u8 *d;
+	u32 i, v, w;
+
+	bench_yuv_sample(src, x, y, &luma, &cb, &cr);
+	fy = luma;
+	fu = cb - 128;
+	fv = cr - 128;
+	if (src->color_range == SDRM_COLOR_YCBCR_LIMITED_RANGE) {
+		fy = (fy - 16) * 255 / 219;
+		fu *= 255.0 / 224;
+		fv *= 255.0 / 224;
+	}
+
+	kg = 1 - kr[e] - kb[e];
+	want[0] = bench_yuv_channel(fy + 2 * (1 - kr[e]) * fv);
+	want[1] = bench_yuv_channel(fy - 2 * kb[e] * (1 - kb[e]) / kg * fu -
+				    2 * kr[e] * (1 - kr[e]) / kg * fv);
+	want[2] = bench_yuv_channel(fy + 2 * (1 - kb[e]) * fu);
+
+	d = dst->map + y * dst->stride + x * dst->cpp;
+	for (v = 0, i = 0; i < dst->cpp; ++i)
+		v |= (u32)d[i] << (8 * i);
+
+	for (i = 0; i < 3; ++i) {
+		w = df->chan[i][1];
+		got = (v >> df->chan[i][0]) & ((1U << w) - 1);
+		if (w >= 8) {
+			got >>= w - 8;
+			tol = 1;
+		} else {
+			got <<= 8 - w;
+			want[i] &= ~((1 << (8 - w)) - 1);
+			tol = 1 << (8 - w);
+		}
+		if (abs(got - want[i]) > tol)
+			return false;
+	}
+
+	return true;
+}
+
+/* YUV sources, for every encoding and range */
+static int bench_yuv_reference(const struct bench_mode *mode,
+			       const struct bench_format *sf,
+			       const struct bench_format *df)
+{
+	struct sdrm_blit_buf src, dst;
+	unsigned int enc, range;
+	u32 x, y;
+
+	bench_src_alloc(&src, sf, mode->width, 64, 0);
+
+	dst = src;
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.stride = mode->width * df->cpp;
+	dst.uv = NULL;
+	dst.map = bench_alloc((size_t)dst.stride * dst.height);
+
+	for (enc = 0; enc < 2; ++enc) {
+		for (range = 0; range < 2; ++range) {
+			src.color_encoding = enc;
+			src.color_range = range;
+			sdrm_blit_rect(&dst, &src, 0, 0, src.width, src.height);
+
+			for (y = 0; y < src.height; ++y)
+				for (x = 0; x < src.width; ++x)
+					if (!bench_yuv_pixel_ok(&src, &dst,
+								df, x, y))
+						goto mismatch;
+		}
+	}
+
+	free(dst.map);
+	bench_src_free(&src);
+	return 0;
+
+mismatch:
+	fprintf(stderr, "REFERENCE MISMATCH: %s -> %s at %u,%u, %s %s range\n",
+		sf->name, df->name, x, y, enc ? "BT.709" : "BT.601",
+		range ? "full" : "limited");
+	free(dst.map);
+	bench_src_free(&src);
+	return -EINVAL;
+}
+
+/*
+ * The generated converters must match a naive per-channel conversion for
+ * every pair, with unused and alpha bits written as zero.
+ */
+static int bench_reference(const struct bench_mode *mode,
+			   const struct bench_format *sf,
+			   const struct bench_format *df)
+{
+	struct sdrm_blit_buf src, dst;
+	u32 x, y, i, want;
+	s32 cx, cy;
+	const u8 *p, *d;
+
+	if (sf->yuv)
+		return bench_yuv_reference(mode, sf, df);
+
+	bench_src_alloc(&src, sf, mode->width, 64, 0);
+	bench_cursor_alloc(&src);
+	src.cursor.x = mode->width - BENCH_CURSOR_SIZE / 2;
+	src.cursor.y = -BENCH_CURSOR_SIZE / 4;
+
+	dst = src;
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.stride = mode->width * df->cpp;
+	dst.map = bench_alloc((size_t)dst.stride * dst.height);
+
+	sdrm_blit_rect(&dst, &src, 0, 0, src.width, src.height);
+
+	for (y = 0; y < src.height; ++y) {
+		for (x = 0; x < src.width; ++x) {
+			p = src.map + y * src.stride + x * sf->cpp;
+			want = bench_ref_pixel(p, sf, df);
+			/* copied as is, unused bits included */
+			if (sf->four_cc == df->four_cc)
+				for (want = 0, i = 0; i < sf->cpp; ++i)
+					want |= (u32)p[i] << (8 * i);
+
+			cx = x - src.cursor.x;
+			cy = y - src.cursor.y;
+			if (cx >= 0 && cx < BENCH_CURSOR_SIZE &&
+			    cy >= 0 && cy < BENCH_CURSOR_SIZE)
+				want = bench_ref_blend(want, src.cursor.map +
+						       cy * src.cursor.stride +
+						       cx * 4, df);
+			d = dst.map + y * dst.stride + x * df->cpp;
+			for (i = 0; i < df->cpp; ++i)
+				if (d[i] != (u8)(want >> (8 * i)))
+					goto mismatch;
+		}
+	}
+
+	free(dst.map);
+	bench_src_free(&src);
+	return 0;
+
+mismatch:
+	fprintf(stderr, "REFERENCE MISMATCH: %s -> %s at %u,%u\n",
+		sf->name, df->name, x, y);
+	free(dst.map);
+	bench_src_free(&src);
+	return -EINVAL;
+}
+
+static const struct bench_format bench_xrgb8888 = {
+	"XRGB8888", DRM_FORMAT_XRGB8888, 4, { { 16, 8 }, { 8, 8 }, { 0, 8 } }
+};
+
+/* source position sampled by output pixel @d, as in simpledrm_blit.c */
+static void bench_scale_sample(u32 d, u32 src_len, u32 dst_len, bool bilinear,
+			       u32 *i, u32 *j, u32 *f)
+{
+	u32 step = (src_len << 16) / dst_len;
+	s32 pos = (s32)(d * step + step / 2) - 0x8000;
+
+	if (!bilinear) {
+		*i = (pos + 0x8000) >> 16;
+		if (*i > src_len - 1)
+			*i = src_len - 1;
+		*j = *i;
+		*f = 0;
+		return;
+	}
+
+	if (pos < 0)
+		pos = 0;
+	if (pos > (s32)(src_len - 1) << 16)
+		pos = (s32)(src_len - 1) << 16;
+	*i = pos >> 16;
+	*j = *i + 1 < src_len ? *i + 1 : *i;
+	*f = (pos >> 8) & 0xff;
+}
+
+static u32 bench_scale_lerp(u32 a, u32 b, u32 f)
+{
+	u32 out = 0, c, i;
+
+	for (i = 0; i < 24; i += 8) {
+		c = (((a >> i) & 0xff) * (256 - f) +
+		     ((b >> i) & 0xff) * f) >> 8;
+		out |= c << i;
+	}
+
+	return out;
+}
+
+/* output pixel (@x, @y) of @src scaled by @scale, in @df */
+static u32 bench_scale_ref_pixel(const struct sdrm_blit_buf *src,
+				 const struct bench_format *sf,
+				 const struct bench_format *df,
+				 const struct sdrm_blit_scale *scale,
+				 u32 x, u32 y)
+{
+	u32 i[2], j[2], f[2], p[2][2], c, r, v;
+	u8 px[4];
+
+	bench_scale_sample(x, scale->src_w, scale->dst_w, scale->bilinear,
+			   &i[0], &i[1], &f[0]);
+	bench_scale_sample(y, scale->src_h, scale->dst_h, scale->bilinear,
+			   &j[0], &j[1], &f[1]);
+
+	for (r = 0; r < 2; ++r)
+		for (c = 0; c < 2; ++c)
+			p[r][c] = bench_ref_pixel(src->map +
+				(scale->src_y + j[r]) * src->stride +
+				(scale->src_x + i[c]) * sf->cpp,
+				sf, &bench_xrgb8888);
+
+	v = bench_scale_lerp(bench_scale_lerp(p[0][0], p[1][0], f[1]),
+			     bench_scale_lerp(p[0][1], p[1][1], f[1]), f[0]);
+	for (c = 0; c < 4; ++c)
+		px[c] = v >> (8 * c);
+
+	return bench_ref_pixel(px, &bench_xrgb8888, df);
+}
+
+/* the channel bits of a @df pixel; unused bits are not checked */
+static u32 bench_chan_mask(const struct bench_format *df)
+{
+	u32 mask = 0, i;
+
+	for (i = 0; i < 3; ++i)
+		mask |= ((1U << df->chan[i][1]) - 1) << df->chan[i][0];
+
+	return mask;
+}
+
+/*
+ * Scale a source rect up and down, with both filters, and check the
+ * output against bench_scale_ref_pixel(). Then re-randomize part of the
+ * source and check that blitting just that damage gives the same result
+ * as blitting everything again, directly and through a mirror.
+ */
+static int bench_scale_verify(const struct bench_mode *mode,
+			      const struct bench_format *sf,
+			      const struct bench_format *df)
+{
+	static const u32 ratio[2][2] = { { 2, 3 }, { 5, 4 } };
+	struct sdrm_blit_buf src, dst, ref, mir;
+	struct sdrm_blit_scale scale;
+	u32 x, y, k, b, want, got, mask = bench_chan_mask(df);
+	size_t dst_size;
+	const u8 *d;
+	int r = 0;
+
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.width = mode->width;
+	dst.height = mode->height;
+	dst.stride = mode->width * df->cpp;
+	dst.mirror = NULL;
+	dst.wc = false;
+	dst_size = (size_t)dst.stride * dst.height;
+	ref = dst;
+	mir = dst;
+	dst.map = bench_alloc(dst_size);
+	ref.map = bench_alloc(dst_size);
+	mir.map = bench_alloc(dst_size);
+	mir.mirror = bench_mirror_alloc(&mir);
+	mir.wc = true;
+
+	for (k = 0; k < 4; ++k) {
+		scale.src_x = 3;
+		scale.src_y = 2;
+		scale.src_w = mode->width * ratio[k / 2][0] / ratio[k / 2][1] | 1;
+		scale.src_h = mode->height * ratio[k / 2][0] / ratio[k / 2][1] | 1;
+		scale.dst_w = mode->width;
+		scale.dst_h = mode->height;
+		scale.bilinear = k & 1;
+		scale.scratch = bench_alloc(SDRM_BLIT_SCALE_SCRATCH(scale.src_w,
+								    scale.dst_w));
+		bench_src_alloc(&src, sf, scale.src_x + scale.src_w + 5,
+				scale.src_y + scale.src_h + 4, 8);
+
+		sdrm_blit_scaled(&dst, &src, &scale, 0, 0, src.width,
+				 src.height);
+		sdrm_blit_scaled(&mir, &src, &scale, 0, 0, src.width,
+				 src.height);
+
+		for (y = 0; !sf->yuv && y < dst.height; ++y) {
+			for (x = 0; x < dst.width; ++x) {
+				want = bench_scale_ref_pixel(&src, sf, df,
+							     &scale, x, y);
+				d = dst.map + y * dst.stride + x * df->cpp;
+				for (got = 0, b = 0; b < df->cpp; ++b)
+					got |= (u32)d[b] << (8 * b);
+				if ((got ^ want) & mask) {
+					fprintf(stderr, "SCALED MISMATCH: %s %s -> %s, %s, at %u,%u\n",
+						mode->name, sf->name, df->name,
+						scale.bilinear ? "bilinear" : "nearest",
+						x, y);
+					r = -EINVAL;
+					goto next;
+				}
+			}
+		}
+
+		/* a rect straddling the left edge of the source rect */
+		for (y = 20; y < 20 + 13; ++y)
+			bench_fill(src.map + y * src.stride,
+				   (scale.src_x + 9) * sf->cpp);
+		sdrm_blit_scaled(&dst, &src, &scale, 0, 20, scale.src_x + 9, 13);
+		sdrm_blit_scaled(&mir, &src, &scale, 0, 20, scale.src_x + 9, 13);
+		sdrm_blit_scaled(&ref, &src, &scale, 0, 0, src.width,
+				 src.height);
+
+		if (memcmp(dst.map, ref.map, dst_size) ||
+		    memcmp(mir.map, ref.map, dst_size)) {
+			fprintf(stderr, "SCALED DAMAGE MISMATCH: %s %s -> %s, %s\n",
+				mode->name, sf->name, df->name,
+				scale.bilinear ? "bilinear" : "nearest");
+			r = -EINVAL;
+		}
+next:
+		free(scale.scratch);
+		bench_src_free(&src);
+	}
+
+	bench_mirror_free(mir.mirror);
+	free(mir.map);
+	free(ref.map);
+	free(dst.map);
+	return r;
+}
+
+/* where source rect pixel (@u, @v) is shown, as drm_rect_rotate() puts it */
+static void bench_rotate_pixel(unsigned int rotation, u32 w, u32 h,
+			       u32 u, u32 v, u32 *x, u32 *y)
+{
+	if (rotation & DRM_REFLECT_X)
+		u = w - 1 - u;
+	if (rotation & DRM_REFLECT_Y)
+		v = h - 1 - v;
+
+	switch (rotation & DRM_ROTATE_MASK) {
+	case DRM_ROTATE_90:
+		*x = v;
+		*y = w - 1 - u;
+		break;
+	case DRM_ROTATE_180:
+		*x = w - 1 - u;
+		*y = h - 1 - v;
+		break;
+	case DRM_ROTATE_270:
+		*x = h - 1 - v;
+		*y = u;
+		break;
+	default:
+		*x = u;
+		*y = v;
+		break;
+	}
+}
+
+/* blit the source rect of @rot wherever the cursor is or was */
+static void bench_rotate_cursor_damage(const struct sdrm_blit_buf *dst,
+				       const struct sdrm_blit_buf *src,
+				       const struct sdrm_blit_rotate *rot,
+				       const struct sdrm_blit_cursor *cursor)
+{
+	s32 x1 = max_t(s32, cursor->x, 0), y1 = max_t(s32, cursor->y, 0);
+	s32 x2 = min_t(s32, cursor->x + (s32)cursor->width, dst->width);
+	s32 y2 = min_t(s32, cursor->y + (s32)cursor->height, dst->height);
+	u32 x = x1, y = y1, w = x2 - x1, h = y2 - y1;
+
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	sdrm_blit_rotate_to_src(rot, &x, &y, &w, &h);
+	sdrm_blit_rotated(dst, src, rot, x, y, w, h);
+}
+
+/*
+ * Turn a source rect that spans several partial tiles every way there is,
+ * under a cursor, and check the output pixel by pixel against a plain
+ * blit of the rect. Then re-randomize part of the source and move the
+ * cursor, and check that blitting just that damage gives the same result
+ * as blitting everything again, directly and through a mirror.
+ */
+static int bench_rotate_verify(const struct bench_format *sf,
+			       const struct bench_format *df)
+{
+	struct sdrm_blit_buf src, dst, ref, mir, full;
+	struct sdrm_blit_cursor cursor, old;
+	struct sdrm_blit_rotate rot;
+	u32 k, u, v, x, y, i, want;
+	size_t dst_size;
+	s32 cx, cy;
+	const u8 *p, *d;
+	int r = 0;
+
+	bench_src_alloc(&src, sf, 181, 97, 8);
+	bench_cursor_alloc(&src);
+	cursor = src.cursor;
+	rot.src_x = 5;
+	rot.src_y = 3;
+	rot.src_w = 157;
+	rot.src_h = 83;
+
+	/* the rect unturned and without cursor, to compare against */
+	ref = src;
+	ref.four_cc = df->four_cc;
+	ref.cpp = df->cpp;
+	ref.stride = src.width * df->cpp;
+	ref.map = bench_alloc((size_t)ref.stride * ref.height);
+
+	dst.four_cc = df->four_cc;
+	dst.cpp = df->cpp;
+	dst.width = 170;
+	dst.height = 170;
+	dst.stride = dst.width * df->cpp;
+	dst.mirror = NULL;
+	dst.wc = false;
+	dst_size = (size_t)dst.stride * dst.height;
+	mir = dst;
+	full = dst;
+	dst.map = bench_alloc(dst_size);
+	mir.map = bench_alloc(dst_size);
+	full.map = bench_alloc(dst_size);
+	mir.mirror = bench_mirror_alloc(&mir);
+	mir.wc = true;
+	rot.scratch = bench_alloc(SDRM_BLIT_ROTATE_SCRATCH(dst.width));
+
+	/* every rotation with every reflection, duplicates included */
+	for (k = 0; k < 16; ++k) {
+		rot.rotation = DRM_ROTATE_0 << (k & 3) | (k >> 2) << 4;
+
+		memset(&src.cursor, 0, sizeof(src.cursor));
+		sdrm_blit_rect(&ref, &src, 0, 0, src.width, src.height);
+
+		memset(dst.map, 0, dst_size);
+		memset(mir.map, 0, dst_size);
+		sdrm_blit_mirror_invalidate(mir.mirror, mir.height);
+		src.cursor = cursor;
+		src.cursor.x = -7;
+		src.cursor.y = 30;
+		sdrm_blit_rotated(&dst, &src, &rot, 0, 0, src.width,
+				  src.height);
+		sdrm_blit_rotated(&mir, &src, &rot, 0, 0, src.width,
+				  src.height);
+
+		for (v = 0; v < rot.src_h; ++v) {
+			for (u = 0; u < rot.src_w; ++u) {
+				bench_rotate_pixel(rot.rotation, rot.src_w,
+						   rot.src_h, u, v, &x, &y);
+				p = ref.map + (rot.src_y + v) * ref.stride +
+				    (rot.src_x + u) * df->cpp;
+				for (want = 0, i = 0; i < df->cpp; ++i)
+					want |= (u32)p[i] << (8 * i);
+
+				cx = x - src.cursor.x;
+				cy = y - src.cursor.y;
+				if (cx >= 0 && cx < BENCH_CURSOR_SIZE &&
+				    cy >= 0 && cy < BENCH_CURSOR_SIZE)
+					want = bench_ref_blend(want,
+						src.cursor.map +
+						cy * src.cursor.stride + cx * 4,
+						df);
+
+				d = dst.map + y * dst.stride + x * df->cpp;
+				for (i = 0; i < df->cpp; ++i)
+					if (d[i] != (u8)(want >> (8 * i)))
+						goto mismatch;
+			}
+		}
+
+		/* damage straddling the rect's edge, and a cursor move */
+		for (y = 1; y < 1 + 29; ++y)
+			bench_fill(src.map + y * src.stride +
+				   (2 + 2 * k) * sf->cpp, 38 * sf->cpp);
+		old = src.cursor;
+		src.cursor.x = 120;
+		src.cursor.y = -11;
+		for (i = 0; i < 2; ++i) {
+			sdrm_blit_rotated(i ? &mir : &dst, &src, &rot,
+					  2 + 2 * k, 1, 38, 29);
+			bench_rotate_cursor_damage(i ? &mir : &dst, &src, &rot,
+						   &old);
+			bench_rotate_cursor_damage(i ? &mir : &dst, &src, &rot,
+						   &src.cursor);
+		}
+		memset(full.map, 0, dst_size);
+		sdrm_blit_rotated(&full, &src, &rot, 0, 0, src.width,
+				  src.height);
+
+		if (memcmp(dst.map, full.map, dst_size) ||
+		    memcmp(mir.map, full.map, dst_size)) {
+			fprintf(stderr, "ROTATED DAMAGE MISMATCH: %s -> %s, rotation 0x%x\n",
+				sf->name, df->name, rot.rotation);
+			r = -EINVAL;
+		}
+	}
+	goto out;
+
+mismatch:
+	fprintf(stderr, "ROTATED MISMATCH: %s -> %s, rotation 0x%x, at %u,%u\n",
+		sf->name, df->name, rot.rotation, u, v);
+	r = -EINVAL;
+out:
+	src.cursor = cursor;
+	bench_mirror_free(mir.mirror);
+	free(rot.scratch);
+	free(full.map);
+	free(mir.map);
+	free(dst.map);
+	free(ref.map);
+	bench_src_free(&src);
+	return r;
+}
+
+/*
+ * Every way the driver's BAR bandwidth test writes a rect has to leave the
+ * same bytes behind, including odd line lengths. Only the single memcpy()
+ * runs over the gaps between lines.
+ */
+static int bench_bandwidth_verify(void)
+{
+	const u32 stride = 1000, len = 998, rows = 13;
+	size_t size = (size_t)stride * rows;
+	u8 *src, *dst;
+	u32 mode, i;
+	bool gaps;
+	int r = 0;
+
+	src = bench_alloc(size);
+	dst = bench_alloc(size);
+	for (i = 0; i < size; ++i)
+		src[i] = i * 7 + 1;
+
+	for (mode = 0; mode < SDRM_BLIT_BW_MODES; ++mode) {
+		memset(dst, 0, size);
+		if (!sdrm_blit_bandwidth(dst + 2, src + 2, stride, len, rows,
+					 mode))
+			continue;
+
+		gaps = mode == SDRM_BLIT_BW_MEMCPY;
+		for (i = 0; i < size; ++i) {
+			if (dst[i] != (i % stride >= 2 || (gaps && i >= 2) ?
+				       src[i] : 0)) {
+				fprintf(stderr, "BANDWIDTH MISMATCH: mode %u, at byte %u\n",
+					mode, i);
+				r = -EINVAL;
+				break;
+			}
+		}
+	}
+
+	free(dst);
+	free(src);
+	return r;
+}
+
+/* random clips, some reaching past the frame and some empty or inverted */
+static void bench_region_clips(struct drm_clip_rect *clips, unsigned int num,
+			       u32 width, u32 height, u32 *seed)
+{
+	u32 v[4];
+	unsigned int i, k;
+
+	for (i = 0; i < num; ++i) {
+		for (k = 0; k < 4; ++k) {
+			*seed = *seed * 1103515245 + 12345;
+			v[k] = *seed >> 8;
+		}
+		clips[i].x1 = v[0] % (width + 16);
+		clips[i].y1 = v[1] % (height + 16);
+		/* mostly small, as from a cursor or a text edit */
+		clips[i].x2 = clips[i].x1 + v[2] % (v[2] & 0x100 ? width : 24);
+		clips[i].y2 = clips[i].y1 + v[3] % (v[3] & 0x100 ? height : 24);
+		if (!(v[0] & 0x1f0))
+			clips[i].x2 = clips[i].x1 / 2;
+	}
+}
+
+/*
+ * The rects sdrm_region_build() uploads have to be disjoint and within the
+ * frame, and cover exactly the damage clipped against it, or more of it
+ * when the cost model collapsed them to the bounding box or the full frame
+ * or the damage was too fragmented to represent.
+ */
+#define BENCH_REGION_W 197
+#define BENCH_REGION_H 131
+
+static int bench_region_verify(void)
+{
+	const u32 width = BENCH_REGION_W, height = BENCH_REGION_H;
+	static struct sdrm_region rgn, tmp;
+	struct drm_clip_rect clips[SDRM_REGION_MAX_INPUT];
+	struct drm_clip_rect in[SDRM_REGION_MAX_INPUT];
+	struct sdrm_region_stats stats;
+	const struct drm_clip_rect *c;
+	u8 want[BENCH_REGION_H][BENCH_REGION_W];
+	u8 got[BENCH_REGION_H][BENCH_REGION_W];
+	unsigned int iter, num, i, n;
+	u32 seed = 0x2468ace0, x, y;
+	bool exact;
+
+	for (iter = 0; iter < 4000; ++iter) {
+		seed = seed * 1103515245 + 12345;
+		num = (seed >> 8) % (iter & 1 ? SDRM_REGION_MAX_INPUT : 6) + 1;
+		bench_region_clips(clips, num, width, height, &seed);
+
+		memset(want, 0, sizeof(want));
+		for (i = 0, n = 0; i < num; ++i) {
+			in[n].x1 = min_t(u32, clips[i].x1, width);
+			in[n].y1 = min_t(u32, clips[i].y1, height);
+			in[n].x2 = min_t(u32, clips[i].x2, width);
+			in[n].y2 = min_t(u32, clips[i].y2, height);
+			if (in[n].x2 <= in[n].x1 || in[n].y2 <= in[n].y1)
+				continue;
+			for (y = in[n].y1; y < in[n].y2; ++y)
+				memset(&want[y][in[n].x1], 1,
+				       in[n].x2 - in[n].x1);
+			n++;
+		}
+
+		memset(&stats, 0, sizeof(stats));
+		sdrm_region_build(&rgn, clips, num, width, height, &stats);
+		exact = sdrm_region_set(&tmp, in, n) &&
+			!stats.bbox && !stats.full;
+
+		memset(got, 0, sizeof(got));
+		for (i = 0; i < rgn.num_rects; ++i) {
+			c = &rgn.rects[i];
+			if (c->x1 >= c->x2 || c->y1 >= c->y2 ||
+			    c->x2 > width || c->y2 > height) {
+				fprintf(stderr, "REGION MISMATCH: iteration %u, rect %u is %u,%u-%u,%u in %ux%u\n",
+					iter, i, c->x1, c->y1, c->x2, c->y2,
+					width, height);
+				return -EINVAL;
+			}
+			for (y = c->y1; y < c->y2; ++y)
+				for (x = c->x1; x < c->x2; ++x)
+					if (got[y][x]++)
+						goto overlap;
+		}
+
+		for (y = 0; y < height; ++y) {
+			for (x = 0; x < width; ++x) {
+				if (want[y][x] > got[y][x] ||
+				    (exact && want[y][x] != got[y][x]))
+					goto coverage;
+			}
+		}
+	}
+
+	return 0;
+
+overlap:
+	fprintf(stderr, "REGION MISMATCH: iteration %u, rects overlap at %u,%u\n",
+		iter, x, y);
+	return -EINVAL;
+
+coverage:
+	fprintf(stderr, "REGION MISMATCH: iteration %u, %s at %u,%u\n",
+		iter, got[y][x] ? "not damaged but uploaded" :
+		"damaged but not uploaded", x, y);
+	return -EINVAL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c] [-S] [-M] [-W] [-j threads] [-f fbdev] [-t seconds]\n"
+		"       [-m mode] [-d damage] [-z filter] [-r rotation]\n"
+		"  -c          verify SIMD and mirror paths against scalar and exit\n"
+		"  -S          disable SIMD row converters\n"
+		"  -M          upload through a RAM mirror, last column is %% stored\n"
+		"  -W          stream stores as if the destination were write-combined\n"
+		"  -j threads  split rects into row bands, speedup column is vs. 1\n"
+		"  -f fbdev    blit into an fbdev mapping, e.g. /dev/fb0\n"
+		"  -t seconds  minimum time per measurement (default %.2f)\n"
+		"  -m mode     only run 720p, 1080p or 4k\n"
+		"  -d damage   only run full, rects or line\n"
+		"  -z filter   scale a 720p source to the mode, nearest or bilinear;\n"
+		"              rates are per output pixel\n"
+		"  -r rotation turn a source onto the mode by 0, 90, 180 or 270\n"
+		"              degrees, a portrait one for 90 and 270\n",
+		prog, bench_min_time);
+}
+
+static int bench_fb_open(const char *path)
+{
+	struct fb_fix_screeninfo fix;
+	struct fb_var_screeninfo var;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0 || ioctl(fd, FBIOGET_FSCREENINFO, &fix) ||
+	    ioctl(fd, FBIOGET_VSCREENINFO, &var)) {
+		perror(path);
+		return -errno;
+	}
+
+	map = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return -errno;
+	}
+
+	bench_fb_map = map;
+	bench_fb_stride = fix.line_length;
+	bench_fb_cpp = (var.bits_per_pixel + 7) / 8;
+	bench_fb_mode.width = var.xres;
+	bench_fb_mode.height = var.yres;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *only_mode = NULL, *only_damage = NULL;
+	const struct bench_mode *modes = bench_modes;
+	unsigned int num_modes = ARRAY_SIZE(bench_modes);
+	bool verify = false;
+	unsigned int m, s, d, k;
+	int opt, r = 0;
+
+	sdrm_blit_init();
+
+	while ((opt = getopt(argc, argv, "cSMWj:f:t:m:d:z:r:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			verify = true;
+			break;
+		case 'S':
+			sdrm_blit_simd = false;
+			break;
+		case 'M':
+			bench_mirror = true;
+			break;
+		case 'W':
+			bench_wc = true;
+			break;
+		case 'j':
+			bench_threads = atoi(optarg);
+			if (bench_threads < 1 ||
+			    bench_threads > BENCH_MAX_THREADS) {
+				fprintf(stderr, "threads must be 1-%d\n",
+					BENCH_MAX_THREADS);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (bench_fb_open(optarg))
+				return 1;
+			modes = &bench_fb_mode;
+			num_modes = 1;
+			bench_wc = true;
+			break;
+		case 't':
+			bench_min_time = atof(optarg);
+			break;
+		case 'm':
+			only_mode = optarg;
+			break;
+		case 'd':
+			only_damage = optarg;
+			break;
+		case 'z':
+			if (strcmp(optarg, "nearest") &&
+			    strcmp(optarg, "bilinear")) {
+				usage(argv[0]);
+				return 1;
+			}
+			bench_scale = &bench_scale_buf;
+			bench_scale->bilinear = !strcmp(optarg, "bilinear");
+			break;
+		case 'r':
+			bench_rotate = &bench_rotate_buf;
+			switch (atoi(optarg)) {
+			case 0:
+				bench_rotate->rotation = DRM_ROTATE_0;
+				break;
+			case 90:
+				bench_rotate->rotation = DRM_ROTATE_90;
+				break;
+			case 180:
+				bench_rotate->rotation = DRM_ROTATE_180;
+				break;
+			case 270:
+				bench_rotate->rotation = DRM_ROTATE_270;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	/* like the driver, scaled blits are not split into bands */
+	if ((bench_scale || bench_rotate) && bench_threads > 1) {
+		fprintf(stderr, "-z and -r cannot be combined with -j\n");
+		return 1;
+	}
+	if (bench_scale && bench_rotate) {
+		fprintf(stderr, "-z and -r cannot be combined\n");
+		return 1;
+	}
+
+	if (!verify) {
+		printf("%-6s %-6s %-11s %-11s %10s %8s %8s",
+		       "mode", "damage", "src", "dst", "MB/s", "ns/px",
+		       "iters");
+		if (bench_threads > 1)
+			printf(" %8s", "speedup");
+		printf("\n");
+		bench_workers_start();
+	}
+
+	/* -c checks the built-in modes in RAM, whatever -f said */
+	if (verify) {
+		modes = bench_modes;
+		num_modes = ARRAY_SIZE(bench_modes);
+		if (bench_bandwidth_verify())
+			r = 1;
+		if (bench_region_verify())
+			r = 1;
+	}
+
+	for (m = 0; m < num_modes; ++m) {
+		if (only_mode && strcmp(only_mode, modes[m].name))
+			continue;
+
+		for (s = 0; s < ARRAY_SIZE(bench_src_formats); ++s) {
+			for (d = 0; d < ARRAY_SIZE(bench_dst_formats); ++d) {
+				const struct bench_format *sf, *df;
+
+				sf = &bench_src_formats[s];
+				df = &bench_dst_formats[d];
+				if (!sdrm_blit_supported(sf->four_cc,
+							 df->four_cc))
+					continue;
+				if (bench_fb_map && !verify &&
+				    df->cpp != bench_fb_cpp)
+					continue;
+
+				if (verify) {
+					if (bench_verify(&modes[m], sf, df))
+						r = 1;
+					if (bench_reference(&modes[m], sf, df))
+						r = 1;
+					/* one mode is enough, the rest is slow */
+					if (m == 0 &&
+					    bench_scale_verify(&modes[m], sf, df))
+						r = 1;
+					if (m == 0 &&
+					    bench_rotate_verify(sf, df))
+						r = 1;
+					continue;
+				}
+
+				for (k = 0; k < BENCH_DAMAGE_COUNT; ++k) {
+					if (only_damage &&
+					    strcmp(only_damage,
+						   bench_damage_names[k]))
+						continue;
+					bench_pair(&modes[m], sf, df, k);
+				}
+			}
+		}
+	}
+
+	if (!verify)
+		bench_workers_stop();
+
+	if (verify && !r)
+		printf("all converters, cursor blends, scalers and rotations match the reference; SIMD, mirror, banded and streamed paths match the scalar ones; bandwidth test writes are exact; damage regions are disjoint and cover the damage\n");
+
+	return r;
+}
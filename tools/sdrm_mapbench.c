@@ -0,0 +1,189 @@
+/*
+ * SimpleDRM dumb buffer first-map benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Creates dumb buffers on a DRM device and times the first mmap() of each,
+ * which is when the driver allocates and maps the backing store, plus the
+ * first write through the new mapping. Every run uses a fresh buffer, so
+ * nothing is served from a previous allocation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int bench_ioctl(int fd, unsigned long req, void *arg)
+{
+	int r;
+
+	do {
+		r = ioctl(fd, req, arg);
+	} while (r < 0 && (errno == EINTR || errno == EAGAIN));
+
+	return r < 0 ? -errno : 0;
+}
+
+/* time to first map and touch one fresh buffer, in seconds */
+static int bench_once(int fd, uint32_t width, uint32_t height, uint32_t bpp,
+		      double *map_time, double *touch_time)
+{
+	struct drm_mode_create_dumb create = {
+		.width = width,
+		.height = height,
+		.bpp = bpp,
+	};
+	struct drm_mode_map_dumb map = { 0 };
+	struct drm_mode_destroy_dumb destroy = { 0 };
+	double start, mapped;
+	size_t i;
+	uint8_t *p;
+	int r;
+
+	r = bench_ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+	if (r)
+		return r;
+
+	map.handle = create.handle;
+	r = bench_ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+	if (r)
+		goto out_destroy;
+
+	start = bench_now();
+	p = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		 map.offset);
+	mapped = bench_now();
+	if (p == MAP_FAILED) {
+		r = -errno;
+		goto out_destroy;
+	}
+
+	/* one byte per page, in case the mapping is populated lazily */
+	for (i = 0; i < create.size; i += 4096)
+		p[i] = i;
+	*touch_time = bench_now() - mapped;
+	*map_time = mapped - start;
+
+	munmap(p, create.size);
+
+out_destroy:
+	destroy.handle = create.handle;
+	bench_ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+	return r;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-d device] [-s WxH] [-b bpp] [-n runs]\n"
+		"  -d device  DRM device (default /dev/dri/card0)\n"
+		"  -s WxH     buffer size (default 1920x1080)\n"
+		"  -b bpp     bits per pixel (default 32)\n"
+		"  -n runs    buffers to create (default 50)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/dev/dri/card0";
+	uint32_t width = 1920, height = 1080, bpp = 32;
+	unsigned int runs = 50, i;
+	double *map_t, *touch_t;
+	int fd, opt, r;
+
+	while ((opt = getopt(argc, argv, "d:s:b:n:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'b':
+			bpp = atoi(optarg);
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!runs) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	map_t = calloc(runs, sizeof(*map_t));
+	touch_t = calloc(runs, sizeof(*touch_t));
+	if (!map_t || !touch_t) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < runs; ++i) {
+		r = bench_once(fd, width, height, bpp, &map_t[i], &touch_t[i]);
+		if (r) {
+			fprintf(stderr, "run %u: %s\n", i, strerror(-r));
+			return 1;
+		}
+	}
+
+	qsort(map_t, runs, sizeof(*map_t), bench_cmp);
+	qsort(touch_t, runs, sizeof(*touch_t), bench_cmp);
+
+	printf("%ux%u@%u, %u buffers\n", width, height, bpp, runs);
+	printf("%-8s %10s %10s %10s\n", "", "min us", "median us", "max us");
+	printf("%-8s %10.1f %10.1f %10.1f\n", "mmap", map_t[0] * 1e6,
+	       map_t[runs / 2] * 1e6, map_t[runs - 1] * 1e6);
+	printf("%-8s %10.1f %10.1f %10.1f\n", "touch", touch_t[0] * 1e6,
+	       touch_t[runs / 2] * 1e6, touch_t[runs - 1] * 1e6);
+
+	free(touch_t);
+	free(map_t);
+	close(fd);
+
+	return 0;
+}
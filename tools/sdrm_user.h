@@ -0,0 +1,126 @@
+/*
+ * SimpleDRM firmware framebuffer driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+/*
+ * Userspace stand-ins for the kernel helpers used by the blit core, so
+ * simpledrm_blit.c and the SIMD units build unmodified outside the kernel.
+ */
+
+#ifndef SDRM_USER_H
+#define SDRM_USER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define __aligned(x) __attribute__((aligned(x)))
+#define __packed __attribute__((packed))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define max_t(type, a, b) ((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+#define clamp_t(type, v, lo, hi) min_t(type, max_t(type, v, lo), hi)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define round_down(x, y) ((x) & ~((__typeof__(x))((y) - 1)))
+#define U32_MAX ((u32)~0U)
+
+#define get_unaligned(ptr) \
+	(((const struct { __typeof__(*(ptr)) v; } __packed *)(ptr))->v)
+#define put_unaligned(val, ptr) \
+	(((struct { __typeof__(*(ptr)) v; } __packed *)(ptr))->v = (val))
+
+/* the kernel only ever defines one of these */
+#undef __LITTLE_ENDIAN
+#undef __BIG_ENDIAN
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define __LITTLE_ENDIAN 1234
+#else
+#define __BIG_ENDIAN 4321
+#endif
+
+#define fourcc_code(a, b, c, d) ((u32)(a) | ((u32)(b) << 8) | \
+				 ((u32)(c) << 16) | ((u32)(d) << 24))
+
+#define DRM_FORMAT_RGB565	fourcc_code('R', 'G', '1', '6')
+#define DRM_FORMAT_XRGB1555	fourcc_code('X', 'R', '1', '5')
+#define DRM_FORMAT_ARGB1555	fourcc_code('A', 'R', '1', '5')
+#define DRM_FORMAT_RGB888	fourcc_code('R', 'G', '2', '4')
+#define DRM_FORMAT_BGR888	fourcc_code('B', 'G', '2', '4')
+#define DRM_FORMAT_XRGB8888	fourcc_code('X', 'R', '2', '4')
+#define DRM_FORMAT_ARGB8888	fourcc_code('A', 'R', '2', '4')
+#define DRM_FORMAT_XBGR8888	fourcc_code('X', 'B', '2', '4')
+#define DRM_FORMAT_ABGR8888	fourcc_code('A', 'B', '2', '4')
+#define DRM_FORMAT_XRGB2101010	fourcc_code('X', 'R', '3', '0')
+#define DRM_FORMAT_ARGB2101010	fourcc_code('A', 'R', '3', '0')
+#define DRM_FORMAT_YUYV		fourcc_code('Y', 'U', 'Y', 'V')
+#define DRM_FORMAT_UYVY		fourcc_code('U', 'Y', 'V', 'Y')
+#define DRM_FORMAT_NV12		fourcc_code('N', 'V', '1', '2')
+
+#define DRM_ROTATE_0		(1 << 0)
+#define DRM_ROTATE_90		(1 << 1)
+#define DRM_ROTATE_180		(1 << 2)
+#define DRM_ROTATE_270		(1 << 3)
+#define DRM_ROTATE_MASK		(DRM_ROTATE_0 | DRM_ROTATE_90 | \
+				 DRM_ROTATE_180 | DRM_ROTATE_270)
+#define DRM_REFLECT_X		(1 << 4)
+#define DRM_REFLECT_Y		(1 << 5)
+
+struct drm_clip_rect {
+	unsigned short x1;
+	unsigned short y1;
+	unsigned short x2;
+	unsigned short y2;
+};
+
+#define may_use_simd() 1
+
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+/* orders the blit core's non-temporal stores */
+#define wmb() __sync_synchronize()
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONFIG_X86 1
+#ifdef __x86_64__
+#define CONFIG_X86_64 1
+#endif
+#define CONFIG_AS_SSSE3 1
+#define CONFIG_AS_AVX2 1
+#define X86_FEATURE_XMM2 "sse2"
+#define X86_FEATURE_SSSE3 "ssse3"
+#define X86_FEATURE_AVX "avx"
+#define X86_FEATURE_AVX2 "avx2"
+#define boot_cpu_has(feature) __builtin_cpu_supports(feature)
+#define cpu_has_xfeatures(mask, name) 1
+#define kernel_fpu_begin() do { } while (0)
+#define kernel_fpu_end() do { } while (0)
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define CONFIG_KERNEL_MODE_NEON 1
+#ifdef __aarch64__
+#define CONFIG_ARM64 1
+#endif
+#ifdef __arm__
+#define CONFIG_ARM 1
+#define cpu_has_neon() 1
+#endif
+#define kernel_neon_begin() do { } while (0)
+#define kernel_neon_end() do { } while (0)
+#endif
+
+#endif /* SDRM_USER_H */